@@ -0,0 +1,146 @@
+/*
+  ==============================================================================
+
+    AllocationTrap.h
+    A debug check that nothing on the audio thread touches the heap.
+
+    Code that must not allocate marks itself with an
+    AllocationTrap::ScopedRealtimeSection. With MIDIPOLYSYNTH_ALLOCATION_TRAP
+    enabled (the default in debug builds), the global allocator is hooked, and
+    any allocation or free made inside such a section prints a message and
+    aborts, or is just counted while a ScopedCountInstead is alive. That covers
+    allocations made inside JUCE as well as our own.
+
+    The hooks themselves are only compiled in the one file that defines
+    MIDIPOLYSYNTH_DEFINE_ALLOCATION_HOOKS before including this header (Main.cpp).
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#ifndef MIDIPOLYSYNTH_ALLOCATION_TRAP
+ #if JUCE_DEBUG
+  #define MIDIPOLYSYNTH_ALLOCATION_TRAP 1
+ #else
+  #define MIDIPOLYSYNTH_ALLOCATION_TRAP 0
+ #endif
+#endif
+
+/** Set this to 0 to have trapped allocations reported on stderr without aborting. */
+#ifndef MIDIPOLYSYNTH_ALLOCATION_TRAP_ABORTS
+ #define MIDIPOLYSYNTH_ALLOCATION_TRAP_ABORTS 1
+#endif
+
+
+namespace AllocationTrap
+{
+    //==============================================================================
+    inline int& getRealtimeDepth() noexcept
+    {
+        thread_local int depth = 0;
+        return depth;
+    }
+
+    inline std::atomic<int>& getNumTrappedAllocations() noexcept
+    {
+        static std::atomic<int> count { 0 };
+        return count;
+    }
+
+    inline std::atomic<int>& getCountInsteadDepth() noexcept
+    {
+        static std::atomic<int> depth { 0 };
+        return depth;
+    }
+
+    constexpr bool isEnabled() noexcept    { return MIDIPOLYSYNTH_ALLOCATION_TRAP != 0; }
+
+    //==============================================================================
+    /** Marks the current thread as real-time for as long as it exists. */
+    struct ScopedRealtimeSection
+    {
+        ScopedRealtimeSection() noexcept     { ++getRealtimeDepth(); }
+        ~ScopedRealtimeSection() noexcept    { --getRealtimeDepth(); }
+
+        JUCE_DECLARE_NON_COPYABLE(ScopedRealtimeSection)
+    };
+
+    /** Counts trapped allocations instead of aborting, so a check can report them all. */
+    struct ScopedCountInstead
+    {
+        ScopedCountInstead() noexcept     { ++getCountInsteadDepth(); }
+        ~ScopedCountInstead() noexcept    { --getCountInsteadDepth(); }
+
+        JUCE_DECLARE_NON_COPYABLE(ScopedCountInstead)
+    };
+
+    /** Called by the hooks on every allocation and free. */
+    inline void check() noexcept
+    {
+        if (getRealtimeDepth() == 0)
+            return;
+
+        getNumTrappedAllocations().fetch_add(1, std::memory_order_relaxed);
+
+        if (getCountInsteadDepth().load(std::memory_order_relaxed) == 0)
+        {
+            // nothing here may allocate, so no juce::String or DBG
+            std::fputs("AllocationTrap: heap allocation or free on the audio thread\n", stderr);
+
+           #if MIDIPOLYSYNTH_ALLOCATION_TRAP_ABORTS
+            std::abort();
+           #endif
+        }
+    }
+}
+
+//==============================================================================
+#if MIDIPOLYSYNTH_ALLOCATION_TRAP && defined (MIDIPOLYSYNTH_DEFINE_ALLOCATION_HOOKS)
+
+ #if defined (__GLIBC__)
+  // Interposing malloc itself catches everything: operator new, HeapBlock, and C code
+  // inside the system libraries.
+  extern "C"
+  {
+      void* __libc_malloc(size_t);
+      void* __libc_calloc(size_t, size_t);
+      void* __libc_realloc(void*, size_t);
+      void __libc_free(void*);
+
+      void* malloc(size_t size)                         { AllocationTrap::check(); return __libc_malloc(size); }
+      void* calloc(size_t count, size_t size)           { AllocationTrap::check(); return __libc_calloc(count, size); }
+      void* realloc(void* ptr, size_t size)             { AllocationTrap::check(); return __libc_realloc(ptr, size); }
+      void free(void* ptr)                              { if (ptr != nullptr) AllocationTrap::check(); __libc_free(ptr); }
+  }
+ #else
+  // Elsewhere only operator new and delete can be replaced portably, so direct malloc
+  // calls (juce::HeapBlock among them) go unnoticed.
+  void* operator new(std::size_t size)
+  {
+      AllocationTrap::check();
+
+      if (auto* ptr = std::malloc(size != 0 ? size : 1))
+          return ptr;
+
+      throw std::bad_alloc();
+  }
+
+  void* operator new[](std::size_t size)                                    { return operator new(size); }
+  void* operator new(std::size_t size, const std::nothrow_t&) noexcept      { AllocationTrap::check(); return std::malloc(size != 0 ? size : 1); }
+  void* operator new[](std::size_t size, const std::nothrow_t&) noexcept    { return operator new(size, std::nothrow); }
+
+  void operator delete(void* ptr) noexcept                                  { if (ptr != nullptr) AllocationTrap::check(); std::free(ptr); }
+  void operator delete[](void* ptr) noexcept                                { operator delete(ptr); }
+  void operator delete(void* ptr, std::size_t) noexcept                     { operator delete(ptr); }
+  void operator delete[](void* ptr, std::size_t) noexcept                   { operator delete(ptr); }
+  void operator delete(void* ptr, const std::nothrow_t&) noexcept           { operator delete(ptr); }
+  void operator delete[](void* ptr, const std::nothrow_t&) noexcept         { operator delete(ptr); }
+ #endif
+
+#endif
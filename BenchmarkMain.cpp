@@ -0,0 +1,23 @@
+/*
+  ==============================================================================
+
+    BenchmarkMain.cpp
+    The entry point for the benchmarks as a console build with no GUI modules:
+    MidiPolySynthBenchmarks [--checks] [--block-size n], with the same options
+    as the app's --benchmark. The exit code is non-zero if any check failed.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+
+#define MIDIPOLYSYNTH_DEFINE_ALLOCATION_HOOKS 1
+#include "AllocationTrap.h"
+
+#include "Benchmarks.h"
+
+//==============================================================================
+int main(int argc, char* argv[])
+{
+    return Benchmarks::runAll(juce::StringArray(argv + 1, argc - 1));
+}
@@ -0,0 +1,1519 @@
+/*
+  ==============================================================================
+
+    Benchmarks.h
+    Timing runs for the DSP hot paths, and checks that fail the run when a
+    result falls outside its threshold. Start the app with --benchmark, or run
+    the console build from BenchmarkMain.cpp, to run them. Each result is
+    printed to stdout as one line of JSON, so runs from different commits can
+    be compared.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <iostream>
+#include <numeric>
+#include <thread>
+#include "AllocationTrap.h"
+#include "EffectsBus.h"
+#include "FFT.h"
+#include "Filter.h"
+#include "MidiEventQueue.h"
+#include "Scope.h"
+#include "PolySynthesiser.h"
+#include "SubBlockRenderer.h"
+#include "VoiceEngine.h"
+#include "WavetableLibrary.h"
+
+
+namespace Benchmarks
+{
+    //==============================================================================
+    /** Runs a block-processing function repeatedly and keeps the fastest pass, which
+        is the one least disturbed by the rest of the system.
+    */
+    struct Runner
+    {
+        double sampleRate = 48000.0;
+        int blockSize = 64;
+        int blocksPerPass = 20000;
+        int numPasses = 5;
+
+        /** A copy that does proportionally fewer blocks, for work that costs about
+            costFactor times as much per sample.
+        */
+        Runner scaledDownBy(int costFactor) const
+        {
+            auto scaled = *this;
+            scaled.blocksPerPass = juce::jmax(200, blocksPerPass / juce::jmax(1, costFactor));
+            return scaled;
+        }
+
+        template <typename ProcessBlock>
+        double measureNanosecondsPerSample(ProcessBlock&& processBlock) const
+        {
+            for (int i = 0; i < blocksPerPass / 10; ++i)
+                processBlock();
+
+            auto best = std::numeric_limits<double>::max();
+
+            for (int pass = 0; pass < numPasses; ++pass)
+            {
+                auto start = juce::Time::getHighResolutionTicks();
+
+                for (int i = 0; i < blocksPerPass; ++i)
+                    processBlock();
+
+                auto seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start);
+                best = juce::jmin(best, seconds * 1.0e9 / ((double)blocksPerPass * (double)blockSize));
+            }
+
+            return best;
+        }
+    };
+
+    inline void report(const juce::String& name, std::initializer_list<std::pair<const char*, double>> values)
+    {
+        std::cout << "{\"benchmark\": \"" << name << "\"";
+
+        for (auto& value : values)
+            std::cout << ", \"" << value.first << "\": " << value.second;
+
+        std::cout << "}" << std::endl;
+    }
+
+    /** Like report(), for a result with a pass threshold. Adds whether it passed to the
+        line, and returns that.
+    */
+    inline bool check(const juce::String& name, bool passed, std::initializer_list<std::pair<const char*, double>> values)
+    {
+        std::cout << "{\"benchmark\": \"" << name << "\", \"passed\": " << (passed ? "true" : "false");
+
+        for (auto& value : values)
+            std::cout << ", \"" << value.first << "\": " << value.second;
+
+        std::cout << "}" << std::endl;
+        return passed;
+    }
+
+    /** Cycles are estimated from the nominal clock speed, so treat them as a guide when
+        the CPU boosts or throttles.
+    */
+    inline double getCyclesPerNanosecond()
+    {
+        static const double cyclesPerNanosecond = juce::SystemStats::getCpuSpeedInMegahertz() / 1000.0;
+        return cyclesPerNanosecond;
+    }
+
+    /** Reports what numVoices voices cost together, per output sample, per voice-sample,
+        and as the fraction of one core they'd take in real time at runner's buffer size.
+    */
+    inline void report(const juce::String& name, const Runner& runner, double nanosecondsPerSample, int numVoices = 1)
+    {
+        auto nanosecondsPerVoiceSample = nanosecondsPerSample / juce::jmax(1, numVoices);
+
+        report(name, { { "voices", (double)numVoices },
+                       { "block_size", (double)runner.blockSize },
+                       { "ns_per_sample", nanosecondsPerSample },
+                       { "ns_per_voice_sample", nanosecondsPerVoiceSample },
+                       { "cycles_per_voice_sample", nanosecondsPerVoiceSample * getCyclesPerNanosecond() },
+                       { "cpu_fraction", nanosecondsPerSample * runner.sampleRate * 1.0e-9 } });
+    }
+
+    /** Stops the optimiser throwing away work whose result is never used. */
+    inline void keep(float value)
+    {
+        static volatile float sink;
+        sink = value;
+    }
+
+    //==============================================================================
+    /** The block renderer against the scalar reference, over a long note at several
+        frequencies and morph positions. Passes if no sample is further apart than the
+        tolerance.
+
+        The reference's float index wanders off on its own over a long note, which is
+        what the fixed-point phase is there to stop, so it's moved to the block
+        renderer's phase before each block. scalar_drift_samples is how far a reference
+        left to run freely got by the end.
+    */
+    inline bool runOscillatorChecks(const Runner& runner)
+    {
+        const int blockSize = 64;
+        const float tolerance = 1.0e-3f;
+        const double phaseToIndex = (double)tableSize / 4294967296.0;
+        auto numBlocks = (int)(10.0 * runner.sampleRate) / blockSize;
+        auto allPassed = true;
+
+        for (auto frequency : { 27.5f, 110.0f, 440.0f, 1760.0f, 7040.0f, 13000.0f })
+        {
+            for (auto morph : { 0.0f, 0.37f, 1.0f })
+            {
+                auto& bank = WavetableBank::getInstance();
+                WavetableOscillator reference(bank.getMasterTable()), block(bank.getMasterTable()), freeRunning(bank.getMasterTable());
+
+                for (auto* oscillator : { &reference, &block, &freeRunning })
+                    oscillator->setFrequency(frequency, (float)runner.sampleRate);
+
+                float expected[blockSize], actual[blockSize];
+                auto maxError = 0.0f;
+
+                for (int i = 0; i < numBlocks; ++i)
+                {
+                    reference.currentIndex = (float)(block.phase * phaseToIndex);
+
+                    for (int j = 0; j < blockSize; ++j)
+                    {
+                        expected[j] = reference.getNextSample(morph);
+                        freeRunning.getNextSample(morph);
+                    }
+
+                    block.renderBlock(actual, blockSize, morph, morph);
+
+                    for (int j = 0; j < blockSize; ++j)
+                        maxError = juce::jmax(maxError, std::abs(expected[j] - actual[j]));
+                }
+
+                auto drift = std::abs(freeRunning.currentIndex - block.phase * phaseToIndex);
+                drift = juce::jmin(drift, (double)tableSize - drift);
+
+                allPassed = check("oscillator/paths_match",
+                                  maxError <= tolerance,
+                                  { { "frequency_hz", (double)frequency },
+                                    { "morph", (double)morph },
+                                    { "seconds", numBlocks * blockSize / runner.sampleRate },
+                                    { "max_error", (double)maxError },
+                                    { "tolerance", (double)tolerance },
+                                    { "scalar_drift_samples", drift } }) && allPassed;
+            }
+        }
+
+        return allPassed;
+    }
+
+    /** The scalar oscillator against the block renderer, one voice's worth. */
+    inline void runOscillatorBenchmarks(const Runner& runner)
+    {
+        const int blockSize = runner.blockSize;
+        juce::HeapBlock<float> output((size_t)blockSize);
+
+        WavetableOscillator oscillator(WavetableBank::getInstance().getMasterTable());
+        oscillator.setFrequency(440.0f, (float)runner.sampleRate);
+
+        report("oscillator/get_next_sample", runner, runner.measureNanosecondsPerSample([&]
+        {
+            for (int i = 0; i < blockSize; ++i)
+                output[i] = oscillator.getNextSample(0.0f);
+
+            keep(output[blockSize - 1]);
+        }));
+
+        report("oscillator/render_block", runner, runner.measureNanosecondsPerSample([&]
+        {
+            oscillator.renderBlock(output, blockSize);
+            keep(output[blockSize - 1]);
+        }));
+
+        // sweeping the morph position across every frame of the table should cost the
+        // same as sitting still on one
+        auto morph = 0.0f;
+
+        report("oscillator/render_block_morphing", runner, runner.measureNanosecondsPerSample([&]
+        {
+            auto nextMorph = morph >= 1.0f ? 0.0f : juce::jmin(1.0f, morph + 0.125f);
+            oscillator.renderBlock(output, blockSize, morph, nextMorph);
+            morph = nextMorph;
+            keep(output[blockSize - 1]);
+        }));
+    }
+
+    //==============================================================================
+    /** What the app used to need to keep aliasing down without mip levels: the plain
+        table run at twice the rate, then a windowed-sinc lowpass and every other sample.
+    */
+    struct OversampledOscillator
+    {
+        static constexpr int numTaps = 63;
+
+        OversampledOscillator(int maximumBlockSize)
+            : oscillator(WavetableBank::getInstance().getNaiveMasterTable())
+        {
+            input.calloc((size_t)(numTaps - 1 + 2 * maximumBlockSize));
+
+            // cut off just below the output's Nyquist frequency, with a Blackman window
+            const double cutoff = 0.23;
+
+            for (int i = 0; i < numTaps; ++i)
+            {
+                auto n = i - (numTaps - 1) / 2;
+                auto sinc = n == 0 ? 2.0 * cutoff : std::sin(juce::MathConstants<double>::twoPi * cutoff * n) / (juce::MathConstants<double>::pi * n);
+                auto window = 0.42 - 0.5 * std::cos(juce::MathConstants<double>::twoPi * i / (numTaps - 1))
+                                   + 0.08 * std::cos(2.0 * juce::MathConstants<double>::twoPi * i / (numTaps - 1));
+                taps[i] = (float)(sinc * window);
+            }
+        }
+
+        void setFrequency(float frequency, float sampleRate)    { oscillator.setFrequency(frequency, 2.0f * sampleRate); }
+
+        void renderBlock(float* dst, int numSamples) noexcept
+        {
+            oscillator.renderBlock(input + numTaps - 1, 2 * numSamples);
+
+            for (int i = 0; i < numSamples; ++i)
+            {
+                auto* window = input + 2 * i;
+                auto sum = 0.0f;
+
+                for (int tap = 0; tap < numTaps; ++tap)
+                    sum += taps[tap] * window[tap];
+
+                dst[i] = sum;
+            }
+
+            std::memmove(input, input + 2 * numSamples, sizeof(float) * (size_t)(numTaps - 1));
+        }
+
+        WavetableOscillator oscillator;
+        juce::HeapBlock<float> input;
+        float taps[numTaps];
+    };
+
+    /** How far above everything else the harmonics of a note are, in dB. The note is
+        tuned to fit a whole number of cycles into the analysis, so its harmonics land
+        exactly on every numCycles'th bin and anything else is aliasing or
+        interpolation noise.
+    */
+    template <typename Oscillator>
+    double measureSignalToNoise(Oscillator& oscillator, double sampleRate, int numCycles)
+    {
+        const int fftSize = 8192, blockSize = 256;
+
+        oscillator.setFrequency((float)(sampleRate * numCycles / fftSize), (float)sampleRate);
+
+        std::vector<float> output((size_t)(fftSize + blockSize));
+
+        for (int i = 0; i < fftSize + blockSize; i += blockSize)
+            oscillator.renderBlock(output.data() + i, blockSize);
+
+        // the first block lets any filter settle
+        std::vector<std::complex<float>> spectrum(output.begin() + blockSize, output.end());
+        RadixTwoFFT(fftSize).perform(spectrum.data(), false);
+
+        auto signal = 0.0, noise = 0.0;
+
+        for (int bin = 1; bin <= fftSize / 2; ++bin)
+            (bin % numCycles == 0 ? signal : noise) += std::norm(spectrum[(size_t)bin]);
+
+        return 10.0 * std::log10(signal / juce::jmax(1.0e-30, noise));
+    }
+
+    /** The mip-mapped master table against the plain one, at 1x and 2x oversampled: signal
+        to aliasing for a few notes up the keyboard. Passes if the mip-mapped table stays
+        at least minimumSignalToNoise above its aliasing at every note, and beats the
+        oversampled plain table by a clear margin.
+    */
+    inline bool runAliasingChecks(const Runner& runner)
+    {
+        const double minimumSignalToNoise = 70.0, minimumGainOverOversampling = 40.0;
+        auto allPassed = true;
+
+        for (auto numCycles : { 45, 179, 357, 715 })
+        {
+            WavetableOscillator mipmapped(WavetableBank::getInstance().getMasterTable());
+            WavetableOscillator naive(WavetableBank::getInstance().getNaiveMasterTable());
+            OversampledOscillator oversampled(256);
+
+            auto mipmappedSignalToNoise = measureSignalToNoise(mipmapped, runner.sampleRate, numCycles);
+            auto oversampledSignalToNoise = measureSignalToNoise(oversampled, runner.sampleRate, numCycles);
+
+            allPassed = check("aliasing/" + juce::String(juce::roundToInt(runner.sampleRate * numCycles / 8192.0)) + "hz",
+                              mipmappedSignalToNoise >= minimumSignalToNoise
+                                && mipmappedSignalToNoise >= oversampledSignalToNoise + minimumGainOverOversampling,
+                              { { "snr_mipmapped_db", mipmappedSignalToNoise },
+                                { "snr_naive_db", measureSignalToNoise(naive, runner.sampleRate, numCycles) },
+                                { "snr_naive_2x_oversampled_db", oversampledSignalToNoise },
+                                { "minimum_snr_db", minimumSignalToNoise } }) && allPassed;
+        }
+
+        return allPassed;
+    }
+
+    /** What the mip-mapped table costs against the plain one 2x oversampled. */
+    inline void runAliasingBenchmarks(const Runner& runner)
+    {
+        const int blockSize = runner.blockSize;
+        juce::HeapBlock<float> output((size_t)blockSize);
+
+        WavetableOscillator mipmapped(WavetableBank::getInstance().getMasterTable());
+        mipmapped.setFrequency(2093.0f, (float)runner.sampleRate);
+
+        report("oscillator/mipmapped", runner, runner.measureNanosecondsPerSample([&]
+        {
+            mipmapped.renderBlock(output, blockSize);
+            keep(output[blockSize - 1]);
+        }));
+
+        OversampledOscillator oversampled(blockSize);
+        oversampled.setFrequency(2093.0f, (float)runner.sampleRate);
+
+        report("oscillator/naive_2x_oversampled", runner, runner.measureNanosecondsPerSample([&]
+        {
+            oversampled.renderBlock(output, blockSize);
+            keep(output[blockSize - 1]);
+        }));
+    }
+
+    /** juce::ADSR as SynthVoice uses it, one sample at a time, retriggered often enough
+        to spend time in every stage.
+    */
+    inline void runEnvelopeBenchmarks(const Runner& runner)
+    {
+        const int blockSize = runner.blockSize;
+        juce::HeapBlock<float> output((size_t)blockSize);
+
+        juce::ADSR adsr;
+        adsr.setSampleRate(runner.sampleRate);
+        adsr.setParameters({ 0.005f, 0.005f, 0.5f, 0.005f });
+
+        int blockCount = 0;
+
+        report("envelope/juce_adsr", runner, runner.measureNanosecondsPerSample([&]
+        {
+            auto phase = blockCount++ % 16;
+
+            if (phase == 0)       adsr.noteOn();
+            else if (phase == 12) adsr.noteOff();
+
+            for (int i = 0; i < blockSize; ++i)
+                output[i] = adsr.getNextSample();
+
+            keep(output[blockSize - 1]);
+        }));
+    }
+
+    //==============================================================================
+    /** The old juce::IIRFilter path against the state-variable filter, all with the
+        cutoff swept so the filters have to follow it.
+    */
+    inline void runFilterBenchmarks(const Runner& runner)
+    {
+        const double rate = 48000.0;
+        const int blockSize = runner.blockSize;
+
+        juce::HeapBlock<float> input((size_t)blockSize), output((size_t)blockSize), g((size_t)blockSize), k((size_t)blockSize);
+        juce::Random random(1);
+
+        for (int i = 0; i < blockSize; ++i)
+        {
+            input[i] = random.nextFloat() * 2.0f - 1.0f;
+            auto coefficients = FilterCoefficients::make(rate, 200.0 + 100.0 * i, FilterCoefficients::butterworthQ);
+            g[i] = coefficients.g;
+            k[i] = coefficients.k;
+        }
+
+        {
+            juce::IIRFilter filter;
+            filter.setCoefficients(juce::IIRCoefficients::makeLowPass(rate, 1000.0));
+
+            report("filter/juce_iir_static", runner, runner.measureNanosecondsPerSample([&]
+            {
+                for (int i = 0; i < blockSize; ++i)
+                    output[i] = filter.processSingleSampleRaw(input[i]);
+
+                keep(output[blockSize - 1]);
+            }));
+        }
+
+        {
+            // what following a modulated cutoff costs the IIRFilter: new coefficients
+            // every sample, each behind the filter's lock
+            juce::IIRFilter filter;
+
+            report("filter/juce_iir_modulated", runner, runner.measureNanosecondsPerSample([&]
+            {
+                for (int i = 0; i < blockSize; ++i)
+                {
+                    filter.setCoefficients(juce::IIRCoefficients::makeLowPass(rate, 200.0 + 100.0 * i));
+                    output[i] = filter.processSingleSampleRaw(input[i]);
+                }
+
+                keep(output[blockSize - 1]);
+            }));
+        }
+
+        {
+            StateVariableFilter filter;
+
+            report("filter/svf_modulated", runner, runner.measureNanosecondsPerSample([&]
+            {
+                juce::FloatVectorOperations::copy(output, input, blockSize);
+                filter.processBlock(output, g, k, blockSize, FilterMode::lowPass);
+                keep(output[blockSize - 1]);
+            }));
+        }
+
+        {
+            // one filter per lane, so this is the cost per voice-sample
+            SIMDStateVariableFilter filter;
+            auto weights = FilterModeWeights::forMode(FilterMode::lowPass);
+            auto sum = SIMDFloat::expand(0.0f);
+
+            report("filter/svf_simd_modulated_per_voice", runner, runner.measureNanosecondsPerSample([&]
+            {
+                for (int i = 0; i < blockSize; ++i)
+                    sum = sum + filter.processSample(SIMDFloat::expand(input[i]), SIMDFloat::expand(g[i]), SIMDFloat::expand(k[i]), weights);
+
+                filter.snapToZero();
+                keep(sum.sum());
+            }) / (double)SIMDFloat::size);
+        }
+    }
+
+    //==============================================================================
+    /** A MIDI buffer that starts numNotes notes at once, spread over all 16 channels. */
+    inline juce::MidiBuffer makeChord(int numNotes)
+    {
+        juce::MidiBuffer chord;
+
+        for (int i = 0; i < numNotes; ++i)
+            chord.addEvent(juce::MidiMessage::noteOn(1 + i % 16, 36 + (i / 16) % 64, (juce::uint8)100), 0);
+
+        return chord;
+    }
+
+    /** Times whole blocks of a synth, the way the audio callback drives it: smoothed
+        parameters into the control state, then the render. startMidi is played in the
+        first block, and addBlockMidi can add events to every block after that.
+    */
+    template <typename SynthType, typename AddBlockMidi>
+    double measureSynth(const Runner& runner, SynthType& synth, SharedControlState& controlState,
+                        const SynthParameters& parameters, const juce::MidiBuffer& startMidi,
+                        AddBlockMidi&& addBlockMidi)
+    {
+        const int blockSize = runner.blockSize;
+
+        SynthParameterSmoother smoother;
+        smoother.prepare(runner.sampleRate, parameters);
+        controlState.prepare(runner.sampleRate, blockSize);
+        synth.prepare(runner.sampleRate, 2, blockSize);
+
+        juce::AudioBuffer<float> buffer(2, blockSize);
+        juce::MidiBuffer midi;
+        int blockCount = 0;
+
+        auto renderBlock = [&](const juce::MidiBuffer& blockMidi)
+        {
+            buffer.clear();
+            controlState.beginBlock(blockSize, smoother.process(parameters, blockSize));
+            synth.renderNextBlock(buffer, blockMidi, 0, blockSize);
+            keep(buffer.getSample(0, blockSize - 1));
+        };
+
+        renderBlock(startMidi);
+
+        return runner.measureNanosecondsPerSample([&]
+        {
+            midi.clear();
+            addBlockMidi(midi, blockCount++);
+            renderBlock(midi);
+        });
+    }
+
+    /** SynthVoice through PolySynthesiser, and the structure-of-arrays engine, holding
+        chords of a range of sizes.
+    */
+    inline void runVoiceBenchmarks(const Runner& runner)
+    {
+        SynthParameters parameters;
+        parameters.filterCutoff = 5000.0f;
+
+        auto noBlockMidi = [](juce::MidiBuffer&, int) {};
+
+        for (auto numVoices : { 1, 3, 16, 64, 256 })
+        {
+            auto scaledRunner = runner.scaledDownBy(numVoices);
+
+            {
+                SharedControlState controlState;
+                PolySynthesiser synth;
+
+                for (int i = 0; i < numVoices; ++i)
+                    synth.addVoice(new SynthVoice(controlState));
+
+                synth.enableLegacyMode(24);
+                synth.setVoiceStealingEnabled(false);
+
+                report("voices/synth_voice/" + juce::String(numVoices), runner,
+                       measureSynth(scaledRunner, synth, controlState, parameters, makeChord(numVoices), noBlockMidi),
+                       numVoices);
+            }
+
+            {
+                SharedControlState controlState;
+                SoAVoiceEngine synth(controlState);
+                synth.enableLegacyMode(24);
+
+                report("voices/soa_engine/" + juce::String(numVoices), runner,
+                       measureSynth(scaledRunner, synth, controlState, parameters, makeChord(numVoices), noBlockMidi),
+                       numVoices);
+            }
+        }
+    }
+
+    /** Both engines at 64 voices with a full modulation matrix: every route in use,
+        reaching all four destinations. Compare with voices/.../64 for the matrix's cost.
+    */
+    inline void runModulationBenchmarks(const Runner& runner)
+    {
+        const int numVoices = 64;
+
+        SynthParameters parameters;
+        parameters.filterCutoff = 5000.0f;
+        parameters.modulation.envelope2 = { 0.2f, 0.5f, 0.3f, 0.5f };
+        parameters.modulation.lfos[1] = { 0.3f, LFOShape::triangle };
+
+        const ModulationSource sources[] = { ModulationSource::lfo1, ModulationSource::lfo2,
+                                             ModulationSource::envelope2, ModulationSource::pressure };
+
+        for (int i = 0; i < ModulationParameters::maxRoutes; ++i)
+            parameters.modulation.routes[i] = { sources[i % 4], (ModulationDestination)(i % numModulationDestinations), 0.1f };
+
+        auto noBlockMidi = [](juce::MidiBuffer&, int) {};
+        auto scaledRunner = runner.scaledDownBy(numVoices);
+
+        {
+            SharedControlState controlState;
+            PolySynthesiser synth;
+
+            for (int i = 0; i < numVoices; ++i)
+                synth.addVoice(new SynthVoice(controlState));
+
+            synth.enableLegacyMode(24);
+            synth.setVoiceStealingEnabled(false);
+
+            report("modulation/synth_voice/" + juce::String(numVoices), runner,
+                   measureSynth(scaledRunner, synth, controlState, parameters, makeChord(numVoices), noBlockMidi),
+                   numVoices);
+        }
+
+        {
+            SharedControlState controlState;
+            SoAVoiceEngine synth(controlState);
+            synth.enableLegacyMode(24);
+
+            report("modulation/soa_engine/" + juce::String(numVoices), runner,
+                   measureSynth(scaledRunner, synth, controlState, parameters, makeChord(numVoices), noBlockMidi),
+                   numVoices);
+        }
+    }
+
+    /** What numVoices voices playing a chord cost, each with unisonVoices copies. */
+    inline double measureUnison(const Runner& runner, int numVoices, int unisonVoices)
+    {
+        SynthParameters parameters;
+        parameters.filterCutoff = 5000.0f;
+        parameters.unisonVoices = unisonVoices;
+
+        SharedControlState controlState;
+        PolySynthesiser synth;
+
+        for (int i = 0; i < numVoices; ++i)
+            synth.addVoice(new SynthVoice(controlState));
+
+        synth.enableLegacyMode(24);
+        synth.setVoiceStealingEnabled(false);
+
+        return measureSynth(runner, synth, controlState, parameters, makeChord(numVoices),
+                            [](juce::MidiBuffer&, int) {});
+    }
+
+    /** One note with an N-copy unison stack against N separate voices each playing a note,
+        which is what stacking by hand would cost. The stack shares its envelope, filter
+        coefficients and modulation, and runs its copies in SIMD lanes, so cost_ratio (the
+        stack's cost over the separate voices') should fall as N grows.
+    */
+    inline void runUnisonBenchmarks(const Runner& runner)
+    {
+        for (auto numCopies : { 1, 2, 4, 8, 16 })
+        {
+            auto scaledRunner = runner.scaledDownBy(numCopies);
+            auto stacked = measureUnison(scaledRunner, 1, numCopies);
+            auto separate = measureUnison(scaledRunner, numCopies, 1);
+
+            report("unison/stacked/" + juce::String(numCopies), runner, stacked, numCopies);
+            report("unison/separate_voices/" + juce::String(numCopies), runner, separate, numCopies);
+            report("unison/cost_ratio/" + juce::String(numCopies), { { "stacked_over_separate", stacked / separate } });
+        }
+    }
+
+    /** Checks that a full 16-copy stack scales sub-linearly: it has to cost less than 16
+        separate voices, and less than 16 times a single copy.
+
+        Both are loose limits, which the stack should come in well under, so a busy
+        machine doesn't fail it by chance. Each setup is also measured numRepeats times,
+        alternating between them, and only the fastest of each counts, as noise only
+        ever makes a run slower.
+    */
+    inline bool runUnisonCheck(const Runner& runner)
+    {
+        const int numCopies = 16, numRepeats = 5;
+        auto scaledRunner = runner.scaledDownBy(numCopies);
+        auto stacked = 0.0, separate = 0.0, singleCopy = 0.0;
+
+        for (int i = 0; i < numRepeats; ++i)
+        {
+            auto keepFastest = [i](double& fastest, double nanoseconds)
+            {
+                fastest = i == 0 ? nanoseconds : juce::jmin(fastest, nanoseconds);
+            };
+
+            keepFastest(stacked,    measureUnison(scaledRunner, 1, numCopies));
+            keepFastest(separate,   measureUnison(scaledRunner, numCopies, 1));
+            keepFastest(singleCopy, measureUnison(scaledRunner, 1, 1));
+        }
+
+        return check("unison/scaling/" + juce::String(numCopies),
+                     stacked < separate && stacked < singleCopy * numCopies,
+                     { { "repeats", (double)numRepeats },
+                       { "stacked_over_separate", stacked / separate },
+                       { "stacked_over_single_copy", stacked / singleCopy } });
+    }
+
+    /** The full MPESynthesiser in MPE mode, with every note's pitch bend, pressure and
+        timbre moving every block. Timbre drives the cutoff, so each voice has to work
+        out its own filter coefficients too.
+    */
+    inline void runMPEBenchmarks(const Runner& runner)
+    {
+        const int numVoices = 15;
+
+        SynthParameters parameters;
+        parameters.filterCutoff = 2000.0f;
+        parameters.timbreToCutoff = 2.0f;
+
+        SharedControlState controlState;
+        PolySynthesiser synth;
+
+        for (int i = 0; i < numVoices; ++i)
+            synth.addVoice(new SynthVoice(controlState));
+
+        juce::MPEZoneLayout layout;
+        layout.setLowerZone(numVoices);
+        synth.setZoneLayout(layout);
+        synth.setVoiceStealingEnabled(false);
+
+        // one note per member channel, 2 to 16
+        juce::MidiBuffer notes;
+
+        for (int i = 0; i < numVoices; ++i)
+            notes.addEvent(juce::MidiMessage::noteOn(2 + i, 48 + i, (juce::uint8)100), 0);
+
+        auto blockSize = runner.blockSize;
+
+        report("mpe/synth_voice/" + juce::String(numVoices), runner,
+               measureSynth(runner.scaledDownBy(numVoices), synth, controlState, parameters, notes, [=](juce::MidiBuffer& midi, int block)
+               {
+                   for (int i = 0; i < numVoices; ++i)
+                   {
+                       auto channel = 2 + i;
+                       auto wobble = std::sin(0.05 * block + i);
+                       auto position = (i * blockSize) / numVoices;
+
+                       midi.addEvent(juce::MidiMessage::pitchWheel(channel, 8192 + (int)(1000.0 * wobble)), position);
+                       midi.addEvent(juce::MidiMessage::channelPressureChange(channel, 64 + (int)(60.0 * wobble)), position);
+                       midi.addEvent(juce::MidiMessage::controllerEvent(channel, 74, 64 - (int)(60.0 * wobble)), position);
+                   }
+               }),
+               numVoices);
+    }
+
+    //==============================================================================
+    /** A parameter change in the middle of a large block, against the same change at the
+        start of a block of its own, which is where small blocks would put it. Passes if
+        the two renders match within the tolerance, so the change landed on its sample.
+        error_if_applied_per_block is how far off applying it at the next block boundary
+        instead would be.
+    */
+    inline bool runSubBlockChecks(const Runner& runner)
+    {
+        const int numVoices = 8, blockSize = 2048, changePosition = 512;
+        const float tolerance = 1.0e-5f;
+
+        SynthParameters before, after;
+        before.filterCutoff = 4000.0f;
+        after = before;
+        after.filterCutoff = 300.0f;
+        after.filterResonance = 2.0f;
+        after.morph = 0.5f;
+
+        // renders the blocks one after another, with the change queued at changeSample
+        auto render = [&](std::initializer_list<int> blockLengths, int changeSample)
+        {
+            SharedControlState controlState;
+            SynthParameterSmoother smoother;
+            SubBlockRenderer subBlockRenderer { smoother, controlState };
+            PolySynthesiser synth;
+
+            for (int i = 0; i < numVoices; ++i)
+                synth.addVoice(new SynthVoice(controlState));
+
+            smoother.prepare(runner.sampleRate, before);
+            controlState.prepare(runner.sampleRate, blockSize);
+            subBlockRenderer.prepare(before);
+            synth.prepare(runner.sampleRate, 2, blockSize);
+
+            juce::AudioBuffer<float> buffer(2, blockSize);
+            auto chord = makeChord(numVoices);
+            juce::MidiBuffer noMidi;
+            std::vector<float> output;
+            int start = 0;
+
+            for (auto length : blockLengths)
+            {
+                if (changeSample >= start && changeSample < start + length)
+                    subBlockRenderer.addParameterChange(changeSample - start, after);
+
+                buffer.clear();
+                subBlockRenderer.render(synth, buffer, start == 0 ? chord : noMidi, length);
+
+                for (int i = 0; i < length; ++i)
+                    for (int channel = 0; channel < 2; ++channel)
+                        output.push_back(buffer.getSample(channel, i));
+
+                start += length;
+            }
+
+            return output;
+        };
+
+        auto maxDifference = [](const std::vector<float>& a, const std::vector<float>& b)
+        {
+            auto difference = 0.0f;
+
+            for (size_t i = 0; i < juce::jmin(a.size(), b.size()); ++i)
+                difference = juce::jmax(difference, std::abs(a[i] - b[i]));
+
+            return difference;
+        };
+
+        auto split = render({ blockSize, blockSize, blockSize }, changePosition);
+        auto reference = render({ changePosition, blockSize - changePosition, blockSize, blockSize }, changePosition);
+        auto perBlock = render({ blockSize, blockSize, blockSize }, blockSize);
+        auto error = maxDifference(split, reference);
+
+        return check("sub_block/change_lands_on_its_sample", error <= tolerance,
+                     { { "voices", (double)numVoices },
+                       { "block_size", (double)blockSize },
+                       { "change_position", (double)changePosition },
+                       { "max_error", (double)error },
+                       { "tolerance", (double)tolerance },
+                       { "error_if_applied_per_block", (double)maxDifference(perBlock, reference) } });
+    }
+
+    //==============================================================================
+    /** A chord through SubBlockRenderer at a large block size, with no parameter changes,
+        a few per block, and a change every few samples. The last one shows how much the
+        minimum sub-block size saves, against splitting at every change.
+    */
+    inline void runSubBlockBenchmarks(const Runner& runner)
+    {
+        const int numVoices = 16, blockSize = 2048;
+
+        auto largeBlocks = runner.scaledDownBy(numVoices * blockSize / juce::jmax(1, runner.blockSize));
+        largeBlocks.blockSize = blockSize;
+
+        struct Case
+        {
+            const char* name;
+            int changeInterval, minimumSubBlockSize;
+        };
+
+        for (auto& test : { Case { "none",        0,    SubBlockRenderer::defaultMinimumSubBlockSize },
+                            Case { "every_512",   512,  SubBlockRenderer::defaultMinimumSubBlockSize },
+                            Case { "every_8",     8,    SubBlockRenderer::defaultMinimumSubBlockSize },
+                            Case { "every_8_unmerged", 8, SharedControlState::controlInterval } })
+        {
+            SynthParameters parameters;
+            parameters.filterCutoff = 2000.0f;
+
+            SharedControlState controlState;
+            SynthParameterSmoother smoother;
+            SubBlockRenderer subBlockRenderer { smoother, controlState };
+            PolySynthesiser synth;
+
+            for (int i = 0; i < numVoices; ++i)
+                synth.addVoice(new SynthVoice(controlState));
+
+            smoother.prepare(largeBlocks.sampleRate, parameters);
+            controlState.prepare(largeBlocks.sampleRate, blockSize);
+            subBlockRenderer.prepare(parameters, blockSize);
+            subBlockRenderer.setMinimumSubBlockSize(test.minimumSubBlockSize);
+            synth.prepare(largeBlocks.sampleRate, 2, blockSize);
+
+            juce::AudioBuffer<float> buffer(2, blockSize);
+            juce::MidiBuffer noMidi;
+            auto chord = makeChord(numVoices);
+            int block = 0, numPieces = 0;
+
+            auto renderBlock = [&](const juce::MidiBuffer& midi)
+            {
+                for (int position = 0; test.changeInterval > 0 && position < blockSize; position += test.changeInterval)
+                {
+                    parameters.filterCutoff = 2000.0f + 1000.0f * (float)std::sin(0.001 * (block * blockSize + position));
+                    subBlockRenderer.addParameterChange(position, parameters);
+                }
+
+                buffer.clear();
+                numPieces = subBlockRenderer.render(synth, buffer, midi, blockSize);
+                keep(buffer.getSample(0, blockSize - 1));
+                ++block;
+            };
+
+            renderBlock(chord);
+            auto nanosecondsPerSample = largeBlocks.measureNanosecondsPerSample([&] { renderBlock(noMidi); });
+
+            report("sub_block/parameter_changes_" + juce::String(test.name),
+                   { { "voices", (double)numVoices },
+                     { "block_size", (double)blockSize },
+                     { "minimum_sub_block", (double)test.minimumSubBlockSize },
+                     { "sub_blocks_per_block", (double)numPieces },
+                     { "ns_per_sample", nanosecondsPerSample } });
+        }
+    }
+
+    //==============================================================================
+    /** Plays a dense MPE stream (notes starting and stopping on every channel, with
+        pitch bend, pressure and timbre in between) through the synth, serially and
+        across the worker pool, then switches voice engines with a chord held, and
+        counts every heap allocation the render makes. Returns true if there were none.
+
+        Without MIDIPOLYSYNTH_ALLOCATION_TRAP there's nothing to count with, so the check
+        is reported as skipped rather than passed. The benchmark build turns the trap on
+        in every configuration, so ctest always runs it.
+    */
+    inline bool runAllocationCheck(const Runner& runner)
+    {
+        if (! AllocationTrap::isEnabled())
+        {
+            std::cout << "{\"benchmark\": \"allocations\", \"skipped\": true, "
+                         "\"reason\": \"built without MIDIPOLYSYNTH_ALLOCATION_TRAP\"}" << std::endl;
+            return true;
+        }
+
+        const int numChannels = 15, numBlocks = 2000;
+        const int blockSize = runner.blockSize;
+
+        SynthParameters parameters;
+        parameters.filterCutoff = 2000.0f;
+        parameters.timbreToCutoff = 2.0f;
+
+        SharedControlState controlState;
+        SynthParameterSmoother smoother;
+        SubBlockRenderer subBlockRenderer { smoother, controlState };
+        PolySynthesiser synth;
+
+        for (int i = 0; i < numChannels; ++i)
+            synth.addVoice(new SynthVoice(controlState));
+
+        juce::MPEZoneLayout layout;
+        layout.setLowerZone(numChannels);
+        synth.setZoneLayout(layout);
+
+        smoother.prepare(runner.sampleRate, parameters);
+        controlState.prepare(runner.sampleRate, blockSize);
+        subBlockRenderer.prepare(parameters);
+        synth.prepare(runner.sampleRate, 2, blockSize);
+
+        juce::AudioBuffer<float> buffer(2, blockSize);
+        juce::MidiBuffer midi;
+        midi.ensureSize(8192);
+
+        auto allPassed = true;
+
+        for (auto numWorkers : { 0, juce::jmin(3, RenderWorkerPool::getDefaultNumWorkers()) })
+        {
+            synth.setParallelRenderingEnabled(numWorkers > 0, numWorkers);
+
+            AllocationTrap::ScopedCountInstead countInstead;
+            auto allocationsBefore = AllocationTrap::getNumTrappedAllocations().load();
+
+            for (int block = 0; block < numBlocks; ++block)
+            {
+                midi.clear();
+
+                for (int i = 0; i < numChannels; ++i)
+                {
+                    auto channel = 2 + i;
+                    auto note = 48 + (block / 8 + i) % 24;
+                    auto wobble = std::sin(0.1 * block + i);
+                    auto position = (i * blockSize) / numChannels;
+
+                    if ((block + i) % 8 == 0)
+                        midi.addEvent(juce::MidiMessage::noteOn(channel, note, (juce::uint8)100), position);
+
+                    midi.addEvent(juce::MidiMessage::pitchWheel(channel, 8192 + (int)(2000.0 * wobble)), position);
+                    midi.addEvent(juce::MidiMessage::channelPressureChange(channel, 64 + (int)(60.0 * wobble)), position);
+                    midi.addEvent(juce::MidiMessage::controllerEvent(channel, 74, 64 - (int)(60.0 * wobble)), position);
+
+                    if ((block + i) % 8 == 5)
+                        midi.addEvent(juce::MidiMessage::noteOff(channel, note), position);
+                }
+
+                AllocationTrap::ScopedRealtimeSection realtimeSection;
+
+                parameters.filterCutoff = 2000.0f + 1000.0f * (float)std::sin(0.1 * block);
+                subBlockRenderer.addParameterChange(blockSize / 2, parameters);
+
+                buffer.clear();
+                subBlockRenderer.render(synth, buffer, midi, blockSize);
+            }
+
+            auto allocations = AllocationTrap::getNumTrappedAllocations().load() - allocationsBefore;
+
+            allPassed = check("allocations/mpe_dense/workers_" + juce::String(numWorkers), allocations == 0,
+                              { { "blocks", (double)numBlocks },
+                                { "allocations", (double)allocations } }) && allPassed;
+        }
+
+        synth.setParallelRenderingEnabled(false);
+
+        // a chord held on every channel while the engines are switched, there and back:
+        // the engine that was left is silenced on this thread, outside the real-time
+        // section, so rendering either side of the switch must not allocate
+        SoAVoiceEngine soaSynth(controlState);
+        soaSynth.setZoneLayout(layout);
+        soaSynth.prepare(runner.sampleRate, 2, blockSize);
+
+        VoiceEngineSelector engineSelector;
+        const int blocksPerEngine = 100, numSwitches = 2;
+
+        {
+            AllocationTrap::ScopedCountInstead countInstead;
+            auto allocationsBefore = AllocationTrap::getNumTrappedAllocations().load();
+
+            for (int block = 0; block < (numSwitches + 1) * blocksPerEngine; ++block)
+            {
+                midi.clear();
+
+                if (block % blocksPerEngine == 0)
+                {
+                    if (block > 0)
+                    {
+                        engineSelector.select(! engineSelector.isSoAEngineSelected(), [&](bool soaEngineWasLeft)
+                        {
+                            soaEngineWasLeft ? soaSynth.turnOffAllVoices() : synth.turnOffAllVoices(false);
+                        });
+                    }
+
+                    for (int i = 0; i < numChannels; ++i)
+                        midi.addEvent(juce::MidiMessage::noteOn(2 + i, 48 + i, (juce::uint8)100), 0);
+                }
+
+                AllocationTrap::ScopedRealtimeSection realtimeSection;
+
+                buffer.clear();
+
+                engineSelector.renderSelected([&](bool soa)
+                {
+                    if (soa)
+                        subBlockRenderer.render(soaSynth, buffer, midi, blockSize);
+                    else
+                        subBlockRenderer.render(synth, buffer, midi, blockSize);
+                });
+            }
+
+            auto allocations = AllocationTrap::getNumTrappedAllocations().load() - allocationsBefore;
+
+            allPassed = check("allocations/engine_switch_held_notes", allocations == 0,
+                              { { "switches", (double)numSwitches },
+                                { "blocks", (double)((numSwitches + 1) * blocksPerEngine) },
+                                { "allocations", (double)allocations } }) && allPassed;
+        }
+
+        return allPassed;
+    }
+
+    //==============================================================================
+    /** What the audio callback pays to feed the scope: mixing a stereo block down and
+        copying it into the tap's ring. The drain that keeps the ring from filling up
+        is included, but with nothing to do per sample it only moves the read position.
+    */
+    inline void runAudioTapBenchmarks(const Runner& runner)
+    {
+        const int blockSize = runner.blockSize;
+        juce::AudioBuffer<float> buffer(2, blockSize);
+        juce::Random random(1);
+
+        for (int channel = 0; channel < 2; ++channel)
+            for (int i = 0; i < blockSize; ++i)
+                buffer.setSample(channel, i, random.nextFloat() * 2.0f - 1.0f);
+
+        AudioTap tap;
+        tap.prepare(runner.sampleRate);
+
+        report("audio_tap/push_stereo", runner, runner.measureNanosecondsPerSample([&]
+        {
+            tap.push(buffer, blockSize);
+            tap.drain([](const float* samples, int numSamples) { keep(samples[numSamples - 1]); });
+        }));
+    }
+
+    /** The effects chain with everything turned up, and what the bus costs the callback
+        inline and pipelined. Pipelined, the callback only copies the block in and out;
+        the calls come back to back here rather than at the block rate, so the effects
+        thread can't keep up and most blocks are counted as overruns.
+    */
+    inline void runEffectsBenchmarks(const Runner& runner)
+    {
+        const int blockSize = runner.blockSize;
+        juce::AudioBuffer<float> buffer(2, blockSize);
+        juce::Random random(1);
+
+        auto fillBuffer = [&]
+        {
+            for (int channel = 0; channel < 2; ++channel)
+                for (int i = 0; i < blockSize; ++i)
+                    buffer.setSample(channel, i, random.nextFloat() * 0.2f - 0.1f);
+        };
+
+        EffectsParameters parameters;
+        parameters.chorusMix = 0.5f;
+        parameters.delayMix = 0.4f;
+        parameters.reverbMix = 0.3f;
+
+        {
+            StereoEffectsChain chain;
+            chain.prepare(runner.sampleRate);
+            fillBuffer();
+
+            report("effects/chain/all_on", runner, runner.measureNanosecondsPerSample([&]
+            {
+                chain.process(buffer.getWritePointer(0), buffer.getWritePointer(1), blockSize, parameters);
+            }));
+        }
+
+        for (auto pipelined : { false, true })
+        {
+            EffectsBus bus;
+            bus.setPipelined(pipelined);
+            bus.prepare(runner.sampleRate, blockSize);
+
+            report(juce::String("effects/bus/") + (pipelined ? "pipelined_callback" : "inline_callback"), runner,
+                   runner.measureNanosecondsPerSample([&]
+                   {
+                       fillBuffer();
+                       bus.process(buffer, blockSize, parameters);
+                   }));
+
+            report(juce::String("effects/bus/") + (pipelined ? "pipelined_latency" : "inline_latency"),
+                   { { "latency_samples", (double)bus.getLatencyInSamples() } });
+            bus.release();
+        }
+    }
+
+    //==============================================================================
+    /** Sends a steady stream of pitch-wheel messages, one every half millisecond, from
+        one thread while another plays the audio callback, waking up at the block rate
+        with some random scheduling delay. Each message carries its own index, so the
+        time it would sound can be compared with the time it arrived. The spread of that
+        latency is the jitter the synth would hear.
+    */
+    template <typename PushMessage, typename RemoveNextBlock>
+    void measureMidiJitter(const juce::String& name, double sampleRate, int blockSize,
+                           PushMessage&& pushMessage, RemoveNextBlock&& removeNextBlock)
+    {
+        const int numEvents = 2000;
+        const double eventInterval = 0.0005;
+        const auto blockDuration = blockSize / sampleRate;
+
+        std::vector<double> arrivalTimes((size_t)numEvents), soundTimes((size_t)numEvents, -1.0);
+
+        auto waitUntil = [](double time)
+        {
+            while (MidiEventQueue::getCurrentTimeInSeconds() < time)
+                std::this_thread::yield();
+        };
+
+        const auto startTime = MidiEventQueue::getCurrentTimeInSeconds() + 0.05;
+
+        std::thread producer([&]
+        {
+            for (int i = 0; i < numEvents; ++i)
+            {
+                waitUntil(startTime + i * eventInterval);
+
+                auto message = juce::MidiMessage::pitchWheel(1, i);
+                arrivalTimes[(size_t)i] = MidiEventQueue::getCurrentTimeInSeconds();
+                message.setTimeStamp(arrivalTimes[(size_t)i]);
+                pushMessage(message);
+            }
+        });
+
+        std::thread consumer([&]
+        {
+            juce::Random random(1);
+            juce::MidiBuffer midi;
+            midi.ensureSize(8192);
+
+            auto numBlocks = (int)((numEvents * eventInterval + 0.1) / blockDuration);
+
+            for (int block = 0; block < numBlocks; ++block)
+            {
+                // the device asks for block k once block k - 1 has been played
+                waitUntil(startTime + (block + 1) * blockDuration + random.nextDouble() * 0.5 * blockDuration);
+
+                midi.clear();
+                removeNextBlock(midi, blockSize);
+
+                for (const auto metadata : midi)
+                    soundTimes[(size_t)metadata.getMessage().getPitchWheelValue()]
+                        = startTime + block * blockDuration + metadata.samplePosition / sampleRate;
+            }
+        });
+
+        producer.join();
+        consumer.join();
+
+        std::vector<double> latencies;
+
+        for (int i = 0; i < numEvents; ++i)
+            if (soundTimes[(size_t)i] >= 0.0)
+                latencies.push_back((soundTimes[(size_t)i] - arrivalTimes[(size_t)i]) * 1000.0);
+
+        if (latencies.empty())
+            return;
+
+        auto mean = std::accumulate(latencies.begin(), latencies.end(), 0.0) / (double)latencies.size();
+        auto variance = 0.0;
+
+        for (auto latency : latencies)
+            variance += (latency - mean) * (latency - mean);
+
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&](double p) { return latencies[(size_t)(p * (double)(latencies.size() - 1))]; };
+
+        report(name + "/block_" + juce::String(blockSize),
+               { { "events", (double)latencies.size() },
+                 { "block_size", (double)blockSize },
+                 { "mean_latency_ms", mean },
+                 { "jitter_ms", std::sqrt(variance / (double)latencies.size()) },
+                 { "p1_to_p99_ms", percentile(0.99) - percentile(0.01) } });
+    }
+
+    /** The MIDI jitter of JUCE's MidiMessageCollector, which the app used to use,
+        against MidiEventQueue's sample-accurate placement.
+    */
+    inline void runMidiJitterBenchmarks(const Runner& runner)
+    {
+        for (auto blockSize : { runner.blockSize, 512 })
+        {
+            juce::MidiMessageCollector collector;
+            collector.reset(runner.sampleRate);
+
+            measureMidiJitter("midi_jitter/collector", runner.sampleRate, blockSize,
+                              [&](const juce::MidiMessage& message) { collector.addMessageToQueue(message); },
+                              [&](juce::MidiBuffer& midi, int numSamples) { collector.removeNextBlockOfMessages(midi, numSamples); });
+
+            MidiEventQueue queue;
+            queue.prepare(runner.sampleRate);
+
+            measureMidiJitter("midi_jitter/event_queue", runner.sampleRate, blockSize,
+                              [&](const juce::MidiMessage& message) { queue.push(message); },
+                              [&](juce::MidiBuffer& midi, int numSamples) { queue.removeNextBlockOfMessages(midi, numSamples); });
+        }
+    }
+
+    //==============================================================================
+    /** How many SynthVoices one core keeps up with in real time, rendering serially
+        and across the worker pool, at a few buffer sizes.
+    */
+    inline void runScalingBenchmarks()
+    {
+        const double rate = 48000.0;
+        const int numVoices = 256;
+        const double secondsOfAudio = 2.0;
+
+        juce::Array<int> workerCounts;
+        auto maxWorkers = RenderWorkerPool::getDefaultNumWorkers();
+
+        for (int n = 0; n < maxWorkers; n = n * 2 + 1)
+            workerCounts.add(n);
+
+        workerCounts.addIfNotAlreadyThere(maxWorkers);
+
+        for (auto blockSize : { 32, 64, 256 })
+        {
+            for (auto numWorkers : workerCounts)
+            {
+                SharedControlState controlState;
+                PolySynthesiser synth;
+
+                for (int i = 0; i < numVoices; ++i)
+                    synth.addVoice(new SynthVoice(controlState));
+
+                synth.enableLegacyMode(24);
+                synth.setVoiceStealingEnabled(false);
+                controlState.prepare(rate, blockSize);
+                synth.prepare(rate, 2, blockSize);
+                synth.setParallelRenderingEnabled(numWorkers > 0, numWorkers);
+
+                juce::AudioBuffer<float> buffer(2, blockSize);
+                SynthParameters parameters;
+                parameters.filterCutoff = 5000.0f;
+
+                auto renderBlock = [&](const juce::MidiBuffer& midi)
+                {
+                    buffer.clear();
+                    controlState.beginBlock(blockSize, parameters);
+                    synth.renderNextBlock(buffer, midi, 0, blockSize);
+                };
+
+                renderBlock(makeChord(numVoices));
+
+                const juce::MidiBuffer noMidi;
+                auto numBlocks = (int)(secondsOfAudio * rate) / blockSize;
+                auto start = juce::Time::getHighResolutionTicks();
+
+                for (int i = 0; i < numBlocks; ++i)
+                    renderBlock(noMidi);
+
+                auto renderSeconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start);
+                auto realtimeFactor = (numBlocks * blockSize / rate) / renderSeconds;
+
+                report("scaling/synth_voice/block_" + juce::String(blockSize) + "/workers_" + juce::String(numWorkers),
+                       { { "voices", (double)numVoices },
+                         { "threads", (double)(numWorkers + 1) },
+                         { "realtime_factor", realtimeFactor },
+                         { "voices_per_core", numVoices * realtimeFactor / (numWorkers + 1) } });
+
+                synth.setParallelRenderingEnabled(false);
+            }
+        }
+    }
+
+    //==============================================================================
+    /** Sample i of frame of synthetic table number table: a handful of harmonics whose
+        mix changes from frame to frame and table to table.
+    */
+    inline float getSyntheticWavetableSample(int table, int frame, int i)
+    {
+        auto x = juce::MathConstants<double>::twoPi * i / tableSize;
+        auto sum = 0.0;
+
+        for (int harmonic = 1; harmonic <= 1 + (table + frame) % 12; ++harmonic)
+            sum += std::sin(harmonic * x + 0.1 * table) * (1.0 + 0.5 * std::sin(0.3 * frame * harmonic)) / harmonic;
+
+        return (float)(0.5 * sum);
+    }
+
+    inline void writeSyntheticWavetables(const juce::File& directory, int numTables, int framesPerTable)
+    {
+        juce::WavAudioFormat wav;
+        juce::AudioBuffer<float> buffer(1, (int)tableSize * framesPerTable);
+
+        for (int table = 0; table < numTables; ++table)
+        {
+            for (int frame = 0; frame < framesPerTable; ++frame)
+                for (int i = 0; i < (int)tableSize; ++i)
+                    buffer.setSample(0, frame * (int)tableSize + i, getSyntheticWavetableSample(table, frame, i));
+
+            auto file = directory.getChildFile("table_" + juce::String(table).paddedLeft('0', 4) + ".wav");
+            std::unique_ptr<juce::OutputStream> stream(file.createOutputStream());
+            std::unique_ptr<juce::AudioFormatWriter> writer(wav.createWriterFor(stream.get(), 48000.0, 1, 32, {}, 0));
+
+            if (writer == nullptr)
+                continue;
+
+            stream.release();
+            writer->writeFromAudioSampleBuffer(buffer, 0, buffer.getNumSamples());
+        }
+    }
+
+    /** A synthetic library of several hundred multi-frame WAV tables, written to a
+        temporary directory and stepped through the way a user goes through presets.
+        Reports how long the scan and each first decode take, how cheap a cache hit
+        is, whether the cache stays within its budget, how closely a decoded table
+        matches what was written, and what the audio thread pays per block to pick
+        up a switch.
+
+        Passes if every table is found and decodes with all its frames, the cache had
+        to evict and never held more than its budget plus the two tables in use, and
+        the decoded table is within maxDecodeError of what was written.
+    */
+    inline bool runWavetableLibraryChecks(const Runner& runner)
+    {
+        const int numTables = 300, framesPerTable = 16;
+        const double maxDecodeError = 1.0e-4;
+
+        auto directory = juce::File::getSpecialLocation(juce::File::tempDirectory).getChildFile("MidiPolySynthWavetables");
+        directory.deleteRecursively();
+        directory.createDirectory();
+        writeSyntheticWavetables(directory, numTables, framesPerTable);
+
+        // room for about a tenth of the library, so stepping through it has to evict
+        auto tableBytes = sizeof(float) * (size_t)numMipLevels * (size_t)framesPerTable * totalTableSize;
+        auto cacheBudget = tableBytes * numTables / 10;
+        WavetableLibrary library(cacheBudget);
+        WavetableSwitcher switcher;
+
+        auto waitUntilIdle = [&library]
+        {
+            while (library.isBusy())
+                juce::Thread::sleep(1);
+        };
+
+        auto start = juce::Time::getHighResolutionTicks();
+        library.addDirectory(directory);
+        waitUntilIdle();
+        auto scanSeconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start);
+
+        int numDecoded = 0;
+        size_t peakCachedBytes = 0;
+        start = juce::Time::getHighResolutionTicks();
+
+        for (int index = 0; index < library.getNumTables(); ++index)
+        {
+            library.prefetch(index);
+            waitUntilIdle();
+
+            auto table = library.getCachedTable(index);
+
+            if (table != nullptr && table->numFrames == framesPerTable)
+                ++numDecoded;
+
+            // play it, as the audio thread would, and let go of the last one
+            switcher.setTable(table);
+            switcher.acquire();
+            switcher.releaseRetiredTables();
+            peakCachedBytes = juce::jmax(peakCachedBytes, library.getCachedBytes());
+        }
+
+        auto decodeSeconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start);
+
+        // the newest table is still cached, so looking it up again is a hit
+        auto lastIndex = library.getNumTables() - 1;
+        const int numLookups = 10000;
+        start = juce::Time::getHighResolutionTicks();
+
+        for (int i = 0; i < numLookups; ++i)
+            library.getCachedTable(lastIndex);
+
+        auto lookupSeconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start);
+
+        // frame by frame against what was written, allowing for the normalisation
+        auto maxError = 1.0;
+
+        if (auto decoded = WavetableLibrary::decode(directory.getChildFile("table_0000.wav"), 0))
+        {
+            auto table = decoded->getTable();
+            auto peak = 0.0f;
+
+            for (int frame = 0; frame < framesPerTable; ++frame)
+                for (int i = 0; i < (int)tableSize; ++i)
+                    peak = juce::jmax(peak, std::abs(getSyntheticWavetableSample(0, frame, i)));
+
+            maxError = 0.0;
+
+            for (int frame = 0; frame < framesPerTable; ++frame)
+                for (int i = 0; i < (int)tableSize; ++i)
+                    maxError = juce::jmax(maxError, (double)std::abs(table.samples[(size_t)frame * table.numSamples + (size_t)i]
+                                                                        - 0.6f * getSyntheticWavetableSample(0, frame, i) / peak));
+        }
+
+        auto passed = library.getNumTables() == numTables
+                       && numDecoded == numTables
+                       && library.getNumEvictions() > 0
+                       && peakCachedBytes <= cacheBudget + 2 * tableBytes
+                       && maxError <= maxDecodeError;
+
+        check("wavetable_library/synthetic", passed,
+              { { "tables", (double)library.getNumTables() },
+                { "frames_per_table", (double)framesPerTable },
+                { "decoded_tables", (double)numDecoded },
+                { "scan_ms", scanSeconds * 1000.0 },
+                { "first_load_ms_per_table", decodeSeconds * 1000.0 / juce::jmax(1, library.getNumTables()) },
+                { "cache_hit_us", lookupSeconds * 1.0e6 / numLookups },
+                { "cache_budget_mb", (double)cacheBudget / (1024.0 * 1024.0) },
+                { "peak_cached_mb", (double)peakCachedBytes / (1024.0 * 1024.0) },
+                { "evictions", (double)library.getNumEvictions() },
+                { "max_decode_error", maxError },
+                { "max_decode_error_allowed", maxDecodeError } });
+
+        // the audio thread's side of a switch: one acquire per block, with the message
+        // thread switching tables every few blocks
+        SharedControlState controlState;
+        auto first = library.getCachedTable(lastIndex);
+        int blockCount = 0;
+
+        report("wavetable_library/switch_per_block", runner, runner.measureNanosecondsPerSample([&]
+        {
+            if (++blockCount % 16 == 0)
+            {
+                switcher.setTable((blockCount / 16) % 2 == 0 ? first : nullptr);
+                switcher.releaseRetiredTables();
+            }
+
+            controlState.setWavetable(switcher.acquire());
+            keep((float)controlState.wavetableVersion);
+        }));
+
+        switcher.setTable(nullptr);
+        directory.deleteRecursively();
+        return passed;
+    }
+
+    //==============================================================================
+    /** Runs everything that has a pass threshold, and returns true if all of it passed. */
+    inline bool runChecks(const Runner& runner)
+    {
+        auto allPassed = runAllocationCheck(runner);
+        allPassed = runOscillatorChecks(runner) && allPassed;
+        allPassed = runAliasingChecks(runner) && allPassed;
+        allPassed = runSubBlockChecks(runner) && allPassed;
+        allPassed = runUnisonCheck(runner) && allPassed;
+        allPassed = runWavetableLibraryChecks(runner) && allPassed;
+        return allPassed;
+    }
+
+    /** Runs the checks and every benchmark, and returns the process exit code, which is
+        non-zero if any check failed. The buffer size the CPU fractions are worked out
+        for can be set with --block-size n, and --checks skips everything but the checks.
+    */
+    inline int runAll(const juce::StringArray& args)
+    {
+        Runner runner;
+
+        auto blockSizeIndex = args.indexOf("--block-size");
+
+        if (blockSizeIndex >= 0)
+            runner.blockSize = juce::jmax(1, args[blockSizeIndex + 1].getIntValue());
+
+        auto allPassed = runChecks(runner);
+
+        if (args.contains("--checks"))
+            return allPassed ? 0 : 1;
+
+        runOscillatorBenchmarks(runner);
+        runAliasingBenchmarks(runner);
+        runEnvelopeBenchmarks(runner);
+        runFilterBenchmarks(runner);
+        runVoiceBenchmarks(runner);
+        runMPEBenchmarks(runner);
+        runModulationBenchmarks(runner);
+        runUnisonBenchmarks(runner);
+        runSubBlockBenchmarks(runner);
+        runAudioTapBenchmarks(runner);
+        runEffectsBenchmarks(runner);
+        runMidiJitterBenchmarks(runner);
+        runScalingBenchmarks();
+        return allPassed ? 0 : 1;
+    }
+
+    inline int runAll(const juce::String& commandLine)
+    {
+        return runAll(juce::StringArray::fromTokens(commandLine, true));
+    }
+}
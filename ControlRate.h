@@ -0,0 +1,331 @@
+/*
+  ==============================================================================
+
+    ControlRate.h
+    Values that only need working out every few samples, computed once per
+    control segment and ramped linearly in between.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "Filter.h"
+#include "Parameters.h"
+#include "Wavetable.h"
+
+
+//==============================================================================
+/** A set of coefficients plus how much each one moves per sample. */
+struct FilterCoefficientRamp
+{
+    FilterCoefficients current, delta;
+
+    forcedinline void advance() noexcept
+    {
+        current.g += delta.g;
+        current.k += delta.k;
+    }
+
+    static FilterCoefficientRamp between(const FilterCoefficients& start, const FilterCoefficients& end,
+                                         int offset, int length) noexcept
+    {
+        if (offset >= length)
+            return { end, { 0.0f, 0.0f } };
+
+        auto step = 1.0f / (float)length;
+        return { FilterCoefficients::interpolate(start, end, (float)offset * step),
+                 { (end.g - start.g) * step, (end.k - start.k) * step } };
+    }
+};
+
+//==============================================================================
+/** Everything the voices share at control rate, worked out once per block by
+    whoever owns the synth, before any voice renders.
+
+    The block is cut into segments of controlInterval samples. The global cutoff
+    glides exponentially from where the last block ended to its new value, and the
+    resonance glides linearly. The filter coefficients are computed only at segment
+    boundaries, and voices ramp linearly between them. The wavetable morph glides
+    linearly too, and can be read at any sample.
+
+    The modulation matrix is compiled here too, along with everything its sources
+    share, so each voice only has to step its own LFOs and envelope and evaluate it
+    (see VoiceModulation).
+
+    A block can also be set up a piece at a time, starting at any segment boundary,
+    so that a parameter change lands part way through it (see SubBlockRenderer).
+    Sample positions are always counted from the start of the whole block.
+
+    The wavetable itself changes between blocks, through setWavetable(). Voices
+    compare wavetableVersion with the one they last saw and switch over before they
+    read anything, so after setWavetable() returns nothing reads the old table.
+*/
+class SharedControlState
+{
+public:
+    static constexpr int controlInterval = 32;
+
+    //==============================================================================
+    /** Call before playback starts; this is the only place that allocates. */
+    void prepare(double newSampleRate, int maximumBlockSize)
+    {
+        sampleRate = newSampleRate;
+        maxSegments = maximumBlockSize / controlInterval + 1;
+        boundaryCutoffs.malloc((size_t)maxSegments + 1);
+        boundaryResonances.malloc((size_t)maxSegments + 1);
+        boundaryCoefficients.malloc((size_t)maxSegments + 1);
+        numSegments = 0;
+        lastCutoff = -1.0f;
+        lastMorph = -1.0f;
+    }
+
+    /** Computes this block's filter trajectory and picks up the rest of the block's
+        parameters, which should be the values to reach by the end of the block.
+    */
+    void beginBlock(int numSamples, const SynthParameters& parameters) noexcept
+    {
+        beginBlock(0, numSamples, parameters);
+    }
+
+    /** The same for the part of a block from startSample onwards, which has to be on a
+        segment boundary. The voices then render that part with startSample unchanged.
+    */
+    void beginBlock(int startSample, int numSamples, const SynthParameters& parameters) noexcept
+    {
+        jassert(sampleRate > 0.0);
+        jassert(startSample % controlInterval == 0);
+        jassert(numSamples <= maxSegments * controlInterval);
+
+        firstSegment = startSample / controlInterval;
+        blockStartSample = startSample;
+
+        auto cutoff = juce::jlimit(20.0f, (float)(sampleRate * 0.45), parameters.filterCutoff);
+        auto resonance = juce::jmax((float)FilterCoefficients::minimumQ, parameters.filterResonance);
+
+        if (lastCutoff < 0.0f)
+        {
+            lastCutoff = cutoff;
+            lastResonance = resonance;
+        }
+
+        numSegments = juce::jlimit(1, maxSegments, (numSamples + controlInterval - 1) / controlInterval);
+        auto ratio = cutoff / lastCutoff;
+
+        for (int i = 0; i <= numSegments; ++i)
+        {
+            auto proportion = (float)i / (float)numSegments;
+            auto boundaryCutoff = (ratio == 1.0f) ? cutoff : lastCutoff * std::pow(ratio, proportion);
+            auto boundaryResonance = lastResonance + proportion * (resonance - lastResonance);
+
+            boundaryCutoffs[i] = boundaryCutoff;
+            boundaryResonances[i] = boundaryResonance;
+
+            if (i > 0 && boundaryCutoff == boundaryCutoffs[i - 1] && boundaryResonance == boundaryResonances[i - 1])
+                boundaryCoefficients[i] = boundaryCoefficients[i - 1];
+            else
+                boundaryCoefficients[i] = FilterCoefficients::make(sampleRate, boundaryCutoff, boundaryResonance);
+        }
+
+        lastCutoff = cutoff;
+        lastResonance = resonance;
+        filterModeWeights = FilterModeWeights::forMode(parameters.filterMode);
+
+        if (lastMorph < 0.0f)
+            lastMorph = parameters.morph;
+
+        morphAtBlockStart = lastMorph;
+        morphPerSample = (parameters.morph - lastMorph) / (float)juce::jmax(1, numSamples);
+        lastMorph = parameters.morph;
+
+        modulationMatrix.compile(parameters.modulation, parameters.timbreToCutoff, parameters.timbreToMorph);
+        envelope2Rates = ControlRateEnvelope::Rates::make(parameters.modulation.envelope2, sampleRate);
+
+        for (int i = 0; i < ModulationParameters::numLFOs; ++i)
+        {
+            lfoShapes[i] = parameters.modulation.lfos[i].shape;
+            lfoPhaseDeltas[i] = ModulationLFO::getPhaseDelta(parameters.modulation.lfos[i].rate, sampleRate);
+        }
+
+        tailThreshold = juce::Decibels::decibelsToGain(parameters.tailThresholdDecibels);
+
+        if (std::memcmp(&parameters.adsr, &adsrParameters, sizeof(adsrParameters)) != 0)
+        {
+            adsrParameters = parameters.adsr;
+            ++adsrVersion;
+        }
+
+        if (parameters.unisonVoices != unisonVoices || parameters.unisonDetune != unisonDetune
+             || parameters.unisonSpread != unisonSpread)
+        {
+            unisonVoices = parameters.unisonVoices;
+            unisonDetune = parameters.unisonDetune;
+            unisonSpread = parameters.unisonSpread;
+            ++unisonVersion;
+        }
+    }
+
+    /** Makes table the one every voice plays from now on. Audio thread, before any voice
+        renders; a table that's already current costs nothing.
+    */
+    void setWavetable(const MipmappedWavetable& table) noexcept
+    {
+        if (table.samples != wavetable.samples || table.numFrames != wavetable.numFrames)
+        {
+            wavetable = table;
+            ++wavetableVersion;
+        }
+    }
+
+    //==============================================================================
+    int getSegmentIndex(int sampleInBlock) const noexcept      { return juce::jlimit(0, numSegments - 1, sampleInBlock / controlInterval - firstSegment); }
+    int getSegmentStart(int segment) const noexcept            { return (firstSegment + segment) * controlInterval; }
+    float getCutoffAtBoundary(int boundary) const noexcept     { return boundaryCutoffs[boundary]; }
+    float getResonanceAtBoundary(int boundary) const noexcept  { return boundaryResonances[boundary]; }
+    double getSampleRate() const noexcept                      { return sampleRate; }
+    float getMorphAt(int sampleInBlock) const noexcept         { return morphAtBlockStart + morphPerSample * (float)(sampleInBlock - blockStartSample); }
+
+    /** The shared coefficients at a sample in this block, and their slope until the
+        end of its segment.
+    */
+    FilterCoefficientRamp getFilterRamp(int sampleInBlock) const noexcept
+    {
+        auto segment = getSegmentIndex(sampleInBlock);
+        return FilterCoefficientRamp::between(boundaryCoefficients[segment], boundaryCoefficients[segment + 1],
+                                              sampleInBlock - getSegmentStart(segment), controlInterval);
+    }
+
+    FilterModeWeights filterModeWeights;
+    float tailThreshold = 0.0f;
+    juce::ADSR::Parameters adsrParameters;
+    int adsrVersion = 0;
+    int unisonVoices = 1, unisonVersion = 0;
+    float unisonDetune = 0.0f, unisonSpread = 0.0f;
+    MipmappedWavetable wavetable = WavetableBank::getInstance().getMasterTable();
+    int wavetableVersion = 0;
+
+    ModulationMatrix modulationMatrix;
+    ControlRateEnvelope::Rates envelope2Rates;
+    LFOShape lfoShapes[ModulationParameters::numLFOs] = {};
+    juce::uint32 lfoPhaseDeltas[ModulationParameters::numLFOs] = {};
+
+private:
+    //==============================================================================
+    double sampleRate = 0.0;
+    int maxSegments = 0, numSegments = 0, firstSegment = 0, blockStartSample = 0;
+    float lastCutoff = -1.0f, lastResonance = 0.0f;
+    float lastMorph = -1.0f, morphAtBlockStart = 0.0f, morphPerSample = 0.0f;
+
+    juce::HeapBlock<float> boundaryCutoffs, boundaryResonances;
+    juce::HeapBlock<FilterCoefficients> boundaryCoefficients;
+};
+
+//==============================================================================
+/** Hands a voice its filter coefficients one segment at a time.
+
+    While the voice has no cutoff modulation of its own it just reads the shared
+    trajectory. Once it does, it computes coefficients for its own cutoff at each
+    segment boundary, reusing the previous segment's end as the next one's start.
+    The offsets are the voice's modulation at the start and end of the segment.
+*/
+class VoiceFilterModulator
+{
+public:
+    FilterCoefficientRamp getRamp(const SharedControlState& shared, int sampleInBlock,
+                                  float startOffsetInOctaves, float endOffsetInOctaves) noexcept
+    {
+        if (startOffsetInOctaves == 0.0f && endOffsetInOctaves == 0.0f)
+            return shared.getFilterRamp(sampleInBlock);
+
+        auto segment = shared.getSegmentIndex(sampleInBlock);
+        auto startFrequency = shared.getCutoffAtBoundary(segment) * std::exp2(startOffsetInOctaves);
+        auto endFrequency = shared.getCutoffAtBoundary(segment + 1) * std::exp2(endOffsetInOctaves);
+        auto startResonance = shared.getResonanceAtBoundary(segment);
+        auto endResonance = shared.getResonanceAtBoundary(segment + 1);
+
+        auto start = (startFrequency == cachedFrequency && startResonance == cachedResonance)
+                        ? cachedCoefficients
+                        : FilterCoefficients::make(shared.getSampleRate(), startFrequency, startResonance);
+        auto end = (endFrequency == startFrequency && endResonance == startResonance)
+                        ? start
+                        : FilterCoefficients::make(shared.getSampleRate(), endFrequency, endResonance);
+
+        cachedFrequency = endFrequency;
+        cachedResonance = endResonance;
+        cachedCoefficients = end;
+
+        return FilterCoefficientRamp::between(start, end, sampleInBlock - shared.getSegmentStart(segment),
+                                              SharedControlState::controlInterval);
+    }
+
+private:
+    float cachedFrequency = -1.0f, cachedResonance = -1.0f;
+    FilterCoefficients cachedCoefficients;
+};
+
+//==============================================================================
+/** One voice's modulation sources and what the matrix makes of them, a segment at a
+    time.
+
+    advance() steps the LFOs and the second envelope to the end of a segment and
+    evaluates the matrix there. The start of each segment is the end of the one before,
+    so the voice can ramp every destination linearly across it.
+*/
+class VoiceModulation
+{
+public:
+    /** Restarts the LFOs and the envelope, and works out where the note starts. */
+    void noteStarted(const SharedControlState& shared, float pressure, float timbre, float pitchBend) noexcept
+    {
+        for (auto& phase : lfoPhases)
+            phase = 0;
+
+        envelope2.noteOn();
+        advance(shared, 0, pressure, timbre, pitchBend);
+        std::copy(std::begin(atEnd), std::end(atEnd), atStart);
+    }
+
+    void noteStopped(const SharedControlState& shared) noexcept
+    {
+        envelope2.noteOff(shared.envelope2Rates);
+    }
+
+    void reset() noexcept
+    {
+        envelope2.reset();
+        std::fill(std::begin(atStart), std::end(atStart), 0.0f);
+        std::fill(std::begin(atEnd), std::end(atEnd), 0.0f);
+    }
+
+    /** Moves on to the end of a segment of numSamples, where the MPE dimensions have
+        the values given.
+    */
+    void advance(const SharedControlState& shared, int numSamples, float pressure, float timbre, float pitchBend) noexcept
+    {
+        std::copy(std::begin(atEnd), std::end(atEnd), atStart);
+
+        float sources[numModulationSources];
+
+        for (int i = 0; i < ModulationParameters::numLFOs; ++i)
+        {
+            lfoPhases[i] += shared.lfoPhaseDeltas[i] * (juce::uint32)numSamples;
+            sources[(int)ModulationSource::lfo1 + i] = ModulationLFO::getValue(shared.lfoShapes[i], lfoPhases[i]);
+        }
+
+        sources[(int)ModulationSource::envelope2] = envelope2.advance(numSamples, shared.envelope2Rates);
+        sources[(int)ModulationSource::pressure] = pressure;
+        sources[(int)ModulationSource::timbre] = timbre;
+        sources[(int)ModulationSource::pitchBend] = pitchBend;
+
+        shared.modulationMatrix.evaluate(sources, atEnd);
+    }
+
+    float getStart(ModulationDestination destination) const noexcept    { return atStart[(int)destination]; }
+    float getEnd(ModulationDestination destination) const noexcept      { return atEnd[(int)destination]; }
+
+private:
+    juce::uint32 lfoPhases[ModulationParameters::numLFOs] = {};
+    ControlRateEnvelope envelope2;
+    float atStart[numModulationDestinations] = {}, atEnd[numModulationDestinations] = {};
+};
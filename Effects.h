@@ -0,0 +1,250 @@
+/*
+  ==============================================================================
+
+    Effects.h
+    The stereo chorus, delay and reverb that run on the finished synth mix.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "Modulation.h"
+
+
+//==============================================================================
+/** Everything about the effects the user can change, to go in SynthParameters. Each
+    effect is bypassed while its mix is 0.
+*/
+struct EffectsParameters
+{
+    float chorusRate = 0.8f;        // in Hz
+    float chorusDepth = 0.5f;       // 0 to 1
+    float chorusMix = 0.0f;         // 0 to 1; 0.5 is the classic chorus
+
+    float delayTime = 0.35f;        // in seconds, up to StereoEffectsChain::maxDelayInSeconds
+    float delayFeedback = 0.35f;    // 0 to 1, crossed between the sides
+    float delayMix = 0.0f;          // 0 to 1, added on top of the dry signal
+
+    float reverbSize = 0.6f;        // 0 to 1
+    float reverbDamping = 0.5f;     // 0 to 1
+    float reverbMix = 0.0f;         // 0 to 1
+};
+
+//==============================================================================
+/** A delay line with a power-of-two length, read with linear interpolation. */
+class FractionalDelayLine
+{
+public:
+    void prepare(int maximumDelayInSamples)
+    {
+        auto size = juce::nextPowerOfTwo(maximumDelayInSamples + 2);
+        buffer.calloc((size_t)size);
+        mask = size - 1;
+        writeIndex = 0;
+    }
+
+    void clear() noexcept
+    {
+        buffer.clear((size_t)(mask + 1));
+    }
+
+    /** The sample written delayInSamples before the next one, which must be at least 1. */
+    forcedinline float read(float delayInSamples) const noexcept
+    {
+        auto position = (float)writeIndex - delayInSamples;
+        auto whole = (int)std::floor(position);
+        auto fraction = position - (float)whole;
+
+        auto a = buffer[whole & mask];
+        auto b = buffer[(whole + 1) & mask];
+        return a + fraction * (b - a);
+    }
+
+    forcedinline void write(float sample) noexcept
+    {
+        buffer[writeIndex] = sample;
+        writeIndex = (writeIndex + 1) & mask;
+    }
+
+private:
+    juce::HeapBlock<float> buffer;
+    int mask = 0, writeIndex = 0;
+};
+
+//==============================================================================
+/** Chorus, then delay, then reverb, on one stereo stream.
+
+    The chorus is a short delay on each side, swept by a pair of LFOs a quarter cycle
+    apart. The delay feeds each side's echoes back into the other, so they bounce
+    across the stereo field. The reverb is juce::Reverb.
+
+    Mixes and the delay time glide to new values, so moving them doesn't click. An
+    effect whose mix has settled at 0 is skipped and cleared, and costs nothing.
+
+    Nothing allocates after prepare(). The chain isn't thread-safe: whichever thread
+    calls process() has to be the only one using it.
+*/
+class StereoEffectsChain
+{
+public:
+    static constexpr float maxDelayInSeconds = 2.0f;
+
+    //==============================================================================
+    void prepare(double newSampleRate)
+    {
+        sampleRate = newSampleRate;
+
+        for (auto& line : chorusLines)
+            line.prepare((int)std::ceil((chorusCentreInSeconds + chorusSwingInSeconds) * sampleRate) + 1);
+
+        for (auto& line : delayLines)
+            line.prepare((int)std::ceil(maxDelayInSeconds * sampleRate) + 1);
+
+        reverb.setSampleRate(sampleRate);
+
+        for (auto* mix : { &chorusMix, &delayMix })
+            mix->reset(sampleRate, smoothingLengthInSeconds);
+
+        delayInSamples.reset(sampleRate, delaySmoothingLengthInSeconds);
+        reset();
+    }
+
+    void reset() noexcept
+    {
+        for (auto& line : chorusLines)
+            line.clear();
+
+        for (auto& line : delayLines)
+            line.clear();
+
+        reverb.reset();
+        chorusMix.setCurrentAndTargetValue(0.0f);
+        delayMix.setCurrentAndTargetValue(0.0f);
+        delayInSamples.setCurrentAndTargetValue(getDelayInSamples(EffectsParameters().delayTime));
+        chorusActive = delayActive = reverbWasActive = false;
+        chorusPhase = 0;
+    }
+
+    //==============================================================================
+    void process(float* left, float* right, int numSamples, const EffectsParameters& parameters) noexcept
+    {
+        chorusMix.setTargetValue(juce::jlimit(0.0f, 1.0f, parameters.chorusMix));
+        delayMix.setTargetValue(juce::jlimit(0.0f, 1.0f, parameters.delayMix));
+        delayInSamples.setTargetValue(getDelayInSamples(parameters.delayTime));
+
+        if (updateActive(chorusMix, chorusLines, chorusActive))
+            processChorus(left, right, numSamples, parameters);
+
+        if (updateActive(delayMix, delayLines, delayActive))
+            processDelay(left, right, numSamples, parameters);
+        else
+            delayInSamples.setCurrentAndTargetValue(delayInSamples.getTargetValue());
+
+        processReverb(left, right, numSamples, parameters);
+    }
+
+private:
+    //==============================================================================
+    /** False once the mix has settled at 0. The lines are cleared as that happens, so
+        nothing stale comes back when the effect is turned up again.
+    */
+    static bool updateActive(const juce::SmoothedValue<float>& mix, FractionalDelayLine (&lines)[2], bool& active) noexcept
+    {
+        auto nowActive = mix.isSmoothing() || mix.getTargetValue() > 0.0f;
+
+        if (active && ! nowActive)
+            for (auto& line : lines)
+                line.clear();
+
+        return active = nowActive;
+    }
+
+    void processChorus(float* left, float* right, int numSamples, const EffectsParameters& parameters) noexcept
+    {
+        auto phaseDelta = ModulationLFO::getPhaseDelta(parameters.chorusRate, sampleRate);
+        auto centre = chorusCentreInSeconds * (float)sampleRate;
+        auto swing = chorusSwingInSeconds * (float)sampleRate * juce::jlimit(0.0f, 1.0f, parameters.chorusDepth);
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            auto mix = chorusMix.getNextValue();
+            auto leftWet = chorusLines[0].read(centre + swing * ModulationLFO::getValue(LFOShape::sine, chorusPhase));
+            auto rightWet = chorusLines[1].read(centre + swing * ModulationLFO::getValue(LFOShape::sine, chorusPhase + 0x40000000u));
+
+            chorusLines[0].write(left[i]);
+            chorusLines[1].write(right[i]);
+            left[i] += mix * (leftWet - left[i]);
+            right[i] += mix * (rightWet - right[i]);
+            chorusPhase += phaseDelta;
+        }
+    }
+
+    void processDelay(float* left, float* right, int numSamples, const EffectsParameters& parameters) noexcept
+    {
+        auto feedback = juce::jlimit(0.0f, maxFeedback, parameters.delayFeedback);
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            auto delay = delayInSamples.getNextValue();
+            auto mix = delayMix.getNextValue();
+            auto leftEcho = delayLines[0].read(delay);
+            auto rightEcho = delayLines[1].read(delay);
+
+            delayLines[0].write(left[i] + feedback * rightEcho);
+            delayLines[1].write(right[i] + feedback * leftEcho);
+            left[i] += mix * leftEcho;
+            right[i] += mix * rightEcho;
+        }
+    }
+
+    void processReverb(float* left, float* right, int numSamples, const EffectsParameters& parameters) noexcept
+    {
+        auto mix = juce::jlimit(0.0f, 1.0f, parameters.reverbMix);
+
+        // juce::Reverb glides its own gains, so it runs for one more block after the mix
+        // reaches 0, to fade out rather than stop dead
+        if (mix <= 0.0f && ! reverbWasActive)
+            return;
+
+        // juce::Reverb scales the dry level by 2 and the wet level by 3
+        juce::Reverb::Parameters reverbParameters;
+        reverbParameters.roomSize = juce::jlimit(0.0f, 1.0f, parameters.reverbSize);
+        reverbParameters.damping = juce::jlimit(0.0f, 1.0f, parameters.reverbDamping);
+        reverbParameters.wetLevel = mix / 3.0f;
+        reverbParameters.dryLevel = 0.5f;
+        reverbParameters.width = 1.0f;
+        reverb.setParameters(reverbParameters);
+        reverb.processStereo(left, right, numSamples);
+
+        if (mix <= 0.0f)
+            reverb.reset();
+
+        reverbWasActive = mix > 0.0f;
+    }
+
+    float getDelayInSamples(float seconds) const noexcept
+    {
+        return juce::jlimit(1.0f, maxDelayInSeconds * (float)sampleRate, seconds * (float)sampleRate);
+    }
+
+    //==============================================================================
+    static constexpr float chorusCentreInSeconds = 0.012f, chorusSwingInSeconds = 0.005f;
+    static constexpr float maxFeedback = 0.95f;
+    static constexpr double smoothingLengthInSeconds = 0.05, delaySmoothingLengthInSeconds = 0.2;
+
+    double sampleRate = 44100.0;
+
+    FractionalDelayLine chorusLines[2];
+    juce::uint32 chorusPhase = 0;
+    juce::SmoothedValue<float> chorusMix;
+    bool chorusActive = false;
+
+    FractionalDelayLine delayLines[2];
+    juce::SmoothedValue<float> delayMix, delayInSamples;
+    bool delayActive = false;
+
+    juce::Reverb reverb;
+    bool reverbWasActive = false;
+};
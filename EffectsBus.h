@@ -0,0 +1,547 @@
+/*
+  ==============================================================================
+
+    EffectsBus.h
+    Runs the effects chain on the synth's mix, either inline in the audio
+    callback or a block behind on its own real-time thread.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "Effects.h"
+#include "Parameters.h"
+#include "RenderWorkerPool.h"
+
+
+//==============================================================================
+/** Puts a StereoEffectsChain after the synth, so the effects don't come out of the
+    voices' budget.
+
+    Inline, the chain runs in the callback and adds no latency. Pipelined, the callback
+    queues each block for an effects thread and plays what came back from it exactly
+    getLatencyInSamples() earlier, which is the maximum block size given to prepare().
+    That gives the chain at least one callback period of its own, and the delay stays
+    the same whatever size of blocks the device or host sends.
+
+    The two threads pass audio through preallocated FIFOs, and neither side waits for
+    the other. The effects thread spins for two block periods after each block, so
+    while audio is flowing it's always there for the next one. Only after a longer
+    gap does it park in an IdleWaiter, and then the callback that brings the next
+    block signals its WaitableEvent, which takes the event's lock once.
+
+    Every queued block carries its position in the stream, and the callback plays
+    each one back at that position plus the latency. Anything that isn't back in
+    time, or didn't fit in the queue, comes out as silence in its own place, so a
+    late effects thread costs a gap rather than shifting the output, and is counted
+    as an overrun. Switching modes drops whatever is in flight.
+
+    The chain is stereo. A mono output gets both sides mixed, and with more than two
+    channels the even ones get the left side and the odd ones the right.
+*/
+class EffectsBus
+{
+public:
+    //==============================================================================
+    EffectsBus() = default;
+
+    ~EffectsBus()
+    {
+        stopThread();
+    }
+
+    /** Allocates everything for the device's settings and, if pipelining is on, starts
+        the effects thread. Call this from the message thread before the callbacks start.
+    */
+    void prepare(double sampleRate, int maximumBlockSize)
+    {
+        const juce::ScopedLock sl(threadLock);
+
+        stopThread();
+
+        chain.prepare(sampleRate);
+        preparedSampleRate = sampleRate;
+        preparedBlockSize = maximumBlockSize;
+        callbackBuffer.setSize(2, maximumBlockSize);
+        threadBuffer.setSize(2, maximumBlockSize);
+
+        // room for the effects thread to fall a few blocks behind and catch up again,
+        // even if every block is a single sample
+        auto capacity = maximumBlockSize * maxBlocksBehind;
+        inputAudio.setSize(2, capacity + 1);
+        outputAudio.setSize(2, capacity + maximumBlockSize * 2 + 1);
+        inputFifo.setTotalSize(inputAudio.getNumSamples());
+        outputFifo.setTotalSize(outputAudio.getNumSamples());
+
+        jobs.calloc((size_t)capacity + 1);
+        segments.calloc((size_t)capacity + 1);
+        jobFifo.setTotalSize(capacity + 1);
+        segmentFifo.setTotalSize(capacity + 1);
+
+        if (pipelined.load())
+        {
+            resetPipeline();
+            startThread();
+        }
+
+        updateLatency();
+    }
+
+    /** Stops the effects thread until the next prepare(). Call this once the audio has stopped. */
+    void release()
+    {
+        const juce::ScopedLock sl(threadLock);
+        stopThread();
+    }
+
+    /** Switches between running the chain on the effects thread and in the callback.
+        Call this from the message thread; it waits for the callback to finish with
+        the effects thread before stopping it.
+    */
+    void setPipelined(bool shouldBePipelined)
+    {
+        const juce::ScopedLock sl(threadLock);
+
+        pipelined.store(false);
+
+        while (busInUse.load())
+            std::this_thread::yield();
+
+        stopThread();
+
+        if (shouldBePipelined && preparedBlockSize > 0)
+        {
+            resetPipeline();
+            startThread();
+        }
+
+        pipelined.store(shouldBePipelined);
+        updateLatency();
+
+        if (onLatencyChange != nullptr)
+            onLatencyChange();
+    }
+
+    bool isPipelined() const noexcept                  { return pipelined.load(); }
+
+    /** How far behind the synth the output is: the prepared block size while pipelined,
+        and 0 inline. It only changes in prepare() and setPipelined().
+    */
+    int getLatencyInSamples() const noexcept           { return latencyInSamples.load(); }
+
+    /** Called on the message thread by setPipelined(), once the latency has changed. */
+    std::function<void()> onLatencyChange;
+
+    /** Blocks that came out with some of the effects thread's audio missing. */
+    int getNumOverruns() const noexcept                { return numOverruns.load(); }
+
+    //==============================================================================
+    /** Replaces the first numSamples of buffer with the chain's output. Audio thread only. */
+    void process(juce::AudioBuffer<float>& buffer, int numSamples, const EffectsParameters& parameters) noexcept
+    {
+        if (buffer.getNumChannels() == 0 || numSamples <= 0 || preparedBlockSize <= 0)
+            return;
+
+        // set before checking the flags, so setPipelined() can't stop the thread between
+        // the check and the handover
+        busInUse.store(true);
+
+        auto pipelinedNow = pipelined.load();
+        auto threadRunning = effectsThreadRunning.load();
+
+        // a block longer than the device promised goes through a piece at a time
+        for (int start = 0; start < numSamples; start += preparedBlockSize)
+        {
+            auto numThisTime = juce::jmin(preparedBlockSize, numSamples - start);
+
+            if (pipelinedNow && threadRunning)
+            {
+                sendToThread(buffer, start, numThisTime, parameters);
+                receiveFromThread(numThisTime);
+                writeOutput(callbackBuffer, start, numThisTime, buffer);
+            }
+            else if (! threadRunning)
+            {
+                readInput(buffer, start, numThisTime, callbackBuffer);
+                chain.process(callbackBuffer.getWritePointer(0), callbackBuffer.getWritePointer(1), numThisTime, parameters);
+                writeOutput(callbackBuffer, start, numThisTime, buffer);
+            }
+
+            // otherwise the effects thread is still stopping after a switch, so the chain
+            // isn't free and the mix goes out dry for now
+        }
+
+        busInUse.store(false);
+    }
+
+private:
+    //==============================================================================
+    /** A block queued for the effects thread, and where it starts in the stream. */
+    struct Job
+    {
+        juce::int64 start;
+        int numSamples;
+        EffectsParameters parameters;
+    };
+
+    /** A block the effects thread has finished, whose audio is next in the output FIFO. */
+    struct Segment
+    {
+        juce::int64 start;
+        int numSamples;
+    };
+
+    struct EffectsThread : public juce::Thread
+    {
+        EffectsThread(EffectsBus& b)
+            : juce::Thread("Effects bus"), bus(b)
+        {}
+
+        void run() override
+        {
+            while (! threadShouldExit())
+            {
+                if (! idleWaiter.waitUntil(*this, [this] { return bus.jobFifo.getNumReady() > 0; }))
+                    return;
+
+                AllocationTrap::ScopedRealtimeSection realtimeSection;
+                bus.processNextJob();
+            }
+        }
+
+        EffectsBus& bus;
+        IdleWaiter idleWaiter;
+    };
+
+    static constexpr int maxBlocksBehind = 4;
+
+    //==============================================================================
+    /** Queues a block for the effects thread, or drops it if the queue is full. */
+    void sendToThread(const juce::AudioBuffer<float>& buffer, int startSample, int numSamples,
+                      const EffectsParameters& parameters) noexcept
+    {
+        auto start = writePosition;
+        writePosition += numSamples;
+
+        // a dropped block leaves a gap in the stream, which plays as silence when it's due
+        if (jobFifo.getFreeSpace() == 0 || inputFifo.getFreeSpace() < numSamples)
+            return;
+
+        writeToFifo(inputFifo, inputAudio,
+                    buffer.getReadPointer(0, startSample),
+                    buffer.getReadPointer(juce::jmin(1, buffer.getNumChannels() - 1), startSample),
+                    numSamples);
+
+        int start1, size1, start2, size2;
+        jobFifo.prepareToWrite(1, start1, size1, start2, size2);
+        jobs[size1 > 0 ? start1 : start2] = { start, numSamples, parameters };
+        jobFifo.finishedWrite(1);
+
+        effectsThread->idleWaiter.wake();
+    }
+
+    /** Effects thread only. */
+    void processNextJob() noexcept
+    {
+        int start1, size1, start2, size2;
+        jobFifo.prepareToRead(1, start1, size1, start2, size2);
+        auto job = jobs[size1 > 0 ? start1 : start2];
+
+        auto* left = threadBuffer.getWritePointer(0);
+        auto* right = threadBuffer.getWritePointer(1);
+        readFromFifo(inputFifo, inputAudio, left, right, job.numSamples);
+        jobFifo.finishedRead(1);
+
+        chain.process(left, right, job.numSamples, job.parameters);
+
+        // if the callback is this far behind, the block is dropped and it plays a gap
+        if (outputFifo.getFreeSpace() < job.numSamples || segmentFifo.getFreeSpace() == 0)
+            return;
+
+        writeToFifo(outputFifo, outputAudio, left, right, job.numSamples);
+
+        segmentFifo.prepareToWrite(1, start1, size1, start2, size2);
+        segments[size1 > 0 ? start1 : start2] = { job.start, job.numSamples };
+        segmentFifo.finishedWrite(1);
+    }
+
+    /** Fills the start of callbackBuffer with the next numSamples of the stream, as they
+        were when they went in the latency ago. Finished blocks that are too late for
+        that are thrown away, and anything missing is left silent.
+    */
+    void receiveFromThread(int numSamples) noexcept
+    {
+        auto end = readPosition + numSamples;
+        auto numFound = 0;
+
+        callbackBuffer.clear(0, numSamples);
+
+        while (segmentFifo.getNumReady() > 0)
+        {
+            int start1, size1, start2, size2;
+            segmentFifo.prepareToRead(1, start1, size1, start2, size2);
+            auto& segment = segments[size1 > 0 ? start1 : start2];
+
+            auto segmentStart = segment.start + numSegmentSamplesRead;
+            auto segmentEnd = segment.start + segment.numSamples;
+
+            if (segmentStart >= end)
+                break;
+
+            if (segmentStart < readPosition)
+            {
+                // came back too late, so it's skipped to keep the rest in place
+                auto numLate = (int)(juce::jmin(segmentEnd, readPosition) - segmentStart);
+                readFromFifo(outputFifo, outputAudio, nullptr, nullptr, numLate);
+                numSegmentSamplesRead += numLate;
+            }
+            else
+            {
+                auto offset = (int)(segmentStart - readPosition);
+                auto numToRead = (int)(juce::jmin(segmentEnd, end) - segmentStart);
+                readFromFifo(outputFifo, outputAudio, callbackBuffer.getWritePointer(0, offset),
+                             callbackBuffer.getWritePointer(1, offset), numToRead);
+                numSegmentSamplesRead += numToRead;
+                numFound += numToRead;
+            }
+
+            if (numSegmentSamplesRead == segment.numSamples)
+            {
+                segmentFifo.finishedRead(1);
+                numSegmentSamplesRead = 0;
+            }
+        }
+
+        // the latency's worth of silence at the start isn't missing anything
+        auto numExpected = (int)(end - juce::jlimit(readPosition, end, (juce::int64)0));
+
+        if (numFound < numExpected)
+            numOverruns.fetch_add(1, std::memory_order_relaxed);
+
+        readPosition = end;
+    }
+
+    //==============================================================================
+    static void writeToFifo(juce::AbstractFifo& fifo, juce::AudioBuffer<float>& storage,
+                            const float* left, const float* right, int numSamples) noexcept
+    {
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite(numSamples, start1, size1, start2, size2);
+
+        storage.copyFrom(0, start1, left, size1);
+        storage.copyFrom(1, start1, right, size1);
+
+        if (size2 > 0)
+        {
+            storage.copyFrom(0, start2, left + size1, size2);
+            storage.copyFrom(1, start2, right + size1, size2);
+        }
+
+        fifo.finishedWrite(size1 + size2);
+    }
+
+    /** Null destinations throw the samples away. */
+    static void readFromFifo(juce::AbstractFifo& fifo, const juce::AudioBuffer<float>& storage,
+                             float* left, float* right, int numSamples) noexcept
+    {
+        int start1, size1, start2, size2;
+        fifo.prepareToRead(numSamples, start1, size1, start2, size2);
+
+        if (left != nullptr)
+        {
+            juce::FloatVectorOperations::copy(left, storage.getReadPointer(0, start1), size1);
+            juce::FloatVectorOperations::copy(right, storage.getReadPointer(1, start1), size1);
+
+            if (size2 > 0)
+            {
+                juce::FloatVectorOperations::copy(left + size1, storage.getReadPointer(0, start2), size2);
+                juce::FloatVectorOperations::copy(right + size1, storage.getReadPointer(1, start2), size2);
+            }
+        }
+
+        fifo.finishedRead(size1 + size2);
+    }
+
+    static void readInput(const juce::AudioBuffer<float>& buffer, int startSample, int numSamples,
+                          juce::AudioBuffer<float>& stereo) noexcept
+    {
+        stereo.copyFrom(0, 0, buffer, 0, startSample, numSamples);
+        stereo.copyFrom(1, 0, buffer, juce::jmin(1, buffer.getNumChannels() - 1), startSample, numSamples);
+    }
+
+    static void writeOutput(const juce::AudioBuffer<float>& stereo, int startSample, int numSamples,
+                            juce::AudioBuffer<float>& buffer) noexcept
+    {
+        if (buffer.getNumChannels() == 1)
+        {
+            buffer.copyFrom(0, startSample, stereo, 0, 0, numSamples);
+            buffer.addFrom(0, startSample, stereo, 1, 0, numSamples);
+            buffer.applyGain(0, startSample, numSamples, 0.5f);
+            return;
+        }
+
+        for (auto channel = buffer.getNumChannels(); --channel >= 0;)
+            buffer.copyFrom(channel, startSample, stereo, channel & 1, 0, numSamples);
+    }
+
+    //==============================================================================
+    /** Empties the FIFOs and starts the stream again. Only while the thread is stopped
+        and the callback isn't pipelining.
+    */
+    void resetPipeline() noexcept
+    {
+        for (auto* fifo : { &inputFifo, &outputFifo, &jobFifo, &segmentFifo })
+            fifo->reset();
+
+        writePosition = 0;
+        readPosition = -preparedBlockSize;
+        numSegmentSamplesRead = 0;
+    }
+
+    void startThread()
+    {
+        stopThread();
+
+        effectsThread.reset(new EffectsThread(*this));
+        effectsThread->idleWaiter.setBlockPeriod(preparedSampleRate, preparedBlockSize);
+        effectsThread->startThread(juce::Thread::realtimeAudioPriority);
+        effectsThreadRunning.store(true);
+    }
+
+    void stopThread()
+    {
+        if (effectsThread != nullptr)
+        {
+            effectsThread->signalThreadShouldExit();
+            effectsThread->idleWaiter.interrupt();
+            effectsThread->stopThread(1000);
+        }
+
+        effectsThread.reset();
+        effectsThreadRunning.store(false);
+    }
+
+    void updateLatency() noexcept
+    {
+        latencyInSamples.store(pipelined.load() ? preparedBlockSize : 0);
+    }
+
+    //==============================================================================
+    StereoEffectsChain chain;
+    double preparedSampleRate = 0.0;
+    int preparedBlockSize = 0;
+
+    // callbackBuffer belongs to the callback and threadBuffer to the effects thread
+    juce::AudioBuffer<float> callbackBuffer, threadBuffer;
+
+    // the callback writes the input and the jobs, and the effects thread the output
+    // and the segments
+    juce::AudioBuffer<float> inputAudio, outputAudio;
+    juce::HeapBlock<Job> jobs;
+    juce::HeapBlock<Segment> segments;
+    juce::AbstractFifo inputFifo { 1 }, outputFifo { 1 }, jobFifo { 1 }, segmentFifo { 1 };
+
+    // positions in the stream, in samples, only used by the callback
+    juce::int64 writePosition = 0, readPosition = 0;
+    int numSegmentSamplesRead = 0;
+
+    std::unique_ptr<EffectsThread> effectsThread;
+    juce::CriticalSection threadLock;
+
+    std::atomic<bool> pipelined { false }, busInUse { false }, effectsThreadRunning { false };
+    std::atomic<int> latencyInSamples { 0 }, numOverruns { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(EffectsBus)
+};
+
+#if JUCE_MODULE_AVAILABLE_juce_gui_basics
+
+//==============================================================================
+/** The chorus, delay and reverb controls, and the switch between running the effects
+    inline and on their own thread.
+*/
+class EffectsPanel : public juce::Component,
+    private juce::Timer
+{
+public:
+    EffectsPanel(SynthParameterStore& parameterStore, EffectsBus& busToControl)
+        : parameters(parameterStore), bus(busToControl)
+    {
+        auto& initial = parameters.getParameters().effects;
+
+        addSlider(0, "Chorus rate", 0.05, 5.0, " Hz", initial.chorusRate, [](EffectsParameters& e, float v) { e.chorusRate = v; });
+        addSlider(1, "Chorus depth", 0.0, 1.0, {}, initial.chorusDepth, [](EffectsParameters& e, float v) { e.chorusDepth = v; });
+        addSlider(2, "Chorus mix", 0.0, 1.0, {}, initial.chorusMix, [](EffectsParameters& e, float v) { e.chorusMix = v; });
+        addSlider(3, "Delay time", 0.01, StereoEffectsChain::maxDelayInSeconds, " s", initial.delayTime, [](EffectsParameters& e, float v) { e.delayTime = v; });
+        addSlider(4, "Delay feedback", 0.0, 0.95, {}, initial.delayFeedback, [](EffectsParameters& e, float v) { e.delayFeedback = v; });
+        addSlider(5, "Delay mix", 0.0, 1.0, {}, initial.delayMix, [](EffectsParameters& e, float v) { e.delayMix = v; });
+        addSlider(6, "Reverb size", 0.0, 1.0, {}, initial.reverbSize, [](EffectsParameters& e, float v) { e.reverbSize = v; });
+        addSlider(7, "Reverb damping", 0.0, 1.0, {}, initial.reverbDamping, [](EffectsParameters& e, float v) { e.reverbDamping = v; });
+        addSlider(8, "Reverb mix", 0.0, 1.0, {}, initial.reverbMix, [](EffectsParameters& e, float v) { e.reverbMix = v; });
+
+        addAndMakeVisible(pipelinedToggle);
+        pipelinedToggle.setBounds(0, 100, 300, 25);
+        pipelinedToggle.setToggleState(bus.isPipelined(), juce::dontSendNotification);
+        pipelinedToggle.onClick = [this]
+        {
+            bus.setPipelined(pipelinedToggle.getToggleState());
+        };
+
+        addAndMakeVisible(statusLabel);
+        statusLabel.setBounds(300, 100, 600, 25);
+
+        startTimerHz(4);
+    }
+
+    ~EffectsPanel() override
+    {
+        stopTimer();
+    }
+
+private:
+    //==============================================================================
+    using Setter = void (*)(EffectsParameters&, float);
+
+    void addSlider(int index, const juce::String& name, double minimum, double maximum,
+                   const juce::String& suffix, float initialValue, Setter setter)
+    {
+        auto x = (index / 3) * 450, y = (index % 3) * 30;
+
+        auto& label = labels[index];
+        addAndMakeVisible(label);
+        label.setBounds(x, y, 110, 25);
+        label.setText(name, juce::dontSendNotification);
+
+        auto& slider = sliders[index];
+        addAndMakeVisible(slider);
+        slider.setBounds(x + 110, y, 320, 25);
+        slider.setRange(minimum, maximum);
+        slider.setTextValueSuffix(suffix);
+        slider.setValue(initialValue, juce::dontSendNotification);
+        slider.onValueChange = [this, index, setter]
+        {
+            auto value = (float)sliders[index].getValue();
+            parameters.update([setter, value](SynthParameters& p) { setter(p.effects, value); });
+        };
+    }
+
+    void timerCallback() override
+    {
+        statusLabel.setText("Added latency " + juce::String(bus.getLatencyInSamples())
+                              + " samples, overruns " + juce::String(bus.getNumOverruns()),
+                            juce::dontSendNotification);
+    }
+
+    //==============================================================================
+    SynthParameterStore& parameters;
+    EffectsBus& bus;
+
+    static constexpr int numSliders = 9;
+    juce::Label labels[numSliders];
+    juce::Slider sliders[numSliders];
+    juce::ToggleButton pipelinedToggle { "Run effects on their own thread (+1 block of latency)" };
+    juce::Label statusLabel;
+};
+
+#endif
@@ -0,0 +1,84 @@
+/*
+  ==============================================================================
+
+    FFT.h
+    A small in-place radix-2 FFT, for the few places that need one off the
+    audio thread. The project doesn't pull in juce_dsp just for this.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <complex>
+
+
+//==============================================================================
+/** Transforms a power-of-two number of complex samples in place.
+
+    Neither direction is scaled, so a forward transform followed by an inverse one
+    multiplies everything by the size.
+*/
+class RadixTwoFFT
+{
+public:
+    //==============================================================================
+    explicit RadixTwoFFT(int fftSize)
+        : size(fftSize)
+    {
+        jassert(juce::isPowerOfTwo(size));
+
+        twiddles.calloc((size_t)size / 2);
+
+        for (int i = 0; i < size / 2; ++i)
+            twiddles[i] = std::polar(1.0, -juce::MathConstants<double>::twoPi * i / size);
+    }
+
+    int getSize() const noexcept    { return size; }
+
+    void perform(std::complex<float>* data, bool inverse) const noexcept
+    {
+        for (int i = 1, j = 0; i < size; ++i)
+        {
+            auto bit = size >> 1;
+
+            for (; (j & bit) != 0; bit >>= 1)
+                j ^= bit;
+
+            j ^= bit;
+
+            if (i < j)
+                std::swap(data[i], data[j]);
+        }
+
+        for (int length = 2; length <= size; length <<= 1)
+        {
+            auto twiddleStep = size / length;
+
+            for (int start = 0; start < size; start += length)
+            {
+                for (int k = 0; k < length / 2; ++k)
+                {
+                    auto twiddle = inverse ? std::conj(twiddles[k * twiddleStep]) : twiddles[k * twiddleStep];
+                    auto even = data[start + k];
+                    auto in = data[start + k + length / 2];
+
+                    // written out by hand: the operator's NaN handling makes it several times slower
+                    std::complex<float> odd (in.real() * twiddle.real() - in.imag() * twiddle.imag(),
+                                             in.real() * twiddle.imag() + in.imag() * twiddle.real());
+
+                    data[start + k] = even + odd;
+                    data[start + k + length / 2] = even - odd;
+                }
+            }
+        }
+    }
+
+private:
+    //==============================================================================
+    int size;
+    juce::HeapBlock<std::complex<float>> twiddles;
+
+    JUCE_DECLARE_NON_COPYABLE(RadixTwoFFT)
+};
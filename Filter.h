@@ -0,0 +1,166 @@
+/*
+  ==============================================================================
+
+    Filter.h
+    Zero-delay-feedback state-variable filter (the trapezoidal "TPT" form), in a
+    one-voice version and a version that runs one filter per SIMD lane.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "SIMD.h"
+
+
+//==============================================================================
+enum class FilterMode
+{
+    lowPass,
+    bandPass,
+    highPass
+};
+
+//==============================================================================
+/** Everything the state-variable filter needs for one sample.
+
+    g is the prewarped cutoff, tan(pi * cutoff / sampleRate), and k is the damping,
+    1 / Q. Unlike biquad coefficients, both can be interpolated or modulated freely
+    without the filter blowing up.
+*/
+struct FilterCoefficients
+{
+    float g = 0.0f, k = 1.41421356f;
+
+    static FilterCoefficients make(double sampleRate, double frequency, double q) noexcept
+    {
+        frequency = juce::jlimit(20.0, sampleRate * 0.45, frequency);
+
+        return { (float)std::tan(juce::MathConstants<double>::pi * frequency / sampleRate),
+                 (float)(1.0 / juce::jmax(minimumQ, q)) };
+    }
+
+    static FilterCoefficients interpolate(const FilterCoefficients& a, const FilterCoefficients& b, float proportion) noexcept
+    {
+        return { a.g + proportion * (b.g - a.g), a.k + proportion * (b.k - a.k) };
+    }
+
+    static constexpr double minimumQ = 0.5, butterworthQ = 0.70710678;
+};
+
+//==============================================================================
+/** How much of each of the filter's three outputs goes to the final output.
+
+    Blending with weights instead of switching on the mode keeps the per-sample code
+    branch-free, and it vectorises the same way the rest of the filter does.
+*/
+struct FilterModeWeights
+{
+    float lowPass = 1.0f, bandPass = 0.0f, highPass = 0.0f;
+
+    static FilterModeWeights forMode(FilterMode mode) noexcept
+    {
+        switch (mode)
+        {
+            case FilterMode::bandPass:  return { 0.0f, 1.0f, 0.0f };
+            case FilterMode::highPass:  return { 0.0f, 0.0f, 1.0f };
+            case FilterMode::lowPass:
+            default:                    return { 1.0f, 0.0f, 0.0f };
+        }
+    }
+};
+
+//==============================================================================
+/** A single state-variable filter whose cutoff and resonance can change every sample. */
+class StateVariableFilter
+{
+public:
+    void reset() noexcept
+    {
+        ic1eq = 0.0f;
+        ic2eq = 0.0f;
+    }
+
+    forcedinline float processSample(float in, float g, float k, const FilterModeWeights& mode) noexcept
+    {
+        auto a1 = 1.0f / (1.0f + g * (g + k));
+        auto v3 = in - ic2eq;
+        auto v1 = a1 * (ic1eq + g * v3);
+        auto v2 = ic2eq + g * v1;
+
+        ic1eq = 2.0f * v1 - ic1eq;
+        ic2eq = 2.0f * v2 - ic2eq;
+
+        return mode.lowPass * v2 + mode.bandPass * v1 + mode.highPass * (in - k * v1 - v2);
+    }
+
+    /** Filters samples in place, taking a separate g and k for every sample. */
+    void processBlock(float* samples, const float* g, const float* k, int numSamples, FilterMode mode) noexcept
+    {
+        auto weights = FilterModeWeights::forMode(mode);
+
+        for (int i = 0; i < numSamples; ++i)
+            samples[i] = processSample(samples[i], g[i], k[i], weights);
+
+        snapToZero();
+    }
+
+    /** Stops the state decaying into denormals once the input has gone quiet. Call
+        this once per block rather than per sample.
+    */
+    void snapToZero() noexcept
+    {
+        JUCE_SNAP_TO_ZERO(ic1eq);
+        JUCE_SNAP_TO_ZERO(ic2eq);
+    }
+
+private:
+    float ic1eq = 0.0f, ic2eq = 0.0f;
+};
+
+//==============================================================================
+/** SIMDFloat::size independent state-variable filters, one per lane.
+
+    The state is public so an engine that keeps its voices in arrays can load it,
+    run a segment and store it back.
+*/
+struct SIMDStateVariableFilter
+{
+    SIMDFloat ic1eq = SIMDFloat::expand(0.0f), ic2eq = SIMDFloat::expand(0.0f);
+
+    forcedinline SIMDFloat processSample(SIMDFloat in, SIMDFloat g, SIMDFloat k, const FilterModeWeights& mode) noexcept
+    {
+        const auto one = SIMDFloat::expand(1.0f);
+
+        auto a1 = one / (one + g * (g + k));
+        auto v3 = in - ic2eq;
+        auto v1 = a1 * (ic1eq + g * v3);
+        auto v2 = ic2eq + g * v1;
+
+        ic1eq = v1 + v1 - ic1eq;
+        ic2eq = v2 + v2 - ic2eq;
+
+        return SIMDFloat::expand(mode.lowPass) * v2
+             + SIMDFloat::expand(mode.bandPass) * v1
+             + SIMDFloat::expand(mode.highPass) * (in - k * v1 - v2);
+    }
+
+    void snapToZero() noexcept
+    {
+        ic1eq = snapLanesToZero(ic1eq);
+        ic2eq = snapLanesToZero(ic2eq);
+    }
+
+private:
+    static SIMDFloat snapLanesToZero(SIMDFloat v) noexcept
+    {
+        alignas(32) float lanes[SIMDFloat::size];
+        v.store(lanes);
+
+        for (auto& lane : lanes)
+            JUCE_SNAP_TO_ZERO(lane);
+
+        return SIMDFloat::load(lanes);
+    }
+};
@@ -0,0 +1,325 @@
+/*
+  ==============================================================================
+
+    LoadMonitor.h
+    Times every audio callback against its deadline, and shows the load,
+    deadline misses and dropouts on screen.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+
+//==============================================================================
+/** One audio callback, as measured on the audio thread. */
+struct CallbackTiming
+{
+    float durationSeconds = 0.0f;           // how long the callback ran
+    float deadlineSeconds = 0.0f;           // how long the audio it produced lasts
+    float intervalSeconds = 0.0f;           // since the previous callback started, or 0 for the first
+    float expectedIntervalSeconds = 0.0f;   // the previous callback's deadline
+};
+
+//==============================================================================
+/** Measures audio callbacks and passes the timings to the message thread.
+
+    The audio thread only reads the clock and pushes a CallbackTiming into a
+    preallocated AbstractFifo; everything else is worked out by whoever drains it.
+    If the reader falls behind, new timings are dropped and counted rather than
+    blocking the callback.
+*/
+class CallbackLoadMonitor
+{
+public:
+    //==============================================================================
+    CallbackLoadMonitor()
+        : fifo(capacity)
+    {
+        timings.calloc((size_t)capacity);
+    }
+
+    /** Call before the callbacks start, with the device's sample rate. */
+    void prepare(double newSampleRate) noexcept
+    {
+        sampleRate = newSampleRate;
+        lastStartTicks = 0;
+    }
+
+    //==============================================================================
+    /** Times the callback it lives in. Create one at the top of the audio callback. */
+    struct ScopedTimer
+    {
+        ScopedTimer(CallbackLoadMonitor& m, int numSamplesInCallback) noexcept
+            : monitor(m), numSamples(numSamplesInCallback), startTicks(juce::Time::getHighResolutionTicks())
+        {}
+
+        ~ScopedTimer() noexcept
+        {
+            monitor.addCallback(startTicks, juce::Time::getHighResolutionTicks(), numSamples);
+        }
+
+        CallbackLoadMonitor& monitor;
+        const int numSamples;
+        const juce::int64 startTicks;
+
+        JUCE_DECLARE_NON_COPYABLE(ScopedTimer)
+    };
+
+    //==============================================================================
+    /** Hands every timing gathered since the last call to handleTiming. Call this from
+        one thread only (normally the message thread).
+    */
+    template <typename HandleTiming>
+    void drain(HandleTiming&& handleTiming)
+    {
+        auto numReady = fifo.getNumReady();
+
+        if (numReady == 0)
+            return;
+
+        int start1, size1, start2, size2;
+        fifo.prepareToRead(numReady, start1, size1, start2, size2);
+
+        for (int i = 0; i < size1; ++i)  handleTiming(timings[start1 + i]);
+        for (int i = 0; i < size2; ++i)  handleTiming(timings[start2 + i]);
+
+        fifo.finishedRead(size1 + size2);
+    }
+
+    /** How many timings were thrown away because the fifo was full. */
+    int getNumDroppedTimings() const noexcept    { return numDropped.load(std::memory_order_relaxed); }
+
+private:
+    //==============================================================================
+    void addCallback(juce::int64 startTicks, juce::int64 endTicks, int numSamples) noexcept
+    {
+        if (sampleRate <= 0.0)
+            return;
+
+        CallbackTiming timing;
+        timing.durationSeconds = (float)juce::Time::highResolutionTicksToSeconds(endTicks - startTicks);
+        timing.deadlineSeconds = (float)(numSamples / sampleRate);
+
+        if (lastStartTicks != 0)
+        {
+            timing.intervalSeconds = (float)juce::Time::highResolutionTicksToSeconds(startTicks - lastStartTicks);
+            timing.expectedIntervalSeconds = lastDeadlineSeconds;
+        }
+
+        lastStartTicks = startTicks;
+        lastDeadlineSeconds = timing.deadlineSeconds;
+
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite(1, start1, size1, start2, size2);
+
+        if (size1 > 0)
+            timings[start1] = timing;
+        else
+            numDropped.fetch_add(1, std::memory_order_relaxed);
+
+        fifo.finishedWrite(size1);
+    }
+
+    //==============================================================================
+    static constexpr int capacity = 4096;
+
+    juce::AbstractFifo fifo;
+    juce::HeapBlock<CallbackTiming> timings;
+    std::atomic<int> numDropped { 0 };
+
+    double sampleRate = 0.0;
+    juce::int64 lastStartTicks = 0;
+    float lastDeadlineSeconds = 0.0f;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(CallbackLoadMonitor)
+};
+
+//==============================================================================
+/** What the message thread works out from the callback timings.
+
+    Load is the callback's duration as a fraction of its deadline. A deadline miss is
+    a callback that took longer than the audio it produced lasts. A dropout is a
+    callback that started noticeably later than the previous one said it should,
+    which means the device ran dry at some point, whatever the reason.
+*/
+struct CallbackLoadStatistics
+{
+    static constexpr int numHistogramBins = 12;     // 10% of the deadline each, the last one open-ended
+    static constexpr float dropoutTolerance = 1.5f; // how late a callback can start before it counts
+
+    void add(const CallbackTiming& timing) noexcept
+    {
+        if (timing.deadlineSeconds <= 0.0f)
+            return;
+
+        auto load = timing.durationSeconds / timing.deadlineSeconds;
+
+        recentLoadTotal += load;
+        ++numRecent;
+        peakLoad = juce::jmax(peakLoad, load);
+
+        ++histogram[juce::jlimit(0, numHistogramBins - 1, (int)(load * 10.0f))];
+        ++numCallbacks;
+
+        if (load > 1.0f)
+            ++numDeadlineMisses;
+
+        if (timing.expectedIntervalSeconds > 0.0f
+             && timing.intervalSeconds > timing.expectedIntervalSeconds * dropoutTolerance)
+            ++numDropouts;
+    }
+
+    /** Averages the load over everything added since the last call. */
+    void updateCurrentLoad() noexcept
+    {
+        if (numRecent > 0)
+            currentLoad = (float)(recentLoadTotal / numRecent);
+
+        recentLoadTotal = 0.0;
+        numRecent = 0;
+    }
+
+    void reset() noexcept    { *this = {}; }
+
+    juce::String toJSON() const
+    {
+        juce::StringArray bins;
+
+        for (auto count : histogram)
+            bins.add(juce::String(count));
+
+        return "{\"time\": \"" + juce::Time::getCurrentTime().toISO8601(true)
+             + "\", \"callbacks\": " + juce::String(numCallbacks)
+             + ", \"current_load\": " + juce::String(currentLoad, 4)
+             + ", \"peak_load\": " + juce::String(peakLoad, 4)
+             + ", \"deadline_misses\": " + juce::String(numDeadlineMisses)
+             + ", \"dropouts\": " + juce::String(numDropouts)
+             + ", \"load_histogram\": [" + bins.joinIntoString(", ") + "]}";
+    }
+
+    float currentLoad = 0.0f, peakLoad = 0.0f;
+    juce::int64 histogram[numHistogramBins] = {};
+    juce::int64 numCallbacks = 0, numDeadlineMisses = 0, numDropouts = 0;
+
+private:
+    double recentLoadTotal = 0.0;
+    int numRecent = 0;
+};
+
+#if JUCE_MODULE_AVAILABLE_juce_gui_basics
+
+//==============================================================================
+/** A compact read-out of the callback statistics, with a histogram of the load.
+    Click it to reset the peak and the counts. It can also append the statistics
+    to a log file, as one line of JSON every few seconds.
+*/
+class CallbackLoadPanel : public juce::Component,
+    private juce::Timer
+{
+public:
+    //==============================================================================
+    CallbackLoadPanel(CallbackLoadMonitor& monitorToShow, juce::AudioDeviceManager& deviceManagerToUse)
+        : monitor(monitorToShow), deviceManager(deviceManagerToUse)
+    {
+        addAndMakeVisible(logToggle);
+        logToggle.onClick = [this]
+        {
+            if (logToggle.getToggleState())
+                logFile.appendText("{\"log_started\": \"" + juce::Time::getCurrentTime().toISO8601(true) + "\"}\n");
+        };
+
+        logToggle.setTooltip(logFile.getFullPathName());
+
+        startTimerHz(refreshRateHz);
+    }
+
+    ~CallbackLoadPanel() override
+    {
+        stopTimer();
+    }
+
+    //==============================================================================
+    void paint(juce::Graphics& g) override
+    {
+        g.fillAll(juce::Colours::black.withAlpha(0.6f));
+
+        auto r = getLocalBounds().reduced(4);
+        auto text = r.removeFromTop(20);
+
+        g.setColour(statistics.peakLoad > 1.0f ? juce::Colours::orangered : juce::Colours::white);
+        g.drawText("DSP load " + juce::String(juce::roundToInt(statistics.currentLoad * 100.0f))
+                     + "%  peak " + juce::String(juce::roundToInt(statistics.peakLoad * 100.0f))
+                     + "%  misses " + juce::String(statistics.numDeadlineMisses)
+                     + "  dropouts " + juce::String(statistics.numDropouts)
+                     + "  device xruns " + juce::String(deviceManager.getXRunCount()),
+                   text, juce::Justification::centredLeft);
+
+        r.removeFromBottom(logToggle.getHeight());
+        drawHistogram(g, r.toFloat());
+    }
+
+    void resized() override
+    {
+        logToggle.setBounds(getLocalBounds().reduced(4).removeFromBottom(20).removeFromLeft(300));
+    }
+
+    void mouseDown(const juce::MouseEvent&) override
+    {
+        statistics.reset();
+        repaint();
+    }
+
+private:
+    //==============================================================================
+    void timerCallback() override
+    {
+        monitor.drain([this](const CallbackTiming& timing) { statistics.add(timing); });
+        statistics.updateCurrentLoad();
+
+        if (logToggle.getToggleState() && ++ticksSinceLastLog >= logIntervalSeconds * refreshRateHz)
+        {
+            ticksSinceLastLog = 0;
+            logFile.appendText(statistics.toJSON() + "\n");
+        }
+
+        repaint();
+    }
+
+    void drawHistogram(juce::Graphics& g, juce::Rectangle<float> area)
+    {
+        juce::int64 largest = 1;
+
+        for (auto count : statistics.histogram)
+            largest = juce::jmax(largest, count);
+
+        auto binWidth = area.getWidth() / (float)CallbackLoadStatistics::numHistogramBins;
+
+        for (int i = 0; i < CallbackLoadStatistics::numHistogramBins; ++i)
+        {
+            // bars are scaled by log count, so rare slow callbacks still show up
+            auto proportion = std::log1p((double)statistics.histogram[i]) / std::log1p((double)largest);
+            auto bar = area.withX(area.getX() + binWidth * (float)i).withWidth(binWidth - 1.0f);
+
+            g.setColour(i >= 10 ? juce::Colours::orangered : juce::Colours::limegreen);
+            g.fillRect(bar.withTrimmedTop(bar.getHeight() * (1.0f - (float)proportion)));
+        }
+    }
+
+    //==============================================================================
+    static constexpr int refreshRateHz = 10, logIntervalSeconds = 5;
+
+    CallbackLoadMonitor& monitor;
+    juce::AudioDeviceManager& deviceManager;
+    CallbackLoadStatistics statistics;
+
+    juce::ToggleButton logToggle { "Log callback load every 5s" };
+    juce::File logFile { juce::File::getSpecialLocation(juce::File::tempDirectory).getChildFile("MidiPolySynth-callback-load.jsonl") };
+    int ticksSinceLastLog = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(CallbackLoadPanel)
+};
+
+#endif
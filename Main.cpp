@@ -7,7 +7,14 @@
 */
 
 #include <JuceHeader.h>
+
+#define MIDIPOLYSYNTH_DEFINE_ALLOCATION_HOOKS 1
+#include "AllocationTrap.h"
+
 #include "MainComponent.h"
+#include "Benchmarks.h"
+#include "OfflineRenderer.h"
+#include "MultiInstanceHost.h"
 
 //==============================================================================
 class MidiPolySynthApplication  : public juce::JUCEApplication
@@ -19,8 +26,32 @@ public:
     const juce::String getApplicationName() override { return "Poly WaveTable Synth"; }
     const juce::String getApplicationVersion() override { return "1.0.0"; }
 
-    void initialise(const juce::String&) override
+    void initialise(const juce::String& commandLine) override
     {
+        // whole arguments only, so a file called --render.mid doesn't pick the mode
+        auto args = juce::StringArray::fromTokens(commandLine, true);
+
+        if (args.contains("--benchmark"))
+        {
+            setApplicationReturnValue(Benchmarks::runAll(args));
+            quit();
+            return;
+        }
+
+        if (args.contains("--render"))
+        {
+            setApplicationReturnValue(OfflineRenderer::run(args));
+            quit();
+            return;
+        }
+
+        if (args.contains("--instances"))
+        {
+            setApplicationReturnValue(MultiInstanceHost::run(commandLine));
+            quit();
+            return;
+        }
+
         mainWindow.reset(new MainWindow("Poly WaveTable Synth", new MainComponent, *this));
     }
 
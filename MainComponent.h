@@ -1,15 +1,18 @@
 #pragma once
 
-#include "Synth.h"
+#include "SynthProcessor.h"
 #include "Visualiser.h"
-
-extern unsigned short int numberOfVoices = 3;
+#include "LoadMonitor.h"
+#include "AllocationTrap.h"
+#include "MidiEventQueue.h"
+#include "Scope.h"
 
 
 
 class MainComponent : public juce::Component,
     private juce::AudioIODeviceCallback,  
-    private juce::MidiInputCallback       
+    private juce::MidiInputCallback,
+    private juce::Timer
 {
 public:
     //==============================================================================
@@ -31,23 +34,69 @@ public:
 
         visualiserInstrument.addListener(&visualiserComp);
 
-        for (auto i = 0; i < numberOfVoices; ++i)
-            synth.addVoice(new SynthVoice());
-
-        synth.enableLegacyMode(24);
-        synth.setVoiceStealingEnabled(false);
+        addAndMakeVisible(polyphonySlider);
+        polyphonySlider.setBounds(50, 1050, 300, 40);
+        polyphonySlider.setRange(1.0, (double)SynthAudioProcessor::maxPolyphony, 1.0);
+        polyphonySlider.setValue(SynthAudioProcessor::defaultPolyphony, juce::dontSendNotification);
+        polyphonySlider.onValueChange = [this]
+        {
+            synth.setPolyphony((int)polyphonySlider.getValue());
+        };
+
+        addAndMakeVisible(stealingPolicyBox);
+        stealingPolicyBox.setBounds(350, 1050, 300, 30);
+        stealingPolicyBox.addItem("Steal oldest", 1 + (int)VoiceStealingPolicy::oldest);
+        stealingPolicyBox.addItem("Steal quietest", 1 + (int)VoiceStealingPolicy::quietest);
+        stealingPolicyBox.addItem("Steal same note", 1 + (int)VoiceStealingPolicy::sameNote);
+        stealingPolicyBox.setSelectedId(1 + (int)synth.getVoiceStealingPolicy(), juce::dontSendNotification);
+        stealingPolicyBox.onChange = [this]
+        {
+            synth.setVoiceStealingPolicy((VoiceStealingPolicy)(stealingPolicyBox.getSelectedId() - 1));
+        };
+
+        addAndMakeVisible(parallelRenderingToggle);
+        parallelRenderingToggle.setBounds(350, 1010, 300, 30);
+        parallelRenderingToggle.onClick = [this]
+        {
+            synth.setParallelRenderingEnabled(parallelRenderingToggle.getToggleState());
+        };
+
+        addAndMakeVisible(soaEngineToggle);
+        soaEngineToggle.setBounds(50, 1010, 300, 30);
+        soaEngineToggle.onClick = [this]
+        {
+            processor.setSoAEngineEnabled(soaEngineToggle.getToggleState());
+        };
+
+        addAndMakeVisible(voiceCountLabel);
+        voiceCountLabel.setBounds(50, 1100, 600, 24);
+        startTimerHz(60);
+
+        addAndMakeVisible(loadPanel);
+        loadPanel.setBounds(700, 1010, 550, 120);
 
         addAndMakeVisible(synthComp);
-        synthComp.setBounds(50, 400, 1200, 600);
+        synthComp.setBounds(50, 400, 900, 600);
+
+        addAndMakeVisible(scopePanel);
+        scopePanel.setBounds(960, 400, 500, 600);
+
+        addAndMakeVisible(wavetableLibraryPanel);
+        wavetableLibraryPanel.setBounds(50, 1130, 600, 30);
+
+        addAndMakeVisible(effectsPanel);
+        effectsPanel.setBounds(50, 1170, 1400, 130);
 
         visualiserInstrument.enableLegacyMode(24);
 
-        setSize(1500, 1500);
+        setSize(1500, 1600);
     }
 
     ~MainComponent() override
     {
+        stopTimer();
         audioDeviceManager.removeMidiInputDeviceCallback({}, this);
+        audioDeviceManager.removeAudioCallback(this);
     }
 
     //==============================================================================
@@ -66,41 +115,81 @@ public:
     }
 
     //==============================================================================
-    void audioDeviceIOCallback(const float** /*inputChannelData*/, int /*numInputChannels*/,
-        float** outputChannelData, int numOutputChannels,
-        int numSamples) override
+    void audioDeviceIOCallbackWithContext(const float* const* /*inputChannelData*/, int /*numInputChannels*/,
+        float* const* outputChannelData, int numOutputChannels,
+        int numSamples, const juce::AudioIODeviceCallbackContext& /*context*/) override
     {
+        AllocationTrap::ScopedRealtimeSection realtimeSection;
+        CallbackLoadMonitor::ScopedTimer loadTimer(loadMonitor, numSamples);
+        juce::ScopedNoDenormals noDenormals;
+
         // make buffer
         juce::AudioBuffer<float> buffer(outputChannelData, numOutputChannels, numSamples);
 
-        // clear it to silence
-        buffer.clear();
+        incomingMidi.clear();
 
-        juce::MidiBuffer incomingMidi;
+        // get the MIDI messages for this audio block, each at the sample it arrived
+        midiQueue.removeNextBlockOfMessages(incomingMidi, numSamples);
 
-        // get the MIDI messages for this audio block
-        midiCollector.removeNextBlockOfMessages(incomingMidi, numSamples);
+        // parameter changes land where a MIDI event arriving at the same moment would
+        processor.renderBlock(buffer, incomingMidi, numSamples,
+                              [this](double changeTime) { return midiQueue.getSamplePosition(changeTime); });
 
-        // synthesise the block
-        synth.renderNextBlock(buffer, incomingMidi, 0, numSamples);
+        // hand a copy to the scope, which does all its work on the message thread
+        audioTap.push(buffer, numSamples);
     }
 
+    /** Everything that depends on the sample rate or the block size is set up here, so
+        a device change costs the callback nothing.
+    */
     void audioDeviceAboutToStart(juce::AudioIODevice* device) override
     {
         auto sampleRate = device->getCurrentSampleRate();
-        midiCollector.reset(sampleRate);
-        synth.setCurrentPlaybackSampleRate(sampleRate);
+        auto maximumBlockSize = device->getCurrentBufferSizeSamples();
+        auto numChannels = device->getActiveOutputChannels().countNumberOfSetBits();
+
+        midiQueue.prepare(sampleRate);
+
+        // everything the callback needs is allocated here, before it starts
+        incomingMidi.clear();
+        incomingMidi.ensureSize(midiBufferBytes);
+        loadMonitor.prepare(sampleRate);
+        audioTap.prepare(sampleRate);
+
+        processor.setPlayConfigDetails(0, numChannels, sampleRate, maximumBlockSize);
+        processor.prepareToPlay(sampleRate, maximumBlockSize);
     }
 
-    void audioDeviceStopped() override {}
+    void audioDeviceStopped() override
+    {
+        processor.releaseResources();
+    }
 
 private:
     //==============================================================================
+    void timerCallback() override
+    {
+        // the keyboard display gets its own copy of the MIDI, so it never holds up the audio
+        guiMidiQueue.drain([this](const MidiEventQueue::Event& event)
+        {
+            visualiserInstrument.processNextMidiEvent(event.toMidiMessage());
+        });
+
+        auto counts = synth.getVoiceCounts();
+
+        voiceCountLabel.setText("Voices: " + juce::String(counts.active) + " active, "
+                                  + juce::String(counts.releasing) + " releasing, "
+                                  + juce::String(counts.sleeping) + " sleeping",
+                                juce::dontSendNotification);
+
+        processor.getWavetableSwitcher().releaseRetiredTables();
+    }
+
     void handleIncomingMidiMessage(juce::MidiInput* /*source*/,
         const juce::MidiMessage& message) override
     {
-        visualiserInstrument.processNextMidiEvent(message);
-        midiCollector.addMessageToQueue(message);
+        midiQueue.push(message);
+        guiMidiQueue.push(message);
     }
 
     //==============================================================================
@@ -110,11 +199,31 @@ private:
     Visualiser visualiserComp;
     juce::Viewport visualiserViewport;
 
-    SynthComponent synthComp;
+    SynthAudioProcessor processor;
+    PolySynthesiser& synth = processor.getSynth();
+    SynthComponent synthComp { processor.getParameterStore() };
 
     juce::MPEInstrument visualiserInstrument;
-    juce::MPESynthesiser synth;
-    juce::MidiMessageCollector midiCollector;
+    juce::ToggleButton soaEngineToggle { "Structure-of-arrays voice engine" };
+    juce::ToggleButton parallelRenderingToggle { "Parallel voice rendering" };
+
+    juce::Slider polyphonySlider;
+    juce::ComboBox stealingPolicyBox;
+    juce::Label voiceCountLabel;
+    MidiEventQueue midiQueue, guiMidiQueue;
+    juce::MidiBuffer incomingMidi;
+    static constexpr size_t midiBufferBytes = 2048 * 16;   // a burst of 2048 short messages in one block
+
+    CallbackLoadMonitor loadMonitor;
+    CallbackLoadPanel loadPanel { loadMonitor, audioDeviceManager };
+
+    AudioTap audioTap;
+    ScopePanel scopePanel { audioTap };
+
+    WavetableLibrary wavetableLibrary;
+    WavetableLibraryPanel wavetableLibraryPanel { wavetableLibrary, processor.getWavetableSwitcher() };
+
+    EffectsPanel effectsPanel { processor.getParameterStore(), processor.getEffectsBus() };
 
     juce::Label sustainLabel;
     juce::Slider sustainSlider;
@@ -0,0 +1,203 @@
+/*
+  ==============================================================================
+
+    MidiEventQueue.h
+    A lock-free single-producer, single-consumer queue of timestamped MIDI
+    events, placed sample-accurately into the audio blocks that play them.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+
+//==============================================================================
+/** Carries short MIDI messages from the MIDI input thread to one consumer.
+
+    Each event is timestamped when it arrives. The audio thread then places it in the
+    block that covers that moment, at the matching sample, so a dense controller
+    stream keeps its spacing instead of being squeezed into whatever part of the
+    block it happened to land in. Every event is played about one block after it
+    arrived, and that delay stays constant.
+
+    To get there, the queue keeps its own estimate of when each block starts. Rather
+    than trusting each callback's wake-up time, which jitters with the scheduler,
+    it advances the estimate by the length of every block and lets it drift slowly
+    towards the callback times.
+
+    Nothing locks or allocates after construction. When the queue is full, new
+    events are dropped and counted. Only messages of up to three bytes are carried,
+    which covers everything MPE sends; SysEx is dropped.
+*/
+class MidiEventQueue
+{
+public:
+    //==============================================================================
+    struct Event
+    {
+        juce::uint8 data[3];
+        juce::uint8 numBytes;
+        double timeInSeconds;   // on the Time::getMillisecondCounterHiRes() clock
+
+        juce::MidiMessage toMidiMessage() const    { return juce::MidiMessage(data, (int)numBytes, timeInSeconds); }
+    };
+
+    explicit MidiEventQueue(int capacity = 4096)
+        : fifo(capacity)
+    {
+        events.calloc((size_t)capacity);
+    }
+
+    static double getCurrentTimeInSeconds() noexcept    { return juce::Time::getMillisecondCounterHiRes() * 0.001; }
+
+    //==============================================================================
+    /** Adds a message, timestamped with when it arrived. Producer thread only. */
+    bool push(const juce::MidiMessage& message) noexcept
+    {
+        auto numBytes = message.getRawDataSize();
+
+        if (numBytes > 3 || numBytes == 0)
+            return false;
+
+        // MidiInput stamps messages on arrival, on the same clock as ours
+        auto time = message.getTimeStamp() > 0.0 ? message.getTimeStamp() : getCurrentTimeInSeconds();
+
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite(1, start1, size1, start2, size2);
+
+        if (size1 == 0)
+        {
+            numDropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        auto& event = events[start1];
+        std::memcpy(event.data, message.getRawData(), (size_t)numBytes);
+        event.numBytes = (juce::uint8)numBytes;
+        event.timeInSeconds = time;
+
+        fifo.finishedWrite(1);
+        return true;
+    }
+
+    int getNumDroppedEvents() const noexcept    { return numDropped.load(std::memory_order_relaxed); }
+
+    //==============================================================================
+    /** Call before the consumer starts, e.g. from audioDeviceAboutToStart(). */
+    void prepare(double newSampleRate) noexcept
+    {
+        sampleRate = newSampleRate;
+        timelineStarted = false;
+    }
+
+    /** Moves the events that fall inside the next block of numSamples into destination,
+        each at its own sample. Events that arrived after the block's end stay queued for
+        the next one. Audio thread only, once per callback.
+    */
+    void removeNextBlockOfMessages(juce::MidiBuffer& destination, int numSamples) noexcept
+    {
+        jassert(sampleRate > 0.0);
+
+        auto blockStart = advanceTimeline(numSamples);
+        auto blockEnd = blockStart + numSamples / sampleRate;
+        lastBlockStart = blockStart;
+        lastBlockLength = numSamples;
+
+        removeEventsBefore(blockEnd, [&](const Event& event)
+        {
+            auto position = juce::roundToInt((event.timeInSeconds - blockStart) * sampleRate);
+            destination.addEvent(event.data, (int)event.numBytes, juce::jlimit(0, numSamples - 1, position));
+        });
+    }
+
+    /** Where something that happened at timeInSeconds falls in the block last filled by
+        removeNextBlockOfMessages(), placed the same way as its events. Audio thread only.
+    */
+    int getSamplePosition(double timeInSeconds) const noexcept
+    {
+        auto position = juce::roundToInt((timeInSeconds - lastBlockStart) * sampleRate);
+        return juce::jlimit(0, juce::jmax(0, lastBlockLength - 1), position);
+    }
+
+    /** Hands every queued event to handleEvent, oldest first. For a consumer that isn't
+        the audio thread, such as the GUI. Consumer thread only.
+    */
+    template <typename HandleEvent>
+    void drain(HandleEvent&& handleEvent)
+    {
+        removeEventsBefore(std::numeric_limits<double>::max(), handleEvent);
+    }
+
+private:
+    //==============================================================================
+    /** Returns when the block about to be rendered started, on the arrival clock. */
+    double advanceTimeline(int numSamples) noexcept
+    {
+        auto blockDuration = numSamples / sampleRate;
+        auto measuredStart = getCurrentTimeInSeconds() - blockDuration;
+
+        if (! timelineStarted
+             || std::abs(measuredStart - nextBlockStart) > juce::jmax(resyncThresholdInSeconds, 2.0 * blockDuration))
+        {
+            nextBlockStart = measuredStart;
+            timelineStarted = true;
+        }
+        else
+        {
+            nextBlockStart += (measuredStart - nextBlockStart) * driftCorrection;
+        }
+
+        auto blockStart = nextBlockStart;
+        nextBlockStart += blockDuration;
+        return blockStart;
+    }
+
+    template <typename HandleEvent>
+    void removeEventsBefore(double endTime, HandleEvent&& handleEvent)
+    {
+        auto numReady = fifo.getNumReady();
+
+        if (numReady == 0)
+            return;
+
+        int start1, size1, start2, size2;
+        fifo.prepareToRead(numReady, start1, size1, start2, size2);
+
+        auto numTaken = takeEvents(start1, size1, endTime, handleEvent);
+
+        if (numTaken == size1)
+            numTaken += takeEvents(start2, size2, endTime, handleEvent);
+
+        fifo.finishedRead(numTaken);
+    }
+
+    /** Hands over events from one part of the ring until one is at or after endTime. */
+    template <typename HandleEvent>
+    int takeEvents(int start, int size, double endTime, HandleEvent& handleEvent)
+    {
+        for (int i = 0; i < size; ++i)
+        {
+            if (events[start + i].timeInSeconds >= endTime)
+                return i;
+
+            handleEvent(events[start + i]);
+        }
+
+        return size;
+    }
+
+    //==============================================================================
+    static constexpr double resyncThresholdInSeconds = 0.05, driftCorrection = 0.01;
+
+    juce::AbstractFifo fifo;
+    juce::HeapBlock<Event> events;
+    std::atomic<int> numDropped { 0 };
+
+    double sampleRate = 0.0, nextBlockStart = 0.0, lastBlockStart = 0.0;
+    int lastBlockLength = 0;
+    bool timelineStarted = false;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MidiEventQueue)
+};
@@ -0,0 +1,324 @@
+/*
+  ==============================================================================
+
+    Modulation.h
+    The per-voice modulation matrix: LFOs, a second envelope and the MPE
+    dimensions routed to pitch, morph, cutoff and amplitude, worked out once
+    per control segment.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "SIMD.h"
+
+
+//==============================================================================
+enum class ModulationSource
+{
+    lfo1,
+    lfo2,
+    envelope2,
+    pressure,       // 0 to 1
+    timbre,         // 0 to 1
+    pitchBend       // -1 to 1
+};
+
+enum class ModulationDestination
+{
+    pitch,          // in semitones
+    morph,          // in fractions of the whole wavetable
+    cutoff,         // in octaves
+    amplitude       // added to a gain of 1
+};
+
+static constexpr int numModulationSources = 6, numModulationDestinations = 4;
+
+enum class LFOShape
+{
+    sine,
+    triangle,
+    saw,
+    square
+};
+
+//==============================================================================
+/** One row of the matrix, as the user edits it. amount goes from -1 to 1 and is scaled
+    to the destination's range; a route with no amount does nothing.
+*/
+struct ModulationRoute
+{
+    ModulationSource source = ModulationSource::lfo1;
+    ModulationDestination destination = ModulationDestination::pitch;
+    float amount = 0.0f;
+};
+
+struct LFOParameters
+{
+    float rate = 2.0f;      // in Hz
+    LFOShape shape = LFOShape::sine;
+};
+
+/** Everything about the modulation the user can change, to go in SynthParameters. */
+struct ModulationParameters
+{
+    static constexpr int numLFOs = 2, maxRoutes = 8;
+
+    LFOParameters lfos[numLFOs];
+    juce::ADSR::Parameters envelope2;
+    ModulationRoute routes[maxRoutes];
+};
+
+//==============================================================================
+/** The LFO shapes, read from a 32-bit fixed-point phase, for one voice or a lane per
+    voice. Both versions give the same values.
+
+    Every shape starts at zero and rises, so a note's LFOs all start together. The sine
+    is a cubic fitted to the triangle, which is close enough for modulation and cheap to
+    vectorise.
+*/
+struct ModulationLFO
+{
+    static juce::uint32 getPhaseDelta(float rate, double sampleRate) noexcept
+    {
+        return (juce::uint32)juce::jlimit(0.0, 4294967295.0, rate / sampleRate * 4294967296.0);
+    }
+
+    static float getValue(LFOShape shape, juce::uint32 phase) noexcept
+    {
+        if (shape == LFOShape::saw)
+            return 2.0f * toUnit(phase + 0x80000000u) - 1.0f;
+
+        auto triangle = 1.0f - 4.0f * std::abs(toUnit(phase + 0x40000000u) - 0.5f);
+
+        switch (shape)
+        {
+            case LFOShape::sine:    return triangle * (1.5f - 0.5f * triangle * triangle);
+            case LFOShape::square:  return juce::jlimit(-1.0f, 1.0f, triangle * squareSteepness);
+            case LFOShape::triangle:
+            default:                return triangle;
+        }
+    }
+
+    static SIMDFloat getValues(LFOShape shape, SIMDUInt32 phases) noexcept
+    {
+        const auto one = SIMDFloat::expand(1.0f);
+
+        if (shape == LFOShape::saw)
+            return SIMDFloat::expand(2.0f) * toUnit(phases + SIMDUInt32::expand(0x80000000u)) - one;
+
+        auto centred = toUnit(phases + SIMDUInt32::expand(0x40000000u)) - SIMDFloat::expand(0.5f);
+        auto magnitude = SIMDFloat::max(centred, SIMDFloat::expand(0.0f) - centred);
+        auto triangle = one - SIMDFloat::expand(4.0f) * magnitude;
+
+        switch (shape)
+        {
+            case LFOShape::sine:    return triangle * (SIMDFloat::expand(1.5f) - SIMDFloat::expand(0.5f) * triangle * triangle);
+            case LFOShape::square:  return SIMDFloat::min(one, SIMDFloat::max(SIMDFloat::expand(-1.0f), triangle * SIMDFloat::expand(squareSteepness)));
+            case LFOShape::triangle:
+            default:                return triangle;
+        }
+    }
+
+private:
+    static constexpr float squareSteepness = 1024.0f;
+    static constexpr float phaseScale = 1.0f / 16777216.0f;
+
+    static float toUnit(juce::uint32 phase) noexcept        { return (float)(phase >> 8) * phaseScale; }
+    static SIMDFloat toUnit(SIMDUInt32 phases) noexcept     { return phases.shiftRight(8).toFloat() * SIMDFloat::expand(phaseScale); }
+};
+
+//==============================================================================
+/** A linear ADSR that only moves at control rate: advance() jumps a whole segment at
+    once. The stages match juce::ADSR's, and parameter changes apply straight away.
+*/
+class ControlRateEnvelope
+{
+public:
+    /** The parameters as steps per sample, worked out once for every voice. */
+    struct Rates
+    {
+        float attackStep = 1.0f, decayStep = 1.0f, sustain = 1.0f, releaseLength = 1.0f;
+
+        static Rates make(const juce::ADSR::Parameters& parameters, double sampleRate) noexcept
+        {
+            auto getLength = [sampleRate](float seconds) { return juce::jmax(1.0f, (float)(seconds * sampleRate)); };
+
+            return { 1.0f / getLength(parameters.attack),
+                     (1.0f - parameters.sustain) / getLength(parameters.decay),
+                     parameters.sustain,
+                     getLength(parameters.release) };
+        }
+    };
+
+    void noteOn() noexcept                      { stage = Stage::attack; }
+    void noteOff(const Rates& rates) noexcept
+    {
+        if (stage != Stage::idle)
+        {
+            stage = Stage::release;
+            releaseStep = level / rates.releaseLength;
+        }
+    }
+
+    void reset() noexcept
+    {
+        stage = Stage::idle;
+        level = 0.0f;
+    }
+
+    float getLevel() const noexcept             { return level; }
+
+    /** Moves numSamples on, through as many stages as that takes, and returns the level. */
+    float advance(int numSamples, const Rates& rates) noexcept
+    {
+        auto remaining = (float)numSamples;
+
+        for (;;)
+        {
+            switch (stage)
+            {
+                case Stage::attack:
+                {
+                    auto needed = (1.0f - level) / rates.attackStep;
+
+                    if (needed > remaining)
+                        return level += rates.attackStep * remaining;
+
+                    level = 1.0f;
+                    remaining -= needed;
+                    stage = Stage::decay;
+                    break;
+                }
+
+                case Stage::decay:
+                {
+                    auto needed = rates.decayStep > 0.0f ? (level - rates.sustain) / rates.decayStep : 0.0f;
+
+                    if (needed > remaining)
+                        return level -= rates.decayStep * remaining;
+
+                    level = rates.sustain;
+                    remaining -= juce::jmax(0.0f, needed);
+                    stage = Stage::sustain;
+                    break;
+                }
+
+                case Stage::sustain:
+                    return level = rates.sustain;
+
+                case Stage::release:
+                    if (level > releaseStep * remaining)
+                        return level -= releaseStep * remaining;
+
+                    reset();
+                    return level;
+
+                case Stage::idle:
+                default:
+                    return level;
+            }
+        }
+    }
+
+private:
+    enum class Stage
+    {
+        idle,
+        attack,
+        decay,
+        sustain,
+        release
+    };
+
+    Stage stage = Stage::idle;
+    float level = 0.0f, releaseStep = 0.0f;
+};
+
+//==============================================================================
+/** The routing, compiled from ModulationParameters into a flat list of multiply-adds
+    with the amounts already scaled to each destination's units. Routes that do
+    nothing are left out, and the masks say which sources and destinations are in use,
+    so an engine can skip whatever isn't.
+
+    The timbre-to-cutoff and timbre-to-morph amounts are compiled in as two more
+    routes, so the voices only have one way of modulating anything.
+*/
+class ModulationMatrix
+{
+public:
+    static constexpr int maxRoutes = ModulationParameters::maxRoutes + 2;
+
+    void compile(const ModulationParameters& parameters, float timbreToCutoff, float timbreToMorph) noexcept
+    {
+        numRoutes = 0;
+        sourceMask = 0;
+        destinationMask = 0;
+
+        for (auto& route : parameters.routes)
+            add(route.source, route.destination, route.amount * getRange(route.destination));
+
+        add(ModulationSource::timbre, ModulationDestination::cutoff, timbreToCutoff);
+        add(ModulationSource::timbre, ModulationDestination::morph, timbreToMorph);
+    }
+
+    bool isEmpty() const noexcept                                   { return numRoutes == 0; }
+    bool uses(ModulationSource source) const noexcept               { return (sourceMask & (1 << (int)source)) != 0; }
+    bool modulates(ModulationDestination destination) const noexcept { return (destinationMask & (1 << (int)destination)) != 0; }
+
+    /** Sums every route into destinations, given the value of each source. */
+    void evaluate(const float* sources, float* destinations) const noexcept
+    {
+        for (int i = 0; i < numModulationDestinations; ++i)
+            destinations[i] = 0.0f;
+
+        for (int i = 0; i < numRoutes; ++i)
+            destinations[routes[i].destination] += sources[routes[i].source] * routes[i].amount;
+    }
+
+    /** The same for a lane per voice. */
+    void evaluate(const SIMDFloat* sources, SIMDFloat* destinations) const noexcept
+    {
+        for (int i = 0; i < numModulationDestinations; ++i)
+            destinations[i] = SIMDFloat::expand(0.0f);
+
+        for (int i = 0; i < numRoutes; ++i)
+            destinations[routes[i].destination] = destinations[routes[i].destination]
+                                                    + sources[routes[i].source] * SIMDFloat::expand(routes[i].amount);
+    }
+
+    /** How far an amount of 1 moves each destination. */
+    static float getRange(ModulationDestination destination) noexcept
+    {
+        switch (destination)
+        {
+            case ModulationDestination::pitch:      return 12.0f;
+            case ModulationDestination::cutoff:     return 4.0f;
+            case ModulationDestination::morph:
+            case ModulationDestination::amplitude:
+            default:                                return 1.0f;
+        }
+    }
+
+private:
+    struct Route
+    {
+        int source, destination;
+        float amount;
+    };
+
+    void add(ModulationSource source, ModulationDestination destination, float amount) noexcept
+    {
+        if (amount == 0.0f || numRoutes == maxRoutes)
+            return;
+
+        routes[numRoutes++] = { (int)source, (int)destination, amount };
+        sourceMask |= 1 << (int)source;
+        destinationMask |= 1 << (int)destination;
+    }
+
+    Route routes[maxRoutes];
+    int numRoutes = 0, sourceMask = 0, destinationMask = 0;
+};
@@ -0,0 +1,217 @@
+/*
+  ==============================================================================
+
+    MultiInstanceHost.h
+    A headless host that runs many SynthAudioProcessors side by side, on
+    several threads at once, and checks that they don't affect each other.
+    Start the app with --instances to run it.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <iostream>
+#include <thread>
+#include "SynthProcessor.h"
+
+
+//==============================================================================
+/** Loads a batch of processors the way a plugin host would and plays the same MIDI
+    into all of them, every instance on a thread of its own, all running together.
+
+    Every other instance gets a different cutoff, so an instance picking up another's
+    state would show. Each one's output is hashed, and compared with a reference
+    instance rendered on its own beforehand with the same settings: if any of them
+    differ, something is being shared that shouldn't be.
+
+    Results are printed as one line of JSON, and the return value is 0 only if every
+    instance matched.
+*/
+class MultiInstanceHost
+{
+public:
+    //==============================================================================
+    struct Options
+    {
+        int numInstances = 32;
+        int numThreads = 0;             // 0 means one per core
+        int blockSize = 256;
+        double sampleRate = 48000.0;
+        double seconds = 4.0;
+    };
+
+    /** Reads the options from a command line of the form
+            --instances [n] [--threads n] [--block-size n] [--sample-rate hz] [--seconds s]
+        runs the host, and returns the process exit code.
+    */
+    static int run(const juce::String& commandLine)
+    {
+        auto args = juce::StringArray::fromTokens(commandLine, true);
+        args.trim();
+        args.removeEmptyStrings();
+
+        auto getValue = [&](const char* name, const juce::String& fallback)
+        {
+            auto i = args.indexOf(name);
+            return i >= 0 && i + 1 < args.size() && ! args[i + 1].startsWith("--") ? args[i + 1] : fallback;
+        };
+
+        Options options;
+        options.numInstances = getValue("--instances",   juce::String(options.numInstances)).getIntValue();
+        options.numThreads   = getValue("--threads",     juce::String(options.numThreads)).getIntValue();
+        options.blockSize    = getValue("--block-size",  juce::String(options.blockSize)).getIntValue();
+        options.sampleRate   = getValue("--sample-rate", juce::String(options.sampleRate)).getDoubleValue();
+        options.seconds      = getValue("--seconds",     juce::String(options.seconds)).getDoubleValue();
+
+        juce::String error;
+
+        if (options.numInstances <= 0)          error = "There must be at least one instance";
+        else if (options.numThreads < 0)        error = "The number of threads can't be negative";
+        else if (options.blockSize <= 0)        error = "The block size must be at least 1";
+        else if (options.sampleRate <= 0.0)     error = "The sample rate must be positive";
+        else if (options.seconds <= 0.0)        error = "The length must be positive";
+
+        if (error.isNotEmpty())
+        {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+
+        return MultiInstanceHost(options).runAll() ? 0 : 1;
+    }
+
+    //==============================================================================
+    explicit MultiInstanceHost(const Options& optionsToUse)
+        : options(optionsToUse)
+    {
+    }
+
+    bool runAll()
+    {
+        // one reference per setting, each rendered with nothing else running
+        juce::uint64 references[2];
+
+        for (int variant = 0; variant < 2; ++variant)
+        {
+            auto reference = createInstance(variant);
+            references[variant] = renderAll(*reference);
+        }
+
+        juce::OwnedArray<SynthAudioProcessor> instances;
+
+        for (int i = 0; i < options.numInstances; ++i)
+            instances.add(createInstance(i & 1).release());
+
+        std::vector<juce::uint64> hashes((size_t)options.numInstances);
+        auto numThreads = options.numThreads > 0 ? options.numThreads : juce::jmax(1, (int)std::thread::hardware_concurrency());
+        std::atomic<int> nextInstance { 0 };
+
+        auto start = juce::Time::getHighResolutionTicks();
+
+        {
+            std::vector<std::thread> threads;
+
+            for (int t = 0; t < numThreads; ++t)
+            {
+                threads.emplace_back([&]
+                {
+                    for (int i; (i = nextInstance.fetch_add(1)) < options.numInstances;)
+                        hashes[(size_t)i] = renderAll(*instances[i]);
+                });
+            }
+
+            for (auto& thread : threads)
+                thread.join();
+        }
+
+        auto renderSeconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start);
+
+        int numMismatched = 0;
+
+        for (int i = 0; i < options.numInstances; ++i)
+            if (hashes[(size_t)i] != references[i & 1])
+                ++numMismatched;
+
+        auto audioSeconds = options.seconds * options.numInstances;
+
+        std::cout << "{\"instances\": " << options.numInstances
+                  << ", \"threads\": " << numThreads
+                  << ", \"block_size\": " << options.blockSize
+                  << ", \"audio_seconds\": " << audioSeconds
+                  << ", \"render_seconds\": " << renderSeconds
+                  << ", \"realtime_factor\": " << (renderSeconds > 0.0 ? audioSeconds / renderSeconds : 0.0)
+                  << ", \"settings_differ\": " << (references[0] != references[1] ? "true" : "false")
+                  << ", \"mismatched\": " << numMismatched << "}" << std::endl;
+
+        return numMismatched == 0 && references[0] != references[1];
+    }
+
+private:
+    //==============================================================================
+    std::unique_ptr<SynthAudioProcessor> createInstance(int variant) const
+    {
+        std::unique_ptr<SynthAudioProcessor> processor(new SynthAudioProcessor());
+
+        processor->getParameterStore().update([variant](SynthParameters& p)
+        {
+            p.filterCutoff = variant == 0 ? 8000.0f : 1500.0f;
+        });
+
+        processor->setPlayConfigDetails(0, 2, options.sampleRate, options.blockSize);
+        processor->prepareToPlay(options.sampleRate, options.blockSize);
+        return processor;
+    }
+
+    /** Plays a chord that changes every half second, and returns a hash of the output. */
+    juce::uint64 renderAll(SynthAudioProcessor& processor) const
+    {
+        juce::AudioBuffer<float> buffer(2, options.blockSize);
+        juce::MidiBuffer midi;
+
+        auto totalSamples = (juce::int64)(options.seconds * options.sampleRate);
+        auto chordLength = (juce::int64)(0.5 * options.sampleRate);
+        juce::uint64 hash = 14695981039346656037ull;
+
+        for (juce::int64 blockStart = 0; blockStart < totalSamples; blockStart += options.blockSize)
+        {
+            midi.clear();
+
+            for (auto chordStart = (blockStart + chordLength - 1) / chordLength * chordLength;
+                 chordStart < blockStart + options.blockSize; chordStart += chordLength)
+            {
+                auto position = (int)(chordStart - blockStart);
+                auto chord = chordStart / chordLength;
+                auto root = 48 + (int)(chord % 12), previousRoot = 48 + (int)((chord + 11) % 12);
+
+                for (auto interval : { 0, 4, 7, 11 })
+                {
+                    if (chord > 0)
+                        midi.addEvent(juce::MidiMessage::noteOff(1, previousRoot + interval), position);
+
+                    midi.addEvent(juce::MidiMessage::noteOn(1, root + interval, (juce::uint8)100), position);
+                }
+            }
+
+            processor.processBlock(buffer, midi);
+
+            // FNV-1a over the raw sample bits, so only an exact match passes
+            for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+            {
+                auto* bytes = reinterpret_cast<const juce::uint8*>(buffer.getReadPointer(channel));
+
+                for (size_t i = 0; i < (size_t)options.blockSize * sizeof(float); ++i)
+                    hash = (hash ^ bytes[i]) * 1099511628211ull;
+            }
+        }
+
+        processor.releaseResources();
+        return hash;
+    }
+
+    //==============================================================================
+    Options options;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MultiInstanceHost)
+};
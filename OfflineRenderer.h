@@ -0,0 +1,247 @@
+/*
+  ==============================================================================
+
+    OfflineRenderer.h
+    Renders a Standard MIDI File through the synth to a WAV file, with no GUI or
+    audio device, as fast as the CPU allows. Start the app with
+    --render <in.mid> <out.wav> to use it, or run the console build from
+    RenderMain.cpp, which needs no GUI modules at all.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <iostream>
+#include "AllocationTrap.h"
+#include "Parameters.h"
+#include "PolySynthesiser.h"
+#include "SubBlockRenderer.h"
+
+
+//==============================================================================
+class OfflineRenderer
+{
+public:
+    //==============================================================================
+    struct Options
+    {
+        juce::File midiFile, wavFile;
+        double sampleRate = 48000.0;
+        int blockSize = 512;
+        int numVoices = 16;
+        int numWorkers = 0;
+        int bitDepth = 24;
+        double tailSeconds = 1.0;
+    };
+
+    /** Reads the options from a command line of the form
+            --render <in.mid> <out.wav> [--block-size n] [--sample-rate hz] [--voices n]
+                     [--workers n] [--bit-depth 16|24|32] [--tail seconds]
+        Returns an error message if they don't make sense.
+    */
+    static juce::String parseCommandLine(juce::StringArray args, Options& options)
+    {
+        args.trim();
+        args.removeEmptyStrings();
+
+        auto index = args.indexOf("--render");
+
+        if (index < 0 || index + 2 >= args.size())
+            return "Usage: --render <in.mid> <out.wav> [--block-size n] [--sample-rate hz] [--voices n] "
+                   "[--workers n] [--bit-depth 16|24|32] [--tail seconds]";
+
+        options.midiFile = juce::File::getCurrentWorkingDirectory().getChildFile(args[index + 1].unquoted());
+        options.wavFile  = juce::File::getCurrentWorkingDirectory().getChildFile(args[index + 2].unquoted());
+
+        auto getValue = [&](const char* name, const juce::String& fallback)
+        {
+            auto i = args.indexOf(name);
+            return i >= 0 && i + 1 < args.size() ? args[i + 1] : fallback;
+        };
+
+        options.blockSize   = getValue("--block-size",  juce::String(options.blockSize)).getIntValue();
+        options.sampleRate  = getValue("--sample-rate", juce::String(options.sampleRate)).getDoubleValue();
+        options.numVoices   = getValue("--voices",      juce::String(options.numVoices)).getIntValue();
+        options.numWorkers  = getValue("--workers",     juce::String(options.numWorkers)).getIntValue();
+        options.bitDepth    = getValue("--bit-depth",   juce::String(options.bitDepth)).getIntValue();
+        options.tailSeconds = getValue("--tail",        juce::String(options.tailSeconds)).getDoubleValue();
+
+        if (options.blockSize <= 0)                          return "The block size must be at least 1";
+        if (options.sampleRate <= 0.0)                       return "The sample rate must be positive";
+        if (options.numVoices <= 0)                          return "There must be at least one voice";
+        if (options.numWorkers < 0)                          return "The number of workers can't be negative";
+        if (options.tailSeconds < 0.0)                       return "The tail can't be negative";
+        if (! juce::Array<int> { 16, 24, 32 }.contains(options.bitDepth))
+            return "The bit depth must be 16, 24 or 32";
+
+        return {};
+    }
+
+    /** Renders the file and returns the process exit code. */
+    static int run(const juce::StringArray& args)
+    {
+        Options options;
+        auto error = parseCommandLine(args, options);
+
+        if (error.isEmpty())
+            error = OfflineRenderer(options).render();
+
+        if (error.isNotEmpty())
+        {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+
+        return 0;
+    }
+
+    static int run(const juce::String& commandLine)
+    {
+        return run(juce::StringArray::fromTokens(commandLine, true));
+    }
+
+    //==============================================================================
+    explicit OfflineRenderer(const Options& optionsToUse)
+        : options(optionsToUse)
+    {
+        for (int i = 0; i < options.numVoices; ++i)
+            synth.addVoice(new SynthVoice(controlState));
+
+        synth.enableLegacyMode(24);
+        synth.setVoiceStealingEnabled(false);
+    }
+
+    /** Renders options.midiFile into options.wavFile, printing the real-time factor as
+        a line of JSON. Returns an error message if anything goes wrong.
+    */
+    juce::String render()
+    {
+        juce::MidiMessageSequence sequence;
+        auto error = readMidiFile(sequence);
+
+        if (error.isNotEmpty())
+            return error;
+
+        options.wavFile.deleteFile();
+        std::unique_ptr<juce::OutputStream> stream(options.wavFile.createOutputStream());
+
+        if (stream == nullptr)
+            return "Couldn't write to " + options.wavFile.getFullPathName();
+
+        const int numChannels = 2;
+        juce::WavAudioFormat wav;
+        std::unique_ptr<juce::AudioFormatWriter> writer(wav.createWriterFor(stream.get(), options.sampleRate,
+                                                                            (unsigned int)numChannels,
+                                                                            options.bitDepth, {}, 0));
+        if (writer == nullptr)
+            return "Couldn't create a WAV writer";
+
+        stream.release();
+
+        const auto blockSize = options.blockSize;
+        const auto totalSamples = (juce::int64)std::ceil((sequence.getEndTime() + options.tailSeconds) * options.sampleRate);
+
+        prepare(numChannels);
+
+        juce::AudioBuffer<float> buffer(numChannels, blockSize);
+        juce::MidiBuffer midi;
+        int nextEvent = 0;
+        juce::int64 renderTicks = 0;
+
+        for (juce::int64 blockStart = 0; blockStart < totalSamples; blockStart += blockSize)
+        {
+            auto numSamples = (int)juce::jmin((juce::int64)blockSize, totalSamples - blockStart);
+
+            midi.clear();
+
+            for (; nextEvent < sequence.getNumEvents(); ++nextEvent)
+            {
+                auto& message = sequence.getEventPointer(nextEvent)->message;
+                auto samplePosition = (juce::int64)(message.getTimeStamp() * options.sampleRate);
+
+                if (samplePosition >= blockStart + numSamples)
+                    break;
+
+                midi.addEvent(message, (int)juce::jmax((juce::int64)0, samplePosition - blockStart));
+            }
+
+            // only the synth is timed, not the file writing
+            auto start = juce::Time::getHighResolutionTicks();
+            renderBlock(buffer, midi, numSamples);
+            renderTicks += juce::Time::getHighResolutionTicks() - start;
+
+            if (! writer->writeFromAudioSampleBuffer(buffer, 0, numSamples))
+                return "Couldn't write to " + options.wavFile.getFullPathName();
+        }
+
+        synth.release();
+
+        auto audioSeconds = (double)totalSamples / options.sampleRate;
+        auto renderSeconds = juce::Time::highResolutionTicksToSeconds(renderTicks);
+
+        std::cout << "{\"render\": \"" << options.midiFile.getFileName()
+                  << "\", \"audio_seconds\": " << audioSeconds
+                  << ", \"render_seconds\": " << renderSeconds
+                  << ", \"realtime_factor\": " << (renderSeconds > 0.0 ? audioSeconds / renderSeconds : 0.0)
+                  << ", \"block_size\": " << blockSize
+                  << ", \"voices\": " << options.numVoices
+                  << ", \"workers\": " << options.numWorkers << "}" << std::endl;
+
+        return {};
+    }
+
+private:
+    //==============================================================================
+    /** Merges every track into one sequence, timed in seconds. */
+    juce::String readMidiFile(juce::MidiMessageSequence& sequence) const
+    {
+        juce::FileInputStream input(options.midiFile);
+
+        if (! input.openedOk())
+            return "Couldn't open " + options.midiFile.getFullPathName();
+
+        juce::MidiFile midiFile;
+
+        if (! midiFile.readFrom(input))
+            return options.midiFile.getFullPathName() + " isn't a Standard MIDI File";
+
+        midiFile.convertTimestampTicksToSeconds();
+
+        for (int track = 0; track < midiFile.getNumTracks(); ++track)
+            sequence.addSequence(*midiFile.getTrack(track), 0.0);
+
+        sequence.updateMatchedPairs();
+        return {};
+    }
+
+    void prepare(int numChannels)
+    {
+        parameterSmoother.prepare(options.sampleRate, parameters);
+        controlState.prepare(options.sampleRate, options.blockSize);
+        subBlockRenderer.prepare(parameters);
+        synth.prepare(options.sampleRate, numChannels, options.blockSize);
+        synth.setParallelRenderingEnabled(options.numWorkers > 0, options.numWorkers);
+    }
+
+    /** The same steps the audio callback in MainComponent takes. */
+    void renderBlock(juce::AudioBuffer<float>& buffer, const juce::MidiBuffer& midi, int numSamples)
+    {
+        AllocationTrap::ScopedRealtimeSection realtimeSection;
+        juce::ScopedNoDenormals noDenormals;
+
+        buffer.clear();
+        subBlockRenderer.render(synth, buffer, midi, numSamples);
+    }
+
+    //==============================================================================
+    Options options;
+    SynthParameters parameters;
+    SynthParameterSmoother parameterSmoother;
+    SharedControlState controlState;
+    SubBlockRenderer subBlockRenderer { parameterSmoother, controlState };
+    PolySynthesiser synth;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(OfflineRenderer)
+};
@@ -0,0 +1,325 @@
+/*
+  ==============================================================================
+
+    Parameters.h
+    The user-facing synth parameters, and how they get from the GUI to the audio
+    thread without locks.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "Filter.h"
+#include "Modulation.h"
+#include "Effects.h"
+
+
+//==============================================================================
+/** One consistent set of every parameter the user can change. */
+struct SynthParameters
+{
+    juce::ADSR::Parameters adsr;
+    float filterCutoff = 20000.0f;
+    float filterResonance = (float)FilterCoefficients::butterworthQ;
+    FilterMode filterMode = FilterMode::lowPass;
+    float morph = 0.0f;                     // position through the wavetable's frames, 0 to 1
+    float timbreToCutoff = 0.0f;
+    float timbreToMorph = 0.0f;
+    float tailThresholdDecibels = -90.0f;   // a released voice stops once it's quieter than this
+    int unisonVoices = 1;                   // detuned copies of the oscillator per note, 1 to 16
+    float unisonDetune = 0.15f;             // how far the outer copies are from the note, in semitones
+    float unisonSpread = 0.7f;              // how far across the stereo field the copies go, 0 to 1
+    ModulationParameters modulation;
+    EffectsParameters effects;
+};
+
+//==============================================================================
+/** Saves SynthParameters as XML for a host's session, with every value under its own
+    name.
+
+    A session outlives changes to SynthParameters: a value it doesn't have keeps its
+    default, and one this build doesn't know is ignored. Enumerations are checked, so a
+    damaged session can't load an out-of-range one. If a value's meaning ever changes,
+    bump currentVersion and convert older sessions in restore(). A session saved by a
+    newer version than this build knows isn't loaded at all.
+*/
+struct SynthParameterState
+{
+    static constexpr int currentVersion = 1;
+    static constexpr const char* tagName = "MidiPolySynthState";
+
+    static std::unique_ptr<juce::XmlElement> save(const SynthParameters& parameters)
+    {
+        std::unique_ptr<juce::XmlElement> xml(new juce::XmlElement(tagName));
+        xml->setAttribute("version", currentVersion);
+
+        Writer writer { *xml };
+        forEachValue(parameters, writer);
+        return xml;
+    }
+
+    /** Returns false, leaving parameters as they were, if xml isn't a session this build
+        can read.
+    */
+    static bool restore(const juce::XmlElement& xml, SynthParameters& parameters)
+    {
+        if (! xml.hasTagName(tagName))
+            return false;
+
+        auto version = xml.getIntAttribute("version", 0);
+
+        if (version < 1 || version > currentVersion)
+            return false;
+
+        Reader reader { xml };
+        forEachValue(parameters, reader);
+        return true;
+    }
+
+private:
+    //==============================================================================
+    /** Calls visit(name, value) for every value, and visit(name, value, lastValue) for
+        each enumeration. Each name is saved in sessions, so it can never change.
+    */
+    template <typename Parameters, typename Visitor>
+    static void forEachValue(Parameters& p, Visitor& visit)
+    {
+        visit("attack", p.adsr.attack);
+        visit("decay", p.adsr.decay);
+        visit("sustain", p.adsr.sustain);
+        visit("release", p.adsr.release);
+        visit("filterCutoff", p.filterCutoff);
+        visit("filterResonance", p.filterResonance);
+        visit("filterMode", p.filterMode, FilterMode::highPass);
+        visit("morph", p.morph);
+        visit("timbreToCutoff", p.timbreToCutoff);
+        visit("timbreToMorph", p.timbreToMorph);
+        visit("tailThresholdDecibels", p.tailThresholdDecibels);
+        visit("unisonVoices", p.unisonVoices);
+        visit("unisonDetune", p.unisonDetune);
+        visit("unisonSpread", p.unisonSpread);
+
+        for (int i = 0; i < ModulationParameters::numLFOs; ++i)
+        {
+            auto prefix = "lfo" + juce::String(i + 1);
+            visit(prefix + "Rate", p.modulation.lfos[i].rate);
+            visit(prefix + "Shape", p.modulation.lfos[i].shape, LFOShape::square);
+        }
+
+        visit("envelope2Attack", p.modulation.envelope2.attack);
+        visit("envelope2Decay", p.modulation.envelope2.decay);
+        visit("envelope2Sustain", p.modulation.envelope2.sustain);
+        visit("envelope2Release", p.modulation.envelope2.release);
+
+        for (int i = 0; i < ModulationParameters::maxRoutes; ++i)
+        {
+            auto prefix = "route" + juce::String(i + 1);
+            visit(prefix + "Source", p.modulation.routes[i].source, ModulationSource::pitchBend);
+            visit(prefix + "Destination", p.modulation.routes[i].destination, ModulationDestination::amplitude);
+            visit(prefix + "Amount", p.modulation.routes[i].amount);
+        }
+
+        visit("chorusRate", p.effects.chorusRate);
+        visit("chorusDepth", p.effects.chorusDepth);
+        visit("chorusMix", p.effects.chorusMix);
+        visit("delayTime", p.effects.delayTime);
+        visit("delayFeedback", p.effects.delayFeedback);
+        visit("delayMix", p.effects.delayMix);
+        visit("reverbSize", p.effects.reverbSize);
+        visit("reverbDamping", p.effects.reverbDamping);
+        visit("reverbMix", p.effects.reverbMix);
+    }
+
+    struct Writer
+    {
+        void operator()(const juce::String& name, float value)      { xml.setAttribute(name, (double)value); }
+        void operator()(const juce::String& name, int value)        { xml.setAttribute(name, value); }
+
+        template <typename Enum>
+        void operator()(const juce::String& name, Enum value, Enum) { xml.setAttribute(name, (int)value); }
+
+        juce::XmlElement& xml;
+    };
+
+    struct Reader
+    {
+        void operator()(const juce::String& name, float& value)
+        {
+            auto loaded = xml.getDoubleAttribute(name, (double)value);
+
+            if (std::isfinite(loaded))
+                value = (float)loaded;
+        }
+
+        void operator()(const juce::String& name, int& value)
+        {
+            value = xml.getIntAttribute(name, value);
+        }
+
+        template <typename Enum>
+        void operator()(const juce::String& name, Enum& value, Enum lastValue)
+        {
+            auto loaded = xml.getIntAttribute(name, (int)value);
+
+            if (loaded >= 0 && loaded <= (int)lastValue)
+                value = (Enum)loaded;
+        }
+
+        const juce::XmlElement& xml;
+    };
+};
+
+//==============================================================================
+/** Hands complete SynthParameters snapshots from the message thread to the audio
+    thread through a triple buffer.
+
+    The writer always has a slot of its own to fill, and the reader always has one
+    to read. Publishing and picking up a snapshot each swap one slot index with an
+    atomic exchange. Neither side waits for the other, and nothing allocates. The
+    reader never sees a half-written set, and it skips straight to the newest one
+    if several were published in the meantime.
+
+    Each snapshot is stamped with when it was published, so the reader can place the
+    change at the right sample of its block, like a MIDI event.
+
+    There is one reader, the audio thread. Any other thread can write: writers take
+    turns through a lock, which the audio thread never touches.
+*/
+class SynthParameterStore
+{
+public:
+    //==============================================================================
+    SynthParameterStore() = default;
+
+    /** The values as last edited. Message thread only, and only while nothing else
+        writes; the GUI uses it to set up its controls.
+    */
+    const SynthParameters& getParameters() const noexcept    { return edited; }
+
+    /** A copy of the values as last edited. Any thread but the audio thread. */
+    SynthParameters getSnapshot() const
+    {
+        const juce::ScopedLock sl(writerLock);
+        return edited;
+    }
+
+    /** Applies a change to the parameters and publishes the result. Any thread but the
+        audio thread.
+    */
+    template <typename Change>
+    void update(Change&& change)
+    {
+        const juce::ScopedLock sl(writerLock);
+
+        change(edited);
+        slots[backIndex] = edited;
+        publishTimes[backIndex] = juce::Time::getMillisecondCounterHiRes() * 0.001;
+
+        auto previous = middleIndex.exchange(backIndex | newDataFlag, std::memory_order_acq_rel);
+        backIndex = previous & indexMask;
+    }
+
+    //==============================================================================
+    /** Returns the newest published snapshot. Audio thread only; call it once per block
+        and use the result for the whole block.
+    */
+    const SynthParameters& acquire() noexcept
+    {
+        if ((middleIndex.load(std::memory_order_relaxed) & newDataFlag) != 0)
+        {
+            auto previous = middleIndex.exchange(frontIndex, std::memory_order_acq_rel);
+            frontIndex = previous & indexMask;
+        }
+
+        return slots[frontIndex];
+    }
+
+    /** Like acquire(), but returns nullptr unless something was published since the last
+        call. Otherwise timeInSeconds is set to when it was published, on the
+        Time::getMillisecondCounterHiRes() clock that MidiEventQueue uses. Audio thread only.
+    */
+    const SynthParameters* acquireChange(double& timeInSeconds) noexcept
+    {
+        if ((middleIndex.load(std::memory_order_relaxed) & newDataFlag) == 0)
+            return nullptr;
+
+        auto& parameters = acquire();
+        timeInSeconds = publishTimes[frontIndex];
+        return &parameters;
+    }
+
+private:
+    //==============================================================================
+    static constexpr int indexMask = 3, newDataFlag = 4;
+
+    SynthParameters slots[3], edited;
+    double publishTimes[3] = {};
+    juce::CriticalSection writerLock;
+    int backIndex = 0, frontIndex = 1;
+    std::atomic<int> middleIndex { 2 };
+
+    JUCE_DECLARE_NON_COPYABLE(SynthParameterStore)
+};
+
+//==============================================================================
+/** Glides the continuous parameters towards each new snapshot on the audio thread.
+
+    Smoothing is advanced a whole block at a time; whoever consumes the values ramps
+    them across the block (see SharedControlState). The cutoff is smoothed
+    multiplicatively, so a sweep sounds even across the octaves.
+*/
+class SynthParameterSmoother
+{
+public:
+    void prepare(double sampleRate, const SynthParameters& initialValues)
+    {
+        current = initialValues;
+
+        cutoff.reset(sampleRate, smoothingTimeInSeconds);
+        resonance.reset(sampleRate, smoothingTimeInSeconds);
+        morph.reset(sampleRate, smoothingTimeInSeconds);
+        timbreToCutoff.reset(sampleRate, smoothingTimeInSeconds);
+        timbreToMorph.reset(sampleRate, smoothingTimeInSeconds);
+
+        cutoff.setCurrentAndTargetValue(initialValues.filterCutoff);
+        resonance.setCurrentAndTargetValue(initialValues.filterResonance);
+        morph.setCurrentAndTargetValue(initialValues.morph);
+        timbreToCutoff.setCurrentAndTargetValue(initialValues.timbreToCutoff);
+        timbreToMorph.setCurrentAndTargetValue(initialValues.timbreToMorph);
+    }
+
+    /** Returns the values to use at the end of a block of numSamples. */
+    const SynthParameters& process(const SynthParameters& target, int numSamples) noexcept
+    {
+        cutoff.setTargetValue(juce::jmax(1.0f, target.filterCutoff));
+        resonance.setTargetValue(target.filterResonance);
+        morph.setTargetValue(target.morph);
+        timbreToCutoff.setTargetValue(target.timbreToCutoff);
+        timbreToMorph.setTargetValue(target.timbreToMorph);
+
+        current.adsr = target.adsr;
+        current.filterMode = target.filterMode;
+        current.tailThresholdDecibels = target.tailThresholdDecibels;
+        current.modulation = target.modulation;
+        current.effects = target.effects;
+        current.unisonVoices = target.unisonVoices;
+        current.unisonDetune = target.unisonDetune;
+        current.unisonSpread = target.unisonSpread;
+        current.filterCutoff = cutoff.skip(numSamples);
+        current.filterResonance = resonance.skip(numSamples);
+        current.morph = morph.skip(numSamples);
+        current.timbreToCutoff = timbreToCutoff.skip(numSamples);
+        current.timbreToMorph = timbreToMorph.skip(numSamples);
+
+        return current;
+    }
+
+private:
+    static constexpr double smoothingTimeInSeconds = 0.05;
+
+    SynthParameters current;
+    juce::SmoothedValue<float, juce::ValueSmoothingTypes::Multiplicative> cutoff { 20000.0f };
+    juce::SmoothedValue<float> resonance, morph, timbreToCutoff, timbreToMorph;
+};
@@ -0,0 +1,18 @@
+/*
+  ==============================================================================
+
+    PluginMain.cpp
+    The entry point for the plugin builds (VST3, LV2 and the rest), in place
+    of Main.cpp. The plugin has no editor, so it runs headless in any host.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "SynthProcessor.h"
+
+//==============================================================================
+juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
+{
+    return new SynthAudioProcessor();
+}
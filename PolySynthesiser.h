@@ -0,0 +1,287 @@
+/*
+  ==============================================================================
+
+    PolySynthesiser.h
+    The MPESynthesiser the app plays through, with constant-time voice
+    allocation and optional parallel voice rendering.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "Synth.h"
+#include "RenderWorkerPool.h"
+#include "VoicePool.h"
+
+
+//==============================================================================
+/** The MPESynthesiser the app plays through.
+
+    Voices are handed out by a VoicePool rather than by searching, with a polyphony
+    and stealing policy that can change while it plays. Add a few more voices than
+    the largest polyphony you'll use, so stolen voices can fade out on a spare.
+*/
+class PolySynthesiser : public juce::MPESynthesiser
+{
+public:
+    //==============================================================================
+    PolySynthesiser() = default;
+
+    ~PolySynthesiser() override
+    {
+        setParallelRenderingEnabled(false);
+    }
+
+    /** Passes the sample rate on to every voice and tells the synth the largest block
+        it will be asked for, so the worker pool can size its partial mixes. Call this
+        before the audio starts, and again whenever the device changes; anything still
+        sounding is cut off.
+    */
+    void prepare(double sampleRate, int numChannels, int maximumBlockSize)
+    {
+        setCurrentPlaybackSampleRate(sampleRate);
+
+        const juce::ScopedLock sl(poolLock);
+
+        preparedNumChannels = numChannels;
+        preparedBlockSize = maximumBlockSize;
+
+        if (parallelRenderingEnabled.load())
+            restartWorkers();
+    }
+
+    /** Silences every voice and stops the worker threads until the next prepare().
+        Parallel rendering stays switched on if it was. Call this once the audio has
+        stopped.
+    */
+    void release()
+    {
+        const juce::ScopedLock sl(poolLock);
+
+        auto wasEnabled = parallelRenderingEnabled.load();
+        parallelRenderingEnabled.store(false);
+
+        while (poolInUse.load())
+            std::this_thread::yield();
+
+        workerPool.stop();
+        preparedBlockSize = 0;
+        parallelRenderingEnabled.store(wasEnabled);
+
+        turnOffAllVoices(false);
+    }
+
+    /** Switches parallel rendering on or off. Call this from the message thread; it
+        waits for the audio thread to finish with the pool before stopping it.
+    */
+    void setParallelRenderingEnabled(bool shouldBeEnabled, int numWorkers = RenderWorkerPool::getDefaultNumWorkers())
+    {
+        const juce::ScopedLock sl(poolLock);
+
+        numWorkersWanted = numWorkers;
+        parallelRenderingEnabled.store(false);
+
+        while (poolInUse.load())
+            std::this_thread::yield();
+
+        if (shouldBeEnabled)
+        {
+            if (preparedBlockSize > 0)
+                restartWorkers();
+
+            parallelRenderingEnabled.store(true);
+        }
+        else
+        {
+            workerPool.stop();
+        }
+    }
+
+    bool isParallelRenderingEnabled() const noexcept    { return parallelRenderingEnabled.load(); }
+
+    //==============================================================================
+    /** Adds a voice, which the synth then owns. This hides MPESynthesiser::addVoice(),
+        as every voice has to be a PooledVoice.
+    */
+    void addVoice(PooledVoice* newVoice)
+    {
+        const juce::ScopedLock sl(voicesLock);
+
+        MPESynthesiser::addVoice(newVoice);
+        voicePool.addVoice(newVoice);
+
+        if (getSampleRate() > 0.0)
+            newVoice->setCurrentSampleRate(getSampleRate());
+    }
+
+    void clearVoices()
+    {
+        const juce::ScopedLock sl(voicesLock);
+
+        voicePool.clear();
+        MPESynthesiser::clearVoices();
+    }
+
+    /** Sets how many notes can sound at once, up to the number of voices. Safe to call
+        while playing; any excess voices are faded out on the next block.
+    */
+    void setPolyphony(int numVoices) noexcept                       { voicePool.setPolyphony(numVoices); }
+    int getPolyphony() const noexcept                               { return voicePool.getPolyphony(); }
+
+    VoiceCounts getVoiceCounts() const noexcept                     { return voicePool.getVoiceCounts(); }
+
+    void setVoiceStealingPolicy(VoiceStealingPolicy policy) noexcept { voicePool.setStealingPolicy(policy); }
+    VoiceStealingPolicy getVoiceStealingPolicy() const noexcept     { return voicePool.getStealingPolicy(); }
+
+    void turnOffAllVoices(bool allowTailOff) override
+    {
+        MPESynthesiser::turnOffAllVoices(allowTailOff);
+
+        const juce::ScopedLock sl(voicesLock);
+        voicePool.reclaimFinishedVoices();
+    }
+
+protected:
+    //==============================================================================
+    void noteAdded(juce::MPENote newNote) override
+    {
+        const juce::ScopedLock sl(voicesLock);
+
+        // the same key again on the same channel: let the old note go first
+        if (auto* previous = voicePool.findVoice(newNote))
+            releaseVoice(previous, previous->getCurrentlyPlayingNote());
+
+        auto* voice = voicePool.findFreeVoice();
+
+        if (voice == nullptr && isVoiceStealingEnabled())
+        {
+            if (auto* voiceToSteal = voicePool.findVoiceToSteal(newNote))
+            {
+                voice = voicePool.findSpareVoice();
+
+                if (voice != nullptr)
+                    voicePool.fastRelease(voiceToSteal);
+                else
+                    voice = voiceToSteal;   // nothing spare, so restart it, as MPESynthesiser would
+            }
+        }
+
+        if (voice != nullptr)
+        {
+            startVoice(voice, newNote);
+            voicePool.voiceStarted(voice, newNote);
+        }
+    }
+
+    void noteReleased(juce::MPENote finishedNote) override
+    {
+        const juce::ScopedLock sl(voicesLock);
+
+        if (auto* voice = voicePool.findVoice(finishedNote))
+            releaseVoice(voice, finishedNote);
+    }
+
+    void notePressureChanged(juce::MPENote changedNote) override
+    {
+        const juce::ScopedLock sl(voicesLock);
+
+        if (auto* voice = voicePool.findVoice(changedNote))
+        {
+            voice->setCurrentlyPlayingNote(changedNote);
+            voice->notePressureChanged();
+        }
+    }
+
+    void notePitchbendChanged(juce::MPENote changedNote) override
+    {
+        const juce::ScopedLock sl(voicesLock);
+
+        if (auto* voice = voicePool.findVoice(changedNote))
+        {
+            voice->setCurrentlyPlayingNote(changedNote);
+            voice->notePitchbendChanged();
+        }
+    }
+
+    void noteTimbreChanged(juce::MPENote changedNote) override
+    {
+        const juce::ScopedLock sl(voicesLock);
+
+        if (auto* voice = voicePool.findVoice(changedNote))
+        {
+            voice->setCurrentlyPlayingNote(changedNote);
+            voice->noteTimbreChanged();
+        }
+    }
+
+    void noteKeyStateChanged(juce::MPENote changedNote) override
+    {
+        const juce::ScopedLock sl(voicesLock);
+
+        if (auto* voice = voicePool.findVoice(changedNote))
+        {
+            voice->setCurrentlyPlayingNote(changedNote);
+            voice->noteKeyStateChanged();
+        }
+    }
+
+    //==============================================================================
+    void renderNextSubBlock(juce::AudioBuffer<float>& outputAudio, int startSample, int numSamples) override
+    {
+        const juce::ScopedLock sl(voicesLock);
+
+        voicePool.enforcePolyphony();
+        auto& voicesToRender = voicePool.getVoicesToRender();
+
+        // set before checking the flag, so setParallelRenderingEnabled() can't stop the
+        // pool between the check and the render
+        poolInUse.store(true);
+
+        if (parallelRenderingEnabled.load()
+             && workerPool.getNumWorkers() > 0
+             && startSample + numSamples <= preparedBlockSize)
+        {
+            workerPool.renderVoices(voicesToRender.begin(), voicesToRender.size(), outputAudio, startSample, numSamples);
+        }
+        else
+        {
+            for (auto* voice : voicesToRender)
+                voice->renderNextBlock(outputAudio, startSample, numSamples);
+        }
+
+        poolInUse.store(false);
+
+        voicePool.reclaimFinishedVoices();
+    }
+
+private:
+    //==============================================================================
+    void releaseVoice(PooledVoice* voice, juce::MPENote note)
+    {
+        note.keyState = juce::MPENote::off;
+        stopVoice(voice, note, true);
+        voicePool.voiceReleased(voice);
+    }
+
+    void restartWorkers()
+    {
+        parallelRenderingEnabled.store(false);
+
+        while (poolInUse.load())
+            std::this_thread::yield();
+
+        workerPool.start(numWorkersWanted, preparedNumChannels, preparedBlockSize, getSampleRate());
+        parallelRenderingEnabled.store(true);
+    }
+
+    //==============================================================================
+    VoicePool voicePool;
+    RenderWorkerPool workerPool;
+    juce::CriticalSection poolLock;
+
+    std::atomic<bool> parallelRenderingEnabled { false }, poolInUse { false };
+    int numWorkersWanted = 0, preparedNumChannels = 0, preparedBlockSize = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PolySynthesiser)
+};
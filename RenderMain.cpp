@@ -0,0 +1,28 @@
+/*
+  ==============================================================================
+
+    RenderMain.cpp
+    The entry point for the headless renderer, a console build with no GUI
+    modules: MidiPolySynthRender <in.mid> <out.wav> [options], with the same
+    options as the app's --render.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+
+#define MIDIPOLYSYNTH_DEFINE_ALLOCATION_HOOKS 1
+#include "AllocationTrap.h"
+
+#include "OfflineRenderer.h"
+
+//==============================================================================
+int main(int argc, char* argv[])
+{
+    juce::StringArray args(argv + 1, argc - 1);
+
+    if (! args.contains("--render"))
+        args.insert(0, "--render");
+
+    return OfflineRenderer::run(args);
+}
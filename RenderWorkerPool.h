@@ -0,0 +1,333 @@
+/*
+  ==============================================================================
+
+    RenderWorkerPool.h
+    A fixed set of real-time worker threads that render voices alongside the
+    audio thread, each into its own partial mix.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "AllocationTrap.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_IX86)
+ #include <emmintrin.h>
+#endif
+
+
+//==============================================================================
+/** Lets a real-time thread wait for work without holding on to a core.
+
+    The thread spins for a while first, which catches work that follows closely on
+    the last. Give it the block period with setBlockPeriod(), and it spins for two
+    of them, so a thread fed once per callback is still spinning when the next one
+    comes. After that it parks on a WaitableEvent: under SCHED_FIFO, yielding only
+    hands the core to threads of the same priority, so a real-time thread that never
+    blocks can starve everything below it while the synth is silent.
+
+    Whoever hands out the work calls wake() once it's published. That only touches
+    the event while the thread is parked, which only happens after more than a block
+    period without work, so while audio is flowing it costs one atomic load.
+*/
+class IdleWaiter
+{
+public:
+    /** Sets how long to spin from the period of the blocks the work comes with. Call
+        this before the waiting thread starts.
+    */
+    void setBlockPeriod(double sampleRate, int blockSize) noexcept
+    {
+        if (sampleRate > 0.0)
+            spinMilliseconds = juce::jmax(minimumSpinMilliseconds, 2.0 * 1000.0 * blockSize / sampleRate);
+    }
+
+    /** Waits on the calling thread until isReady() returns true. Returns false instead
+        if the thread is asked to exit first.
+    */
+    template <typename IsReady>
+    bool waitUntil(const juce::Thread& thread, IsReady&& isReady)
+    {
+        auto spinUntil = juce::Time::getMillisecondCounterHiRes() + spinMilliseconds;
+
+        for (int spins = 1; ! isReady(); ++spins)
+        {
+            if (thread.threadShouldExit())
+                return false;
+
+            // the clock is only read every so often, as it costs more than a pause
+            if ((spins & 255) != 0 || juce::Time::getMillisecondCounterHiRes() < spinUntil)
+            {
+                pause();
+                continue;
+            }
+
+            parked.store(true);
+
+            // checked again after saying so, so a wake() in between can't be missed
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            if (! isReady())
+                wakeUpEvent.wait(parkTimeoutMilliseconds);
+
+            parked.store(false);
+        }
+
+        return true;
+    }
+
+    /** Wakes the thread if it's parked. Call this after publishing the work. */
+    void wake() noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (parked.load())
+            wakeUpEvent.signal();
+    }
+
+    /** Wakes the thread whatever it's doing, after it's been told to exit. */
+    void interrupt() noexcept
+    {
+        wakeUpEvent.signal();
+    }
+
+    static void pause() noexcept
+    {
+       #if defined(__SSE2__) || defined(_M_X64) || defined(_M_IX86)
+        _mm_pause();
+       #endif
+    }
+
+private:
+    static constexpr double minimumSpinMilliseconds = 1.0;
+    static constexpr int parkTimeoutMilliseconds = 100;
+
+    double spinMilliseconds = minimumSpinMilliseconds;
+    std::atomic<bool> parked { false };
+    juce::WaitableEvent wakeUpEvent;
+};
+
+//==============================================================================
+/** Splits the active voices of one sub-block between the audio thread and a pool
+    of workers, without any locks.
+
+    The audio thread publishes a job as one atomic word holding its generation, its
+    number of voices and the next voice to claim. Everyone then claims voices one at a
+    time by bumping that word, so a worker that gets cheap voices simply takes more of
+    them, and a worker that turns up late finds nothing left and stays out of it. The
+    audio thread renders its share straight into the output; each worker renders into
+    its own preallocated partial mix. The audio thread only waits for the voices that
+    were claimed to be finished, never for a worker that claimed nothing, and then adds
+    in the partial mixes of the workers that took part.
+
+    Between sub-blocks the workers spin, so they pick up the next job within
+    microseconds. They keep spinning for two block periods, so they're still there
+    for the next callback; only once nothing has arrived for longer than that do they
+    park in an IdleWaiter, and the audio thread wakes them with the next job. The
+    threads only run while parallel rendering is switched on.
+*/
+class RenderWorkerPool
+{
+public:
+    //==============================================================================
+    RenderWorkerPool() = default;
+
+    ~RenderWorkerPool()
+    {
+        stop();
+    }
+
+    static int getDefaultNumWorkers()
+    {
+        return juce::jlimit(0, maxWorkers, juce::SystemStats::getNumCpus() - 1);
+    }
+
+    //==============================================================================
+    /** Allocates the partial mixes and starts the workers. Call this from the message
+        thread, while the audio thread isn't using the pool.
+    */
+    void start(int numWorkersToUse, int numChannels, int maximumBlockSize, double sampleRate)
+    {
+        stop();
+
+        numWorkersToUse = juce::jlimit(0, maxWorkers, numWorkersToUse);
+
+        for (int i = 0; i < numWorkersToUse; ++i)
+        {
+            auto* worker = workers.add(new Worker(*this, i));
+            worker->partialMix.setSize(numChannels, maximumBlockSize);
+            worker->idleWaiter.setBlockPeriod(sampleRate, maximumBlockSize);
+
+            // taken here rather than in run(), so a job published before the thread
+            // gets going isn't missed
+            worker->lastGeneration = getGeneration(currentJob.load(std::memory_order_acquire));
+            worker->startThread(juce::Thread::realtimeAudioPriority);
+        }
+    }
+
+    void stop()
+    {
+        for (auto* worker : workers)
+        {
+            worker->signalThreadShouldExit();
+            worker->idleWaiter.interrupt();
+        }
+
+        for (auto* worker : workers)
+            worker->stopThread(1000);
+
+        workers.clear();
+    }
+
+    int getNumWorkers() const noexcept    { return workers.size(); }
+
+    //==============================================================================
+    /** Renders every active voice into output and returns once they're all done.
+        Called on the audio thread; the caller takes a share of the voices itself.
+    */
+    void renderVoices(juce::MPESynthesiserVoice* const* voicesToRender, int numVoicesToRender,
+                      juce::AudioBuffer<float>& output, int startSample, int numSamples) noexcept
+    {
+        jassert(numVoicesToRender <= maxVoicesPerJob);
+        numVoicesToRender = juce::jmin(numVoicesToRender, maxVoicesPerJob);
+
+        voices = voicesToRender;
+        jobStartSample = startSample;
+        jobNumSamples = numSamples;
+        numVoicesFinished.store(0, std::memory_order_relaxed);
+
+        // publishes the job fields above to the workers
+        auto generation = ++jobGeneration;
+        currentJob.store(makeJob(generation, numVoicesToRender), std::memory_order_release);
+
+        for (auto* worker : workers)
+            worker->idleWaiter.wake();
+
+        renderClaimedVoices(output, nullptr);
+
+        // every voice has been claimed by now, so this only waits for the ones still
+        // being rendered, not for workers that haven't got round to looking
+        for (int spins = 0; numVoicesFinished.load(std::memory_order_acquire) < numVoicesToRender; ++spins)
+            pause(spins);
+
+        for (auto* worker : workers)
+            if (worker->renderedGeneration == generation)
+                for (auto channel = output.getNumChannels(); --channel >= 0;)
+                    output.addFrom(channel, startSample, worker->partialMix, channel, startSample, numSamples);
+    }
+
+    static constexpr int maxWorkers = 32;
+
+    /** Spins for a while, then yields the time slice. Only for the audio thread's short
+        wait for claimed voices to finish; idle threads wait in an IdleWaiter.
+    */
+    static void pause(int spins) noexcept
+    {
+        if (spins < 2000)
+            IdleWaiter::pause();
+        else
+            std::this_thread::yield();
+    }
+
+private:
+    //==============================================================================
+    struct Worker : public juce::Thread
+    {
+        Worker(RenderWorkerPool& p, int index)
+            : juce::Thread("Voice render worker " + juce::String(index)), pool(p)
+        {}
+
+        void run() override
+        {
+            while (! threadShouldExit())
+            {
+                auto hasNewJob = [this]
+                {
+                    return getGeneration(pool.currentJob.load(std::memory_order_acquire)) != lastGeneration;
+                };
+
+                if (! idleWaiter.waitUntil(*this, hasNewJob))
+                    return;
+
+                AllocationTrap::ScopedRealtimeSection realtimeSection;
+                lastGeneration = pool.renderClaimedVoices(partialMix, this);
+            }
+        }
+
+        RenderWorkerPool& pool;
+        IdleWaiter idleWaiter;
+        juce::AudioBuffer<float> partialMix;
+        juce::uint32 lastGeneration = 0;
+
+        // the last job this worker rendered a voice of, read by the audio thread once
+        // every voice of that job is finished
+        juce::uint32 renderedGeneration = 0;
+    };
+
+    //==============================================================================
+    // a job is packed as generation << 32 | numVoices << 16 | next voice to claim
+    static constexpr int maxVoicesPerJob = 0xffff;
+
+    static juce::uint64 makeJob(juce::uint32 generation, int numVoicesInJob) noexcept
+    {
+        return ((juce::uint64)generation << 32) | ((juce::uint64)numVoicesInJob << 16);
+    }
+
+    static juce::uint32 getGeneration(juce::uint64 job) noexcept    { return (juce::uint32)(job >> 32); }
+    static int getNumVoices(juce::uint64 job) noexcept              { return (int)((job >> 16) & 0xffff); }
+    static int getNextVoice(juce::uint64 job) noexcept              { return (int)(job & 0xffff); }
+
+    /** Claims voices from the current job until there are none left, renders each one
+        into destination, and returns the job's generation. A worker clears its part of
+        destination before its first voice; the audio thread passes no worker and adds
+        straight into the output.
+    */
+    juce::uint32 renderClaimedVoices(juce::AudioBuffer<float>& destination, Worker* worker) noexcept
+    {
+        auto job = currentJob.load(std::memory_order_acquire);
+
+        for (;;)
+        {
+            auto index = getNextVoice(job);
+
+            if (index >= getNumVoices(job))
+                return getGeneration(job);
+
+            // fails if another thread claimed this voice first, reloading job
+            if (! currentJob.compare_exchange_weak(job, job + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+                continue;
+
+            // the job can't be replaced until this voice is finished, so its fields are
+            // safe to read from here on
+            auto* voice = voices[index];
+
+            if (voice->isActive())
+            {
+                if (worker != nullptr && worker->renderedGeneration != getGeneration(job))
+                {
+                    destination.clear(jobStartSample, jobNumSamples);
+                    worker->renderedGeneration = getGeneration(job);
+                }
+
+                voice->renderNextBlock(destination, jobStartSample, jobNumSamples);
+            }
+
+            numVoicesFinished.fetch_add(1, std::memory_order_release);
+            ++job;
+        }
+    }
+
+    //==============================================================================
+    juce::OwnedArray<Worker> workers;
+
+    std::atomic<juce::uint64> currentJob { 0 };
+    std::atomic<int> numVoicesFinished { 0 };
+    juce::uint32 jobGeneration = 0;
+
+    juce::MPESynthesiserVoice* const* voices = nullptr;
+    int jobStartSample = 0, jobNumSamples = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(RenderWorkerPool)
+};
@@ -0,0 +1,190 @@
+/*
+  ==============================================================================
+
+    SIMD.h
+    Thin wrappers around the native float and uint32 vector registers, so the
+    DSP code can be written once for SSE2, AVX2 and NEON.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#if defined(__AVX2__)
+ #include <immintrin.h>
+ #define MIDIPOLYSYNTH_SIMD_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+ #include <emmintrin.h>
+ #define MIDIPOLYSYNTH_SIMD_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+ #include <arm_neon.h>
+ #define MIDIPOLYSYNTH_SIMD_NEON 1
+#endif
+
+
+//==============================================================================
+/** A register of floats, as wide as the target's native vector unit.
+
+    Loads and stores are unaligned unless stated otherwise. If no vector unit
+    is available this falls back to four plain floats, which the compiler is
+    still free to vectorise on its own.
+*/
+struct SIMDFloat
+{
+   #if MIDIPOLYSYNTH_SIMD_AVX2
+    static constexpr int size = 8;
+    __m256 value;
+
+    static forcedinline SIMDFloat expand(float s) noexcept               { return { _mm256_set1_ps(s) }; }
+    static forcedinline SIMDFloat load(const float* src) noexcept        { return { _mm256_loadu_ps(src) }; }
+    forcedinline void store(float* dst) const noexcept                   { _mm256_storeu_ps(dst, value); }
+
+    forcedinline SIMDFloat operator+(SIMDFloat o) const noexcept         { return { _mm256_add_ps(value, o.value) }; }
+    forcedinline SIMDFloat operator-(SIMDFloat o) const noexcept         { return { _mm256_sub_ps(value, o.value) }; }
+    forcedinline SIMDFloat operator*(SIMDFloat o) const noexcept         { return { _mm256_mul_ps(value, o.value) }; }
+    forcedinline SIMDFloat operator/(SIMDFloat o) const noexcept         { return { _mm256_div_ps(value, o.value) }; }
+    static forcedinline SIMDFloat min(SIMDFloat a, SIMDFloat b) noexcept { return { _mm256_min_ps(a.value, b.value) }; }
+    static forcedinline SIMDFloat max(SIMDFloat a, SIMDFloat b) noexcept { return { _mm256_max_ps(a.value, b.value) }; }
+   #elif MIDIPOLYSYNTH_SIMD_SSE2
+    static constexpr int size = 4;
+    __m128 value;
+
+    static forcedinline SIMDFloat expand(float s) noexcept               { return { _mm_set1_ps(s) }; }
+    static forcedinline SIMDFloat load(const float* src) noexcept        { return { _mm_loadu_ps(src) }; }
+    forcedinline void store(float* dst) const noexcept                   { _mm_storeu_ps(dst, value); }
+
+    forcedinline SIMDFloat operator+(SIMDFloat o) const noexcept         { return { _mm_add_ps(value, o.value) }; }
+    forcedinline SIMDFloat operator-(SIMDFloat o) const noexcept         { return { _mm_sub_ps(value, o.value) }; }
+    forcedinline SIMDFloat operator*(SIMDFloat o) const noexcept         { return { _mm_mul_ps(value, o.value) }; }
+    forcedinline SIMDFloat operator/(SIMDFloat o) const noexcept         { return { _mm_div_ps(value, o.value) }; }
+    static forcedinline SIMDFloat min(SIMDFloat a, SIMDFloat b) noexcept { return { _mm_min_ps(a.value, b.value) }; }
+    static forcedinline SIMDFloat max(SIMDFloat a, SIMDFloat b) noexcept { return { _mm_max_ps(a.value, b.value) }; }
+   #elif MIDIPOLYSYNTH_SIMD_NEON
+    static constexpr int size = 4;
+    float32x4_t value;
+
+    static forcedinline SIMDFloat expand(float s) noexcept               { return { vdupq_n_f32(s) }; }
+    static forcedinline SIMDFloat load(const float* src) noexcept        { return { vld1q_f32(src) }; }
+    forcedinline void store(float* dst) const noexcept                   { vst1q_f32(dst, value); }
+
+    forcedinline SIMDFloat operator+(SIMDFloat o) const noexcept         { return { vaddq_f32(value, o.value) }; }
+    forcedinline SIMDFloat operator-(SIMDFloat o) const noexcept         { return { vsubq_f32(value, o.value) }; }
+    forcedinline SIMDFloat operator*(SIMDFloat o) const noexcept         { return { vmulq_f32(value, o.value) }; }
+   #if defined(__aarch64__) || defined(_M_ARM64)
+    forcedinline SIMDFloat operator/(SIMDFloat o) const noexcept         { return { vdivq_f32(value, o.value) }; }
+   #else
+    forcedinline SIMDFloat operator/(SIMDFloat o) const noexcept
+    {
+        // armv7 has no divide: refine the reciprocal estimate twice
+        auto r = vrecpeq_f32(o.value);
+        r = vmulq_f32(vrecpsq_f32(o.value, r), r);
+        r = vmulq_f32(vrecpsq_f32(o.value, r), r);
+        return { vmulq_f32(value, r) };
+    }
+   #endif
+    static forcedinline SIMDFloat min(SIMDFloat a, SIMDFloat b) noexcept { return { vminq_f32(a.value, b.value) }; }
+    static forcedinline SIMDFloat max(SIMDFloat a, SIMDFloat b) noexcept { return { vmaxq_f32(a.value, b.value) }; }
+   #else
+    static constexpr int size = 4;
+    float value[size];
+
+    static forcedinline SIMDFloat expand(float s) noexcept               { return { { s, s, s, s } }; }
+    static forcedinline SIMDFloat load(const float* src) noexcept        { return { { src[0], src[1], src[2], src[3] } }; }
+    forcedinline void store(float* dst) const noexcept                   { for (int i = 0; i < size; ++i) dst[i] = value[i]; }
+
+    forcedinline SIMDFloat operator+(SIMDFloat o) const noexcept         { SIMDFloat r; for (int i = 0; i < size; ++i) r.value[i] = value[i] + o.value[i]; return r; }
+    forcedinline SIMDFloat operator-(SIMDFloat o) const noexcept         { SIMDFloat r; for (int i = 0; i < size; ++i) r.value[i] = value[i] - o.value[i]; return r; }
+    forcedinline SIMDFloat operator*(SIMDFloat o) const noexcept         { SIMDFloat r; for (int i = 0; i < size; ++i) r.value[i] = value[i] * o.value[i]; return r; }
+    forcedinline SIMDFloat operator/(SIMDFloat o) const noexcept         { SIMDFloat r; for (int i = 0; i < size; ++i) r.value[i] = value[i] / o.value[i]; return r; }
+    static forcedinline SIMDFloat min(SIMDFloat a, SIMDFloat b) noexcept { SIMDFloat r; for (int i = 0; i < size; ++i) r.value[i] = juce::jmin(a.value[i], b.value[i]); return r; }
+    static forcedinline SIMDFloat max(SIMDFloat a, SIMDFloat b) noexcept { SIMDFloat r; for (int i = 0; i < size; ++i) r.value[i] = juce::jmax(a.value[i], b.value[i]); return r; }
+   #endif
+
+    /** Adds all the lanes together. */
+    forcedinline float sum() const noexcept
+    {
+        alignas(32) float lanes[size];
+        store(lanes);
+
+        auto total = 0.0f;
+
+        for (int i = 0; i < size; ++i)
+            total += lanes[i];
+
+        return total;
+    }
+};
+
+//==============================================================================
+/** A register of unsigned 32-bit integers with the same lane count as SIMDFloat.
+
+    Only the handful of operations a fixed-point phase accumulator needs are here:
+    wrapping adds, masks, logical shifts and conversion of small values to float.
+*/
+struct SIMDUInt32
+{
+   #if MIDIPOLYSYNTH_SIMD_AVX2
+    __m256i value;
+
+    static forcedinline SIMDUInt32 expand(juce::uint32 s) noexcept           { return { _mm256_set1_epi32((int)s) }; }
+    static forcedinline SIMDUInt32 load(const juce::uint32* src) noexcept    { return { _mm256_loadu_si256((const __m256i*)src) }; }
+    forcedinline void store(juce::uint32* dst) const noexcept                { _mm256_storeu_si256((__m256i*)dst, value); }
+
+    forcedinline SIMDUInt32 operator+(SIMDUInt32 o) const noexcept           { return { _mm256_add_epi32(value, o.value) }; }
+    forcedinline SIMDUInt32 operator&(SIMDUInt32 o) const noexcept           { return { _mm256_and_si256(value, o.value) }; }
+    forcedinline SIMDUInt32 shiftRight(int bits) const noexcept              { return { _mm256_srl_epi32(value, _mm_cvtsi32_si128(bits)) }; }
+
+    /** Only exact for values below 2^31. */
+    forcedinline SIMDFloat toFloat() const noexcept                          { return { _mm256_cvtepi32_ps(value) }; }
+   #elif MIDIPOLYSYNTH_SIMD_SSE2
+    __m128i value;
+
+    static forcedinline SIMDUInt32 expand(juce::uint32 s) noexcept           { return { _mm_set1_epi32((int)s) }; }
+    static forcedinline SIMDUInt32 load(const juce::uint32* src) noexcept    { return { _mm_loadu_si128((const __m128i*)src) }; }
+    forcedinline void store(juce::uint32* dst) const noexcept                { _mm_storeu_si128((__m128i*)dst, value); }
+
+    forcedinline SIMDUInt32 operator+(SIMDUInt32 o) const noexcept           { return { _mm_add_epi32(value, o.value) }; }
+    forcedinline SIMDUInt32 operator&(SIMDUInt32 o) const noexcept           { return { _mm_and_si128(value, o.value) }; }
+    forcedinline SIMDUInt32 shiftRight(int bits) const noexcept              { return { _mm_srl_epi32(value, _mm_cvtsi32_si128(bits)) }; }
+
+    /** Only exact for values below 2^31. */
+    forcedinline SIMDFloat toFloat() const noexcept                          { return { _mm_cvtepi32_ps(value) }; }
+   #elif MIDIPOLYSYNTH_SIMD_NEON
+    uint32x4_t value;
+
+    static forcedinline SIMDUInt32 expand(juce::uint32 s) noexcept           { return { vdupq_n_u32(s) }; }
+    static forcedinline SIMDUInt32 load(const juce::uint32* src) noexcept    { return { vld1q_u32(src) }; }
+    forcedinline void store(juce::uint32* dst) const noexcept                { vst1q_u32(dst, value); }
+
+    forcedinline SIMDUInt32 operator+(SIMDUInt32 o) const noexcept           { return { vaddq_u32(value, o.value) }; }
+    forcedinline SIMDUInt32 operator&(SIMDUInt32 o) const noexcept           { return { vandq_u32(value, o.value) }; }
+    forcedinline SIMDUInt32 shiftRight(int bits) const noexcept              { return { vshlq_u32(value, vdupq_n_s32(-bits)) }; }
+
+    forcedinline SIMDFloat toFloat() const noexcept                          { return { vcvtq_f32_u32(value) }; }
+   #else
+    juce::uint32 value[SIMDFloat::size];
+
+    static forcedinline SIMDUInt32 expand(juce::uint32 s) noexcept           { return { { s, s, s, s } }; }
+    static forcedinline SIMDUInt32 load(const juce::uint32* src) noexcept    { return { { src[0], src[1], src[2], src[3] } }; }
+    forcedinline void store(juce::uint32* dst) const noexcept                { for (int i = 0; i < SIMDFloat::size; ++i) dst[i] = value[i]; }
+
+    forcedinline SIMDUInt32 operator+(SIMDUInt32 o) const noexcept           { SIMDUInt32 r; for (int i = 0; i < SIMDFloat::size; ++i) r.value[i] = value[i] + o.value[i]; return r; }
+    forcedinline SIMDUInt32 operator&(SIMDUInt32 o) const noexcept           { SIMDUInt32 r; for (int i = 0; i < SIMDFloat::size; ++i) r.value[i] = value[i] & o.value[i]; return r; }
+    forcedinline SIMDUInt32 shiftRight(int bits) const noexcept              { SIMDUInt32 r; for (int i = 0; i < SIMDFloat::size; ++i) r.value[i] = value[i] >> bits; return r; }
+
+    forcedinline SIMDFloat toFloat() const noexcept                          { SIMDFloat r; for (int i = 0; i < SIMDFloat::size; ++i) r.value[i] = (float)value[i]; return r; }
+   #endif
+
+    /** Returns { start, start + step, start + 2 * step, ... }, wrapping as uint32 does. */
+    static forcedinline SIMDUInt32 ramp(juce::uint32 start, juce::uint32 step) noexcept
+    {
+        alignas(32) juce::uint32 lanes[SIMDFloat::size];
+
+        for (int i = 0; i < SIMDFloat::size; ++i)
+            lanes[i] = start + step * (juce::uint32)i;
+
+        return load(lanes);
+    }
+};
@@ -0,0 +1,383 @@
+/*
+  ==============================================================================
+
+    Scope.h
+    An oscilloscope and spectrum view of what the synth is actually putting
+    out, fed from the audio callback through a wait-free tap.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "FFT.h"
+
+
+//==============================================================================
+/** Copies the audio callback's output into a fixed ring for the GUI to read.
+
+    The audio thread mixes the channels down to mono, averages every few samples
+    into one so the tap runs at about tappedRateTarget, and writes the result into a
+    preallocated AbstractFifo. That copy is all it pays. If the reader falls behind,
+    new samples are dropped and counted rather than waited for.
+*/
+class AudioTap
+{
+public:
+    //==============================================================================
+    explicit AudioTap(int capacity = 16384)
+        : fifo(capacity)
+    {
+        samples.calloc((size_t)capacity);
+    }
+
+    /** Call before the callbacks start, with the device's sample rate. */
+    void prepare(double sampleRate) noexcept
+    {
+        decimation = juce::jmax(1, juce::roundToInt(sampleRate / tappedRateTarget));
+        phase = 0;
+        sum = 0.0f;
+        tappedSampleRate.store(sampleRate / decimation);
+    }
+
+    /** The rate of the samples that come out of drain(). Safe to call from any thread. */
+    double getTappedSampleRate() const noexcept    { return tappedSampleRate.load(); }
+
+    //==============================================================================
+    /** Adds the first numSamples of buffer. Audio thread only. */
+    void push(const juce::AudioBuffer<float>& buffer, int numSamples) noexcept
+    {
+        auto numChannels = buffer.getNumChannels();
+
+        if (numChannels == 0)
+            return;
+
+        auto numOut = (phase + numSamples) / decimation;
+
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite(numOut, start1, size1, start2, size2);
+
+        if (size1 + size2 < numOut)
+            numDropped.fetch_add(numOut - (size1 + size2), std::memory_order_relaxed);
+
+        auto* const* channels = buffer.getArrayOfReadPointers();
+        auto gain = 1.0f / (float)(decimation * numChannels);
+        int numWritten = 0;
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            for (int channel = 0; channel < numChannels; ++channel)
+                sum += channels[channel][i];
+
+            if (++phase == decimation)
+            {
+                if (numWritten < size1)
+                    samples[start1 + numWritten] = sum * gain;
+                else if (numWritten < size1 + size2)
+                    samples[start2 + numWritten - size1] = sum * gain;
+
+                ++numWritten;
+                sum = 0.0f;
+                phase = 0;
+            }
+        }
+
+        fifo.finishedWrite(size1 + size2);
+    }
+
+    //==============================================================================
+    /** Hands every sample pushed since the last call to handleSamples, in at most two
+        runs. Call this from one thread only (normally the message thread).
+    */
+    template <typename HandleSamples>
+    void drain(HandleSamples&& handleSamples)
+    {
+        auto numReady = fifo.getNumReady();
+
+        if (numReady == 0)
+            return;
+
+        int start1, size1, start2, size2;
+        fifo.prepareToRead(numReady, start1, size1, start2, size2);
+
+        if (size1 > 0)  handleSamples(samples + start1, size1);
+        if (size2 > 0)  handleSamples(samples + start2, size2);
+
+        fifo.finishedRead(size1 + size2);
+    }
+
+    /** How many samples were thrown away because the ring was full. */
+    int getNumDroppedSamples() const noexcept    { return numDropped.load(std::memory_order_relaxed); }
+
+private:
+    //==============================================================================
+    static constexpr double tappedRateTarget = 24000.0;
+
+    juce::AbstractFifo fifo;
+    juce::HeapBlock<float> samples;
+    std::atomic<int> numDropped { 0 };
+    std::atomic<double> tappedSampleRate { tappedRateTarget };
+
+    int decimation = 1, phase = 0;
+    float sum = 0.0f;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AudioTap)
+};
+
+#if JUCE_MODULE_AVAILABLE_juce_gui_basics
+
+//==============================================================================
+/** A scope on top and a spectrum underneath, both drawn from an AudioTap.
+
+    Everything is worked out on the message thread, at a fixed refreshRateHz. Both
+    views are stored as one vertical bar per pixel column, and each refresh only
+    repaints the columns whose bars moved, so a steady sound costs next to nothing
+    to draw and silence costs nothing at all.
+*/
+class ScopePanel : public juce::Component,
+    private juce::Timer
+{
+public:
+    //==============================================================================
+    explicit ScopePanel(AudioTap& tapToShow)
+        : tap(tapToShow)
+    {
+        history.calloc((size_t)fftSize);
+        fftData.calloc((size_t)fftSize);
+        window.calloc((size_t)fftSize);
+
+        for (int i = 0; i < fftSize; ++i)
+            window[i] = 0.5f - 0.5f * std::cos(juce::MathConstants<float>::twoPi * (float)i / (float)fftSize);
+
+        setOpaque(true);
+        startTimerHz(refreshRateHz);
+    }
+
+    ~ScopePanel() override
+    {
+        stopTimer();
+    }
+
+    //==============================================================================
+    void paint(juce::Graphics& g) override
+    {
+        g.fillAll(juce::Colours::black);
+
+        auto clip = g.getClipBounds();
+
+        g.setColour(juce::Colours::limegreen);
+        drawColumns(g, scope, clip);
+
+        g.setColour(juce::Colours::orange);
+        drawColumns(g, spectrum, clip);
+    }
+
+    void resized() override
+    {
+        auto r = getLocalBounds().reduced(4);
+        scope.setArea(r.removeFromTop(r.getHeight() / 2).reduced(0, 2));
+        spectrum.setArea(r.reduced(0, 2));
+
+        spectrumLevels.resize(spectrum.area.getWidth());
+        spectrumLevels.fill(minDecibels);
+
+        repaint();
+    }
+
+private:
+    //==============================================================================
+    /** One bar per pixel column, and the part of the area that has changed. */
+    struct ColumnView
+    {
+        struct Column
+        {
+            float top = 0.0f, bottom = 0.0f;
+        };
+
+        void setArea(juce::Rectangle<int> newArea)
+        {
+            area = newArea;
+            columns.resize(area.getWidth());
+
+            for (auto& column : columns)
+                column.top = column.bottom = (float)area.getBottom();
+        }
+
+        void set(int x, float top, float bottom) noexcept
+        {
+            auto& column = columns.getReference(x);
+
+            if (std::abs(column.top - top) < 0.5f && std::abs(column.bottom - bottom) < 0.5f)
+                return;
+
+            auto changed = juce::Rectangle<float>::leftTopRightBottom((float)(area.getX() + x), juce::jmin(top, column.top),
+                                                                      (float)(area.getX() + x + 1), juce::jmax(bottom, column.bottom));
+            dirty = dirty.isEmpty() ? changed : dirty.getUnion(changed);
+
+            column.top = top;
+            column.bottom = bottom;
+        }
+
+        juce::Rectangle<int> takeDirtyArea() noexcept
+        {
+            auto result = dirty.getSmallestIntegerContainer().expanded(1);
+            dirty = {};
+            return result;
+        }
+
+        juce::Rectangle<int> area;
+        juce::Array<Column> columns;
+        juce::Rectangle<float> dirty;
+    };
+
+    //==============================================================================
+    void timerCallback() override
+    {
+        auto numNewSamples = 0;
+
+        tap.drain([this, &numNewSamples](const float* samples, int numSamples)
+        {
+            for (int i = 0; i < numSamples; ++i)
+            {
+                history[historyPosition] = samples[i];
+                historyPosition = (historyPosition + 1) & (fftSize - 1);
+            }
+
+            numNewSamples += numSamples;
+        });
+
+        if (numNewSamples == 0)
+            return;
+
+        updateScope();
+        updateSpectrum();
+
+        for (auto* view : { &scope, &spectrum })
+            if (! view->dirty.isEmpty())
+                repaint(view->takeDirtyArea());
+    }
+
+    /** The sample i places after the oldest one in the history. */
+    float getHistorySample(int i) const noexcept
+    {
+        return history[(historyPosition + i) & (fftSize - 1)];
+    }
+
+    /** Shows the last scopeLength samples or so, starting at a rising zero crossing
+        where there is one, so a steady waveform stands still.
+    */
+    void updateScope()
+    {
+        auto width = scope.area.getWidth();
+
+        if (width <= 0)
+            return;
+
+        auto start = fftSize - scopeLength;
+
+        for (int i = start; i > start - fftSize / 2; --i)
+        {
+            if (getHistorySample(i - 1) < 0.0f && getHistorySample(i) >= 0.0f)
+            {
+                start = i;
+                break;
+            }
+        }
+
+        auto centre = (float)scope.area.getCentreY();
+        auto halfHeight = 0.5f * (float)scope.area.getHeight();
+
+        for (int x = 0; x < width; ++x)
+        {
+            auto first = start + x * scopeLength / width;
+            auto last = juce::jmax(first + 1, start + (x + 1) * scopeLength / width);
+            auto lowest = getHistorySample(first), highest = lowest;
+
+            for (int i = first + 1; i < last; ++i)
+            {
+                lowest = juce::jmin(lowest, getHistorySample(i));
+                highest = juce::jmax(highest, getHistorySample(i));
+            }
+
+            auto top = centre - juce::jlimit(-1.0f, 1.0f, highest) * halfHeight;
+            auto bottom = centre - juce::jlimit(-1.0f, 1.0f, lowest) * halfHeight;
+            scope.set(x, top, juce::jmax(bottom, top + 1.0f));
+        }
+    }
+
+    /** A Hann-windowed FFT of the whole history, on a log frequency axis from 20 Hz
+        up to the tap's Nyquist frequency. Peaks fall back slowly rather than flicker.
+    */
+    void updateSpectrum()
+    {
+        auto width = spectrum.area.getWidth();
+
+        if (width <= 0)
+            return;
+
+        for (int i = 0; i < fftSize; ++i)
+            fftData[i] = getHistorySample(i) * window[i];
+
+        fft.perform(fftData, false);
+
+        auto binWidth = tap.getTappedSampleRate() / fftSize;
+        auto nyquist = 0.5 * tap.getTappedSampleRate();
+        auto lowestFrequency = juce::jmin(20.0, nyquist);
+        auto height = (float)spectrum.area.getHeight();
+        auto bottom = (float)spectrum.area.getBottom();
+
+        // a full-scale sine, windowed, peaks at fftSize / 4
+        auto magnitudeScale = 4.0f / (float)fftSize;
+
+        auto frequency = [&](int column) { return lowestFrequency * std::pow(nyquist / lowestFrequency, (double)column / width); };
+
+        for (int x = 0; x < width; ++x)
+        {
+            auto firstBin = juce::jlimit(1, fftSize / 2 - 1, (int)(frequency(x) / binWidth));
+            auto lastBin = juce::jlimit(firstBin + 1, fftSize / 2, (int)(frequency(x + 1) / binWidth));
+            auto magnitude = 0.0f;
+
+            for (int bin = firstBin; bin < lastBin; ++bin)
+                magnitude = juce::jmax(magnitude, std::abs(fftData[bin]));
+
+            auto level = juce::Decibels::gainToDecibels(magnitude * magnitudeScale, minDecibels);
+            auto& shownLevel = spectrumLevels.getReference(x);
+            shownLevel = juce::jmax(level, shownLevel - fallbackDecibelsPerRefresh);
+
+            auto proportion = (shownLevel - minDecibels) / -minDecibels;
+            spectrum.set(x, bottom - juce::jlimit(0.0f, 1.0f, proportion) * height, bottom);
+        }
+    }
+
+    static void drawColumns(juce::Graphics& g, const ColumnView& view, juce::Rectangle<int> clip)
+    {
+        auto firstX = juce::jmax(0, clip.getX() - view.area.getX());
+        auto lastX = juce::jmin(view.columns.size(), clip.getRight() - view.area.getX());
+
+        for (int x = firstX; x < lastX; ++x)
+        {
+            auto& column = view.columns.getReference(x);
+            g.fillRect(juce::Rectangle<float>::leftTopRightBottom((float)(view.area.getX() + x), column.top,
+                                                                  (float)(view.area.getX() + x + 1), column.bottom));
+        }
+    }
+
+    //==============================================================================
+    static constexpr int refreshRateHz = 30, fftSize = 2048, scopeLength = 512;
+    static constexpr float minDecibels = -100.0f, fallbackDecibelsPerRefresh = 1.5f;
+
+    AudioTap& tap;
+
+    juce::HeapBlock<float> history, window;
+    juce::HeapBlock<std::complex<float>> fftData;
+    RadixTwoFFT fft { fftSize };
+    int historyPosition = 0;
+
+    ColumnView scope, spectrum;
+    juce::Array<float> spectrumLevels;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ScopePanel)
+};
+
+#endif
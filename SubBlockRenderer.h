@@ -0,0 +1,128 @@
+/*
+  ==============================================================================
+
+    SubBlockRenderer.h
+    Renders each audio block in pieces, split where the parameters change, so
+    a change lands at its own sample however large the block is.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "ControlRate.h"
+
+
+//==============================================================================
+/** Drives a synth through one block at a time, splitting the block wherever a
+    parameter change was queued with addParameterChange().
+
+    Each piece gets its own parameter smoothing and its own SharedControlState
+    trajectory, and the voices render it with their usual segment-at-a-time code.
+    MIDI inside a piece is still split by the synth itself, at the same minimum size,
+    so MPE controllers land sample-accurately too.
+
+    Changes are moved back to the control segment boundary before them, so every
+    piece starts on a segment boundary. A change that lands less than
+    minimumSubBlockSize after the start of the current piece is applied at that start
+    instead of splitting it, so a dense stream of changes never breaks the block into
+    tiny loops.
+
+    Nothing allocates after prepare(). Changes past the queue's capacity replace the
+    last one queued.
+*/
+class SubBlockRenderer
+{
+public:
+    static constexpr int defaultMinimumSubBlockSize = 2 * SharedControlState::controlInterval;
+
+    //==============================================================================
+    SubBlockRenderer(SynthParameterSmoother& smootherToUse, SharedControlState& controlStateToUse)
+        : smoother(smootherToUse), controlState(controlStateToUse)
+    {
+    }
+
+    /** Call before playback starts, after preparing the smoother and the control state. */
+    void prepare(const SynthParameters& initialValues, int maxChangesPerBlock = 256)
+    {
+        target = initialValues;
+        changes.malloc((size_t)juce::jmax(1, maxChangesPerBlock));
+        capacity = juce::jmax(1, maxChangesPerBlock);
+        numChanges = 0;
+    }
+
+    /** Rounded up to a whole number of control segments. */
+    void setMinimumSubBlockSize(int numSamples) noexcept
+    {
+        auto interval = SharedControlState::controlInterval;
+        minimumSubBlockSize = juce::jmax(1, (numSamples + interval - 1) / interval) * interval;
+    }
+
+    int getMinimumSubBlockSize() const noexcept    { return minimumSubBlockSize; }
+
+    //==============================================================================
+    /** Queues new parameter values, to glide towards from samplePosition in the next block
+        that render() is given. Changes have to be added in time order. Audio thread only.
+    */
+    void addParameterChange(int samplePosition, const SynthParameters& parameters) noexcept
+    {
+        auto position = juce::jmax(0, samplePosition) / SharedControlState::controlInterval * SharedControlState::controlInterval;
+        jassert(numChanges == 0 || position >= changes[numChanges - 1].samplePosition);
+
+        if (numChanges == capacity)
+            --numChanges;
+
+        changes[numChanges++] = { position, parameters };
+    }
+
+    /** Renders numSamples of buffer from the start, applying the queued changes on the
+        way, and returns how many pieces it took. Audio thread only.
+    */
+    template <typename SynthType>
+    int render(SynthType& synth, juce::AudioBuffer<float>& buffer, const juce::MidiBuffer& midi, int numSamples)
+    {
+        synth.setMinimumRenderingSubdivisionSize(minimumSubBlockSize, false);
+
+        int start = 0, next = 0, numPieces = 0;
+
+        while (start < numSamples)
+        {
+            // anything due before the earliest place this piece may end takes effect from its start
+            while (next < numChanges && changes[next].samplePosition < start + minimumSubBlockSize)
+                target = changes[next++].parameters;
+
+            auto end = next < numChanges ? juce::jmin(numSamples, changes[next].samplePosition) : numSamples;
+
+            controlState.beginBlock(start, end - start, smoother.process(target, end - start));
+            synth.renderNextBlock(buffer, midi, start, end - start);
+
+            start = end;
+            ++numPieces;
+        }
+
+        // anything queued beyond this block becomes the target for the next one
+        while (next < numChanges)
+            target = changes[next++].parameters;
+
+        numChanges = 0;
+        return numPieces;
+    }
+
+private:
+    //==============================================================================
+    struct ParameterChange
+    {
+        int samplePosition;
+        SynthParameters parameters;
+    };
+
+    SynthParameterSmoother& smoother;
+    SharedControlState& controlState;
+
+    SynthParameters target;
+    juce::HeapBlock<ParameterChange> changes;
+    int capacity = 0, numChanges = 0;
+    int minimumSubBlockSize = defaultMinimumSubBlockSize;
+
+    JUCE_DECLARE_NON_COPYABLE(SubBlockRenderer)
+};
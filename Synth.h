@@ -11,65 +11,31 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "Wavetable.h"
+#include "ControlRate.h"
+#include "VoicePool.h"
 
 
-//Global Synth Variables
-const unsigned int tableSize = 1 << 11, numberOfTablesInMasterTable = 2, totalTableSize = tableSize * numberOfTablesInMasterTable + 1;
-const float sampleRate = 48000.0f;
-juce::ADSR::Parameters adsrParas;
-juce::SmoothedValue<float> filterCutoff,  oscMix = 0.0f;
-extern unsigned short int numberOfVoices;
-
-
-class WavetableOscillator
-{
-private:
-    const juce::AudioSampleBuffer& wavetable;
-    unsigned short int tableSize;
-public:
-    WavetableOscillator(juce::AudioSampleBuffer& wavetableToUse) : wavetable(wavetableToUse), tableSize(wavetable.getNumSamples() - 1)
-    {
-        jassert(wavetable.getNumChannels() == 1);
-    }
-
-    float currentIndex = 0.0f, tableDelta = 0.0f;
-
-    void setFrequency(float frequency, float sampleRate)
-    {
-        auto tableSizeOverSampleRate = (float)tableSize / sampleRate;
-        tableDelta = frequency * tableSizeOverSampleRate;
-    }
-
-    forcedinline float getNextSample() noexcept
-    {
-        auto index0 = (unsigned int)currentIndex;
-        auto index1 = index0 + 1;
-
-        auto frac = currentIndex - (float)index0;
-
-        auto* table = wavetable.getReadPointer(0);
-        auto value0 = table[index0];
-        auto value1 = table[index1];
+//=================================================================================
+/** One note: the master wavetable through an ADSR and the state-variable filter.
+    The modulation matrix moves the note's pitch, morph position, filter cutoff and
+    level, from its own LFOs and second envelope and from its MPE dimensions.
 
-        //interpolate
-        auto currentSample = value0 + frac * (value1 - value0);
+    With unison on, a UnisonOscillator stack replaces the single oscillator. Once the
+    stack is spread across the stereo field, each side gets its own filter.
 
-        if ((currentIndex += tableDelta) > oscMix.getCurrentValue() + (float)tableSize)
-            currentIndex -= (float)tableSize;
-        return currentSample;
-    }
-};
-//=================================================================================
-class SynthVoice : public juce::MPESynthesiserVoice
+    Everything that depends on the sample rate is worked out in setCurrentSampleRate(),
+    which the synth calls from its prepare(), so nothing here has to until then.
+*/
+class SynthVoice : public PooledVoice
 {
 public:
     //==============================================================================
-    SynthVoice()
+    SynthVoice(const SharedControlState& sharedControlState)
+        : controlState(sharedControlState),
+          masterOscillator(WavetableBank::getInstance().getMasterTable()),
+          unisonOscillator(WavetableBank::getInstance().getMasterTable())
     {
-        writeWholeWaveTable();
-        adsr.setSampleRate(sampleRate);
-        masterOscillator = new WavetableOscillator(masterWaveTable);
-        filter.setCoefficients( filterCoeffs.makeLowPass(sampleRate, filterCutoff.getCurrentValue() ) );
     }
     
     //==============================================================================
@@ -78,21 +44,48 @@ public:
         jassert(currentlyPlayingNote.isValid());
         jassert(currentlyPlayingNote.keyState == juce::MPENote::keyDown
             || currentlyPlayingNote.keyState == juce::MPENote::keyDownAndSustained);
+        jassert(currentSampleRate > 0.0);
 
+        fastReleaseGain = 1.0f;
+        fastReleaseStep = 0.0f;
+
+        updateWavetable();
+        updateUnison();
+        unisonOscillator.randomisePhases();
         adsr.noteOn();
         // get data from the current MPENote
         level.setTargetValue(currentlyPlayingNote.pressure.asUnsignedFloat());
-        frequency.setTargetValue((float)currentlyPlayingNote.getFrequencyInHertz());
+        frequency.setCurrentAndTargetValue((float)currentlyPlayingNote.getFrequencyInHertz());
         timbre.setTargetValue(currentlyPlayingNote.timbre.asUnsignedFloat());
 
-        masterOscillator->setFrequency(frequency.getCurrentValue(), sampleRate);
+        modulation.noteStarted(controlState, level.getCurrentValue(), timbre.getCurrentValue(), getPitchBend());
+        pitchOffset = modulation.getEnd(ModulationDestination::pitch);
+        updateFrequency();
     }
 
     void noteStopped(bool allowTailOff) override
     {
         jassert(currentlyPlayingNote.keyState == juce::MPENote::off);
+
+        // without a tail, the note ends here and the voice is free straight away
+        if (! allowTailOff)
+        {
+            finishNote();
+            return;
+        }
+
         adsr.noteOff();
-        //limiter->add(*this);
+        modulation.noteStopped(controlState);
+    }
+
+    float getCurrentLevel() const noexcept override
+    {
+        return envelopeLevel * fastReleaseGain;
+    }
+
+    void startFastRelease() noexcept override
+    {
+        fastReleaseStep = fastReleaseStepAtCurrentRate;
     }
 
     void notePressureChanged() override
@@ -116,12 +109,17 @@ public:
     {
         if (currentSampleRate != newRate)
         {
-            noteStopped(false);
+            // anything still sounding was tuned for the old rate
+            if (isActive())
+                finishNote();
+
             currentSampleRate = newRate;
 
+            adsr.setSampleRate(currentSampleRate);
             level.reset(currentSampleRate, smoothingLengthInSeconds);
             timbre.reset(currentSampleRate, smoothingLengthInSeconds);
             frequency.reset(currentSampleRate, smoothingLengthInSeconds);
+            fastReleaseStepAtCurrentRate = 1.0f / (float)juce::jmax(1.0, fastReleaseLengthInSeconds * currentSampleRate);
         }
     }
 
@@ -130,110 +128,358 @@ public:
         int startSample,
         int numSamples) override
     {
-        for (auto sample = 0; sample < numSamples; ++sample)
+        if (adsrVersion != controlState.adsrVersion)
         {
-            float levelSample = getNextSample() * 0.5f;
-            for (auto i = outputBuffer.getNumChannels(); --i >= 0;)
-                outputBuffer.addSample(i, startSample, levelSample);
+            adsr.setParameters(controlState.adsrParameters);
+            adsrVersion = controlState.adsrVersion;
+        }
+
+        updateWavetable();
+        updateUnison();
 
-            ++startSample;
+        float oscillatorSamples[SharedControlState::controlInterval], rightSamples[SharedControlState::controlInterval];
+        auto unison = isUnison();
+        auto stereo = unison && outputBuffer.getNumChannels() > 1;
+
+        // one control segment at a time, so the filter coefficients can ramp across it
+        while (numSamples > 0)
+        {
+            auto numThisTime = juce::jmin(numSamples, SharedControlState::controlInterval - startSample % SharedControlState::controlInterval);
+            modulation.advance(controlState, numThisTime, level.skip(numThisTime), timbre.skip(numThisTime), getPitchBend());
+
+            auto coefficients = filterModulator.getRamp(controlState, startSample,
+                                                        modulation.getStart(ModulationDestination::cutoff),
+                                                        modulation.getEnd(ModulationDestination::cutoff));
+
+            // pitch moves a segment at a time, as a pitch bend glide does
+            auto wasSmoothing = frequency.isSmoothing();
+            frequency.skip(numThisTime);
+
+            if (wasSmoothing || pitchOffset != modulation.getEnd(ModulationDestination::pitch))
+            {
+                pitchOffset = modulation.getEnd(ModulationDestination::pitch);
+                updateFrequency();
+            }
+
+            auto morphStart = controlState.getMorphAt(startSample) + modulation.getStart(ModulationDestination::morph);
+            auto morphEnd = controlState.getMorphAt(startSample + numThisTime) + modulation.getEnd(ModulationDestination::morph);
+
+            if (unison)
+            {
+                unisonOscillator.renderBlock(oscillatorSamples, rightSamples, numThisTime, morphStart, morphEnd);
+
+                // a mono output gets both sides of the stack
+                if (! stereo)
+                    for (auto sample = 0; sample < numThisTime; ++sample)
+                        oscillatorSamples[sample] = 0.5f * (oscillatorSamples[sample] + rightSamples[sample]);
+            }
+            else
+            {
+                masterOscillator.renderBlock(oscillatorSamples, numThisTime, morphStart, morphEnd);
+            }
+
+            auto gain = juce::jmax(0.0f, 1.0f + modulation.getStart(ModulationDestination::amplitude));
+            auto gainStep = (juce::jmax(0.0f, 1.0f + modulation.getEnd(ModulationDestination::amplitude)) - gain) / (float)numThisTime;
+            auto& mode = controlState.filterModeWeights;
+
+            for (auto sample = 0; sample < numThisTime; ++sample)
+            {
+                auto sampleGain = getNextGain() * gain * 0.5f;
+                auto& c = coefficients.current;
+
+                oscillatorSamples[sample] = filter.processSample(oscillatorSamples[sample] * sampleGain, c.g, c.k, mode) * 0.5f;
+
+                if (stereo)
+                    rightSamples[sample] = rightFilter.processSample(rightSamples[sample] * sampleGain, c.g, c.k, mode) * 0.5f;
+
+                coefficients.advance();
+                gain += gainStep;
+            }
+
+            // the finished segment goes into each channel in one go, rather than a sample at a time
+            auto range = juce::FloatVectorOperations::findMinAndMax(oscillatorSamples, numThisTime);
+            auto peak = juce::jmax(-range.getStart(), range.getEnd());
+
+            if (stereo)
+            {
+                auto rightRange = juce::FloatVectorOperations::findMinAndMax(rightSamples, numThisTime);
+                peak = juce::jmax(peak, -rightRange.getStart(), rightRange.getEnd());
+            }
+
+            for (auto i = outputBuffer.getNumChannels(); --i >= 0;)
+                outputBuffer.addFrom(i, startSample, (stereo && (i & 1) != 0) ? rightSamples : oscillatorSamples, numThisTime);
+
+            startSample += numThisTime;
+            numSamples -= numThisTime;
+
+            // checked once per segment rather than per sample; once the voice is done the
+            // rest of the block is skipped
+            if (hasFinished(peak))
+            {
+                finishNote();
+                return;
+            }
         }
-        adsr.setParameters(adsrParas);
-        filter.setCoefficients(filterCoeffs.makeLowPass(sampleRate, filterCutoff.getCurrentValue() ));
+
+        filter.snapToZero();
+        rightFilter.snapToZero();
     }
 
-   
-    void writeSquareWavetable(float* samples, unsigned short int startSample)
+private:
+    //==============================================================================
+    float getPitchBend() const noexcept
     {
-        for (unsigned short int i = startSample; i < startSample + tableSize; ++i)
-        {
-            (i < ((startSample + tableSize) / 2)) ? samples[i] = 0.6 : samples[i] = -0.6;
-        }
+        return currentlyPlayingNote.pitchbend.asSignedFloat();
+    }
+
+    float getModulatedFrequency() const noexcept
+    {
+        return frequency.getCurrentValue() * std::exp2(pitchOffset * (1.0f / 12.0f));
+    }
+
+    bool isUnison() const noexcept
+    {
+        return unisonOscillator.getNumVoices() > 1;
     }
 
-    void writeSawtoothTable(float* samples, unsigned short int startSample)
+    void updateFrequency() noexcept
     {
-        float tableDelta = 1.0f / tableSize;
-        float phase = 0.0f;
-        for (unsigned short int i = startSample; i < startSample + tableSize; ++i)
+        if (isUnison())
+            unisonOscillator.setFrequency(getModulatedFrequency(), (float)currentSampleRate);
+        else
+            masterOscillator.setFrequency(getModulatedFrequency(), (float)currentSampleRate);
+    }
+
+    void updateUnison() noexcept
+    {
+        if (unisonVersion != controlState.unisonVersion)
         {
-            samples[i] = (-1.0f + phase) * 0.6;
-            phase += tableDelta;
+            auto wasUnison = isUnison();
+            unisonOscillator.setUnison(controlState.unisonVoices, controlState.unisonDetune, controlState.unisonSpread);
+            unisonVersion = controlState.unisonVersion;
+
+            // the right-hand filter picks up from the left, so turning the spread on doesn't click
+            if (isUnison() && ! wasUnison)
+                rightFilter = filter;
+
+            if (isUnison() != wasUnison && currentSampleRate > 0.0)
+                updateFrequency();
         }
     }
-    
-    void writeWholeWaveTable()
+
+    void updateWavetable() noexcept
     {
-        masterWaveTable.setSize(1, totalTableSize);
-        masterWaveTable.clear();
-        auto* samples = masterWaveTable.getWritePointer(0);
-        writeSawtoothTable(samples, 0);
-        writeSquareWavetable(samples, tableSize);
-        samples[totalTableSize] = samples[0];
+        if (wavetableVersion != controlState.wavetableVersion)
+        {
+            masterOscillator.setTables(controlState.wavetable);
+            unisonOscillator.setTables(controlState.wavetable);
+            wavetableVersion = controlState.wavetableVersion;
+        }
     }
 
-    void clearNote()
+    /** Moves the envelope and the fast release on a sample, and returns their gain. */
+    float getNextGain() noexcept
     {
-        clearCurrentNote();
+        envelopeLevel = adsr.getNextSample();
+        auto gain = envelopeLevel;
+
+        if (fastReleaseStep > 0.0f)
+        {
+            fastReleaseGain = juce::jmax(0.0f, fastReleaseGain - fastReleaseStep);
+            gain *= fastReleaseGain;
+        }
+
+        return gain;
     }
 
-private:
-    //==============================================================================
-    float getNextSample() noexcept
+    /** True once the envelope or the fast release has run out, or once a released note's
+        output has stayed below the tail threshold for a few segments.
+    */
+    bool hasFinished(float segmentPeak) noexcept
     {
-        if (!adsr.isActive())
+        if (! adsr.isActive() || (fastReleaseStep > 0.0f && fastReleaseGain <= 0.0f))
+            return true;
+
+        if (! isPlayingButReleased())
         {
-            clearCurrentNote();
-            masterOscillator->currentIndex = oscMix.getCurrentValue();
+            numQuietSegments = 0;
+            return false;
         }
-            
-        float rawSample = masterOscillator->getNextSample();
-        return filter.processSingleSampleRaw(rawSample * adsr.getNextSample() * 0.5f);
+
+        numQuietSegments = segmentPeak < controlState.tailThreshold ? numQuietSegments + 1 : 0;
+        return numQuietSegments >= quietSegmentsBeforeStopping;
+    }
+
+    void finishNote() noexcept
+    {
+        clearCurrentNote();
+        adsr.reset();
+        filter.reset();
+        rightFilter.reset();
+        masterOscillator.reset();
+        unisonOscillator.reset();
+        modulation.reset();
+        envelopeLevel = 0.0f;
+        fastReleaseGain = 1.0f;
+        fastReleaseStep = 0.0f;
+        numQuietSegments = 0;
     }
     //==============================================================================
     juce::SmoothedValue<float> level, timbre, frequency;
-    juce::AudioSampleBuffer masterWaveTable;
     
-    juce::ADSR adsr;
-    juce::IIRFilter filter;
-    juce::IIRCoefficients filterCoeffs;
+    const SharedControlState& controlState;
 
-    WavetableOscillator* masterOscillator;
+    juce::ADSR adsr;
+    int adsrVersion = -1, wavetableVersion = -1, unisonVersion = -1;
+    StateVariableFilter filter, rightFilter;
+    VoiceFilterModulator filterModulator;
+
+    WavetableOscillator masterOscillator;
+    UnisonOscillator unisonOscillator;
+    VoiceModulation modulation;
+    float pitchOffset = 0.0f;
     
+    float envelopeLevel = 0.0f, fastReleaseGain = 1.0f, fastReleaseStep = 0.0f, fastReleaseStepAtCurrentRate = 0.0f;
+    int numQuietSegments = 0;
+    static constexpr int quietSegmentsBeforeStopping = 4;
+
     float smoothingLengthInSeconds = 0.1f;
+    static constexpr double fastReleaseLengthInSeconds = 0.005;
 };
+
+#if JUCE_MODULE_AVAILABLE_juce_gui_basics
+
 //==============================================================================
-/*
-class VoiceLimiter
+/** The two LFOs, the second envelope and the rows of the modulation matrix. */
+class ModulationPanel : public juce::Component
 {
 public:
-    VoiceLimiter() {}
-
-    void add(SynthVoice& voice)
+    ModulationPanel(SynthParameterStore& parameterStore)
+        : parameters(parameterStore)
     {
-        voices.push(voice);
-        if (voices.size() >= numberOfVoices)
+        auto& initial = parameters.getParameters().modulation;
+
+        for (int i = 0; i < ModulationParameters::numLFOs; ++i)
+        {
+            auto& rateSlider = lfoRateSliders[i];
+            addAndMakeVisible(rateSlider);
+            rateSlider.setBounds(250 * i, 0, 150, 25);
+            rateSlider.setRange(0.01, 20.0);
+            rateSlider.setSkewFactorFromMidPoint(2.0);
+            rateSlider.setTextValueSuffix(" Hz");
+            rateSlider.setValue(initial.lfos[i].rate, juce::dontSendNotification);
+            rateSlider.onValueChange = [this, i]
+            {
+                parameters.update([this, i](SynthParameters& p) { p.modulation.lfos[i].rate = (float)lfoRateSliders[i].getValue(); });
+            };
+
+            auto& shapeBox = lfoShapeBoxes[i];
+            addAndMakeVisible(shapeBox);
+            shapeBox.setBounds(250 * i + 150, 0, 90, 25);
+            shapeBox.addItem("Sine", 1 + (int)LFOShape::sine);
+            shapeBox.addItem("Triangle", 1 + (int)LFOShape::triangle);
+            shapeBox.addItem("Saw", 1 + (int)LFOShape::saw);
+            shapeBox.addItem("Square", 1 + (int)LFOShape::square);
+            shapeBox.setSelectedId(1 + (int)initial.lfos[i].shape, juce::dontSendNotification);
+            shapeBox.onChange = [this, i]
+            {
+                parameters.update([this, i](SynthParameters& p) { p.modulation.lfos[i].shape = (LFOShape)(lfoShapeBoxes[i].getSelectedId() - 1); });
+            };
+        }
+        //========================================================================
+
+        float initialEnvelope2[] = { initial.envelope2.attack, initial.envelope2.decay,
+                                     initial.envelope2.sustain, initial.envelope2.release };
+
+        for (int i = 0; i < 4; ++i)
         {
-            SynthVoice& temp = voices.front();
-            temp.clearNote();
+            auto& slider = envelope2Sliders[i];
+            addAndMakeVisible(slider);
+            slider.setBounds(500 + 75 * i, 0, 75, 25);
+            slider.setRange(0.0, i == 2 ? 1.0 : 5.0);
+            slider.setValue(initialEnvelope2[i], juce::dontSendNotification);
+            slider.onValueChange = [this]
+            {
+                juce::ADSR::Parameters envelope2((float)envelope2Sliders[0].getValue(), (float)envelope2Sliders[1].getValue(),
+                                                 (float)envelope2Sliders[2].getValue(), (float)envelope2Sliders[3].getValue());
+                parameters.update([&envelope2](SynthParameters& p) { p.modulation.envelope2 = envelope2; });
+            };
+        }
+        //========================================================================
+
+        for (int i = 0; i < ModulationParameters::maxRoutes; ++i)
+        {
+            auto x = (i / 4) * 400, y = 30 + (i % 4) * 30;
+            auto& route = initial.routes[i];
+
+            auto& sourceBox = sourceBoxes[i];
+            addAndMakeVisible(sourceBox);
+            sourceBox.setBounds(x, y, 100, 25);
+            sourceBox.addItem("LFO 1", 1 + (int)ModulationSource::lfo1);
+            sourceBox.addItem("LFO 2", 1 + (int)ModulationSource::lfo2);
+            sourceBox.addItem("Envelope 2", 1 + (int)ModulationSource::envelope2);
+            sourceBox.addItem("Pressure", 1 + (int)ModulationSource::pressure);
+            sourceBox.addItem("Timbre", 1 + (int)ModulationSource::timbre);
+            sourceBox.addItem("Pitch bend", 1 + (int)ModulationSource::pitchBend);
+            sourceBox.setSelectedId(1 + (int)route.source, juce::dontSendNotification);
+            sourceBox.onChange = [this, i]
+            {
+                parameters.update([this, i](SynthParameters& p) { p.modulation.routes[i].source = (ModulationSource)(sourceBoxes[i].getSelectedId() - 1); });
+            };
+
+            auto& destinationBox = destinationBoxes[i];
+            addAndMakeVisible(destinationBox);
+            destinationBox.setBounds(x + 105, y, 100, 25);
+            destinationBox.addItem("Pitch", 1 + (int)ModulationDestination::pitch);
+            destinationBox.addItem("Morph", 1 + (int)ModulationDestination::morph);
+            destinationBox.addItem("Cutoff", 1 + (int)ModulationDestination::cutoff);
+            destinationBox.addItem("Amplitude", 1 + (int)ModulationDestination::amplitude);
+            destinationBox.setSelectedId(1 + (int)route.destination, juce::dontSendNotification);
+            destinationBox.onChange = [this, i]
+            {
+                parameters.update([this, i](SynthParameters& p) { p.modulation.routes[i].destination = (ModulationDestination)(destinationBoxes[i].getSelectedId() - 1); });
+            };
+
+            auto& amountSlider = amountSliders[i];
+            addAndMakeVisible(amountSlider);
+            amountSlider.setBounds(x + 210, y, 180, 25);
+            amountSlider.setRange(-1.0, 1.0);
+            amountSlider.setValue(route.amount, juce::dontSendNotification);
+            amountSlider.onValueChange = [this, i]
+            {
+                parameters.update([this, i](SynthParameters& p) { p.modulation.routes[i].amount = (float)amountSliders[i].getValue(); });
+            };
         }
     }
 
 private:
-    static std::queue<SynthVoice> voices;
-};*/
+    SynthParameterStore& parameters;
+
+    juce::Slider lfoRateSliders[ModulationParameters::numLFOs];
+    juce::ComboBox lfoShapeBoxes[ModulationParameters::numLFOs];
+    juce::Slider envelope2Sliders[4];
+
+    juce::ComboBox sourceBoxes[ModulationParameters::maxRoutes];
+    juce::ComboBox destinationBoxes[ModulationParameters::maxRoutes];
+    juce::Slider amountSliders[ModulationParameters::maxRoutes];
+};
 
+//==============================================================================
 class SynthComponent : public juce::Component
 {
 public:
-    SynthComponent()
+    SynthComponent(SynthParameterStore& parameterStore)
+        : parameters(parameterStore)
     {
+        auto& initial = parameters.getParameters();
+
         addAndMakeVisible(attackSlider);
         attackSlider.setRange(0.0, 5.0);
         attackSlider.setBounds(50, 50, 200, 100);
+        attackSlider.setValue(initial.adsr.attack, juce::dontSendNotification);
         attackSlider.onValueChange = [this]
         {
-            adsrParas.attack = (float)attackSlider.getValue();
+            parameters.update([this](SynthParameters& p) { p.adsr.attack = (float)attackSlider.getValue(); });
         };
 
         addAndMakeVisible(attackLabel);
@@ -244,9 +490,10 @@ public:
         addAndMakeVisible(decaySlider);
         decaySlider.setRange(0.0, 5.0);
         decaySlider.setBounds(250, 50, 200, 100);
+        decaySlider.setValue(initial.adsr.decay, juce::dontSendNotification);
         decaySlider.onValueChange = [this]
         {
-            adsrParas.decay = (float)decaySlider.getValue();
+            parameters.update([this](SynthParameters& p) { p.adsr.decay = (float)decaySlider.getValue(); });
         };
 
         addAndMakeVisible(decayLabel);
@@ -257,9 +504,10 @@ public:
         addAndMakeVisible(sustainSlider);
         sustainSlider.setRange(0.0, 5.0);
         sustainSlider.setBounds(450, 50, 200, 100);
+        sustainSlider.setValue(initial.adsr.sustain, juce::dontSendNotification);
         sustainSlider.onValueChange = [this]
         {
-            adsrParas.sustain = (float)sustainSlider.getValue();
+            parameters.update([this](SynthParameters& p) { p.adsr.sustain = (float)sustainSlider.getValue(); });
         };
 
         addAndMakeVisible(sustainLabel);
@@ -270,9 +518,10 @@ public:
         addAndMakeVisible(releaseSlider);
         releaseSlider.setRange(0.0, 5.0);
         releaseSlider.setBounds(650, 50, 200, 100);
+        releaseSlider.setValue(initial.adsr.release, juce::dontSendNotification);
         releaseSlider.onValueChange = [this]
         {
-            adsrParas.release = (float)releaseSlider.getValue();
+            parameters.update([this](SynthParameters& p) { p.adsr.release = (float)releaseSlider.getValue(); });
         };
 
         addAndMakeVisible(releaseLabel);
@@ -280,12 +529,56 @@ public:
         releaseLabel.setText(juce::String("R"), juce::dontSendNotification);
         //========================================================================
 
-        addAndMakeVisible(oscMixSlider);
-        oscMixSlider.setBounds(50, 300, 200, 100);
-        oscMixSlider.setRange(0.0, 1024.0);
-        oscMixSlider.onValueChange = [this]
+        addAndMakeVisible(modulationPanel);
+        modulationPanel.setBounds(50, 150, 800, 150);
+        //========================================================================
+
+        addAndMakeVisible(morphSlider);
+        morphSlider.setBounds(50, 300, 200, 100);
+        morphSlider.setRange(0.0, 1.0);
+        morphSlider.setValue(initial.morph, juce::dontSendNotification);
+        morphSlider.onValueChange = [this]
+        {
+            parameters.update([this](SynthParameters& p) { p.morph = (float)morphSlider.getValue(); });
+        };
+
+        addAndMakeVisible(timbreToMorphSlider);
+        timbreToMorphSlider.setBounds(250, 300, 200, 100);
+        timbreToMorphSlider.setRange(-1.0, 1.0);
+        timbreToMorphSlider.setValue(initial.timbreToMorph, juce::dontSendNotification);
+        timbreToMorphSlider.onValueChange = [this]
+        {
+            parameters.update([this](SynthParameters& p) { p.timbreToMorph = (float)timbreToMorphSlider.getValue(); });
+        };
+        //========================================================================
+
+        addAndMakeVisible(unisonVoicesSlider);
+        unisonVoicesSlider.setBounds(450, 300, 200, 50);
+        unisonVoicesSlider.setRange(1.0, (double)UnisonOscillator::maxVoices, 1.0);
+        unisonVoicesSlider.setTextValueSuffix(" voices");
+        unisonVoicesSlider.setValue(initial.unisonVoices, juce::dontSendNotification);
+        unisonVoicesSlider.onValueChange = [this]
+        {
+            parameters.update([this](SynthParameters& p) { p.unisonVoices = (int)unisonVoicesSlider.getValue(); });
+        };
+
+        addAndMakeVisible(unisonSpreadSlider);
+        unisonSpreadSlider.setBounds(450, 350, 200, 50);
+        unisonSpreadSlider.setRange(0.0, 1.0);
+        unisonSpreadSlider.setValue(initial.unisonSpread, juce::dontSendNotification);
+        unisonSpreadSlider.onValueChange = [this]
+        {
+            parameters.update([this](SynthParameters& p) { p.unisonSpread = (float)unisonSpreadSlider.getValue(); });
+        };
+
+        addAndMakeVisible(unisonDetuneSlider);
+        unisonDetuneSlider.setBounds(650, 300, 200, 100);
+        unisonDetuneSlider.setRange(0.0, 1.0);
+        unisonDetuneSlider.setTextValueSuffix(" st");
+        unisonDetuneSlider.setValue(initial.unisonDetune, juce::dontSendNotification);
+        unisonDetuneSlider.onValueChange = [this]
         {
-            oscMix = oscMixSlider.getValue();
+            parameters.update([this](SynthParameters& p) { p.unisonDetune = (float)unisonDetuneSlider.getValue(); });
         };
         //========================================================================
 
@@ -293,12 +586,49 @@ public:
         cutoffSlider.setBounds(50, 400, 400, 100);
         cutoffSlider.setRange(20.0, 20000.0f);
         cutoffSlider.setSkewFactorFromMidPoint(5000.0);
+        cutoffSlider.setValue(initial.filterCutoff, juce::dontSendNotification);
         cutoffSlider.onValueChange = [this]
         {
-            filterCutoff = cutoffSlider.getValue();
+            parameters.update([this](SynthParameters& p) { p.filterCutoff = (float)cutoffSlider.getValue(); });
+        };
+        //========================================================================
+
+        addAndMakeVisible(timbreToCutoffSlider);
+        timbreToCutoffSlider.setBounds(50, 500, 400, 100);
+        timbreToCutoffSlider.setRange(0.0, 4.0);
+        timbreToCutoffSlider.setValue(initial.timbreToCutoff, juce::dontSendNotification);
+        timbreToCutoffSlider.onValueChange = [this]
+        {
+            parameters.update([this](SynthParameters& p) { p.timbreToCutoff = (float)timbreToCutoffSlider.getValue(); });
+        };
+        //========================================================================
+
+        addAndMakeVisible(resonanceSlider);
+        resonanceSlider.setBounds(450, 400, 400, 100);
+        resonanceSlider.setRange(FilterCoefficients::minimumQ, 10.0);
+        resonanceSlider.setSkewFactorFromMidPoint(2.0);
+        resonanceSlider.setValue(initial.filterResonance, juce::dontSendNotification);
+        resonanceSlider.onValueChange = [this]
+        {
+            parameters.update([this](SynthParameters& p) { p.filterResonance = (float)resonanceSlider.getValue(); });
+        };
+        //========================================================================
+
+        addAndMakeVisible(filterModeBox);
+        filterModeBox.setBounds(450, 500, 200, 30);
+        filterModeBox.addItem("Low pass", 1 + (int)FilterMode::lowPass);
+        filterModeBox.addItem("Band pass", 1 + (int)FilterMode::bandPass);
+        filterModeBox.addItem("High pass", 1 + (int)FilterMode::highPass);
+        filterModeBox.setSelectedId(1 + (int)initial.filterMode, juce::dontSendNotification);
+        filterModeBox.onChange = [this]
+        {
+            parameters.update([this](SynthParameters& p) { p.filterMode = (FilterMode)(filterModeBox.getSelectedId() - 1); });
         };
     }
 private:
+    SynthParameterStore& parameters;
+    ModulationPanel modulationPanel { parameters };
+
     juce::Label attackLabel;
     juce::Slider attackSlider;
 
@@ -311,7 +641,13 @@ private:
     juce::Label releaseLabel;
     juce::Slider releaseSlider;
 
-    juce::Slider oscMixSlider;
+    juce::Slider morphSlider;
+    juce::Slider timbreToMorphSlider;
+    juce::Slider unisonVoicesSlider, unisonSpreadSlider, unisonDetuneSlider;
     juce::Slider cutoffSlider;
+    juce::Slider timbreToCutoffSlider;
+    juce::Slider resonanceSlider;
+    juce::ComboBox filterModeBox;
 };
 
+#endif
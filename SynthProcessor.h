@@ -0,0 +1,209 @@
+/*
+  ==============================================================================
+
+    SynthProcessor.h
+    The whole synth engine as one juce::AudioProcessor, so it can run as a
+    plugin, or as any number of instances in one process.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "Synth.h"
+#include "VoiceEngine.h"
+#include "PolySynthesiser.h"
+#include "SubBlockRenderer.h"
+#include "EffectsBus.h"
+#include "WavetableLibrary.h"
+
+
+//==============================================================================
+/** Owns everything one instance of the synth needs: its parameters, control state,
+    both voice engines and the effects. No two instances share anything they write to.
+    The only thing they share is the read-only data, the built-in WavetableBank and any
+    tables loaded through a WavetableLibrary, which stay put while anything plays them.
+
+    The standalone app drives it through renderBlock(), which places parameter changes
+    by the time they were made. A host calls processBlock(), which applies them at the
+    start of the block, as a host gives no clock to place them by.
+
+    The processor has no editor. Its state is the SynthParameters, saved through
+    SynthParameterState. Hosts may call the state and tail functions from any thread,
+    so those work from a snapshot rather than the message thread's copy.
+*/
+class SynthAudioProcessor : public juce::AudioProcessor
+{
+public:
+    static constexpr int maxPolyphony = 64, numSpareVoices = 8, defaultPolyphony = 16;
+
+    //==============================================================================
+    SynthAudioProcessor()
+        : AudioProcessor(BusesProperties().withOutput("Output", juce::AudioChannelSet::stereo(), true))
+    {
+        // the spares let stolen voices fade out while the new note starts
+        for (auto i = 0; i < maxPolyphony + numSpareVoices; ++i)
+            synth.addVoice(new SynthVoice(controlState));
+
+        synth.enableLegacyMode(24);
+        synth.setVoiceStealingEnabled(true);
+        synth.setPolyphony(defaultPolyphony);
+
+        soaSynth.enableLegacyMode(24);
+
+        // switching the effects thread on or off changes the latency, so the host has
+        // to hear about it to keep its delay compensation right
+        effectsBus.onLatencyChange = [this] { setLatencySamples(effectsBus.getLatencyInSamples()); };
+    }
+
+    //==============================================================================
+    const juce::String getName() const override                 { return "MidiPolySynth"; }
+    bool acceptsMidi() const override                           { return true; }
+    bool producesMidi() const override                          { return false; }
+    double getTailLengthSeconds() const override                { return tailLengthSeconds.load(); }
+
+    /** Any number of outputs: the voices and the effects spread themselves over however
+        many channels there are.
+    */
+    bool isBusesLayoutSupported(const BusesLayout& layouts) const override
+    {
+        return ! layouts.getMainOutputChannelSet().isDisabled();
+    }
+
+    bool hasEditor() const override                             { return false; }
+    juce::AudioProcessorEditor* createEditor() override         { return nullptr; }
+
+    int getNumPrograms() override                               { return 1; }
+    int getCurrentProgram() override                            { return 0; }
+    void setCurrentProgram(int) override                        {}
+    const juce::String getProgramName(int) override             { return {}; }
+    void changeProgramName(int, const juce::String&) override   {}
+
+    //==============================================================================
+    /** Everything that depends on the sample rate or the block size is set up here, so
+        rendering costs nothing extra.
+    */
+    void prepareToPlay(double sampleRate, int maximumBlockSize) override
+    {
+        auto numChannels = getTotalNumOutputChannels();
+        auto parameters = parameterStore.getSnapshot();
+
+        tailLengthSeconds.store((double)parameters.adsr.release);
+        parameterSmoother.prepare(sampleRate, parameters);
+        controlState.prepare(sampleRate, maximumBlockSize);
+        subBlockRenderer.prepare(parameters);
+        effectsParameters = parameters.effects;
+        effectsBus.prepare(sampleRate, maximumBlockSize);
+        synth.prepare(sampleRate, numChannels, maximumBlockSize);
+        soaSynth.prepare(sampleRate, numChannels, maximumBlockSize);
+
+        setLatencySamples(effectsBus.getLatencyInSamples());
+    }
+
+    void releaseResources() override
+    {
+        synth.release();
+        soaSynth.release();
+        effectsBus.release();
+    }
+
+    void processBlock(juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midi) override
+    {
+        renderBlock(buffer, midi, buffer.getNumSamples(), [](double) { return 0; });
+    }
+
+    /** Renders numSamples of buffer from the start, with the MIDI in midi. A parameter
+        change published since the last block lands at getSamplePosition(timeInSeconds),
+        given when it was published. Audio thread only.
+    */
+    template <typename GetSamplePosition>
+    void renderBlock(juce::AudioBuffer<float>& buffer, const juce::MidiBuffer& midi, int numSamples,
+                     GetSamplePosition&& getSamplePosition) noexcept
+    {
+        AllocationTrap::ScopedRealtimeSection realtimeSection;
+        juce::ScopedNoDenormals noDenormals;
+
+        buffer.clear();
+
+        // pick up the newest parameters from the GUI, placed in the block like a MIDI event
+        // arriving at the same moment
+        double changeTime;
+
+        if (auto* parameters = parameterStore.acquireChange(changeTime))
+        {
+            subBlockRenderer.addParameterChange(getSamplePosition(changeTime), *parameters);
+            effectsParameters = parameters->effects;
+            tailLengthSeconds.store((double)parameters->adsr.release);
+        }
+
+        controlState.setWavetable(wavetableSwitcher.acquire());
+
+        // synthesise the block with whichever engine is selected, splitting it wherever the
+        // parameters change and gliding towards the new values from there
+        engineSelector.renderSelected([&](bool soa)
+        {
+            if (soa)
+                subBlockRenderer.render(soaSynth, buffer, midi, numSamples);
+            else
+                subBlockRenderer.render(synth, buffer, midi, numSamples);
+        });
+
+        // the effects run on the whole mix, either here or a block behind on their own thread
+        effectsBus.process(buffer, numSamples, effectsParameters);
+    }
+
+    //==============================================================================
+    void getStateInformation(juce::MemoryBlock& destData) override
+    {
+        if (auto xml = SynthParameterState::save(parameterStore.getSnapshot()))
+            copyXmlToBinary(*xml, destData);
+    }
+
+    void setStateInformation(const void* data, int sizeInBytes) override
+    {
+        auto xml = getXmlFromBinary(data, sizeInBytes);
+        SynthParameters loaded;
+
+        if (xml != nullptr && SynthParameterState::restore(*xml, loaded))
+        {
+            parameterStore.update([&loaded](SynthParameters& p) { p = loaded; });
+            tailLengthSeconds.store((double)loaded.adsr.release);
+        }
+    }
+
+    //==============================================================================
+    SynthParameterStore& getParameterStore() noexcept           { return parameterStore; }
+    PolySynthesiser& getSynth() noexcept                        { return synth; }
+    EffectsBus& getEffectsBus() noexcept                        { return effectsBus; }
+    WavetableSwitcher& getWavetableSwitcher() noexcept          { return wavetableSwitcher; }
+
+    /** Switches to the structure-of-arrays voice engine, or back. Call this from any thread
+        except the audio thread: the engine being left is silenced here, as that can free
+        memory.
+    */
+    void setSoAEngineEnabled(bool shouldBeEnabled)
+    {
+        engineSelector.select(shouldBeEnabled, [this](bool soaEngineWasLeft)
+        {
+            soaEngineWasLeft ? soaSynth.turnOffAllVoices() : synth.turnOffAllVoices(false);
+        });
+    }
+
+private:
+    //==============================================================================
+    SynthParameterStore parameterStore;
+    SynthParameterSmoother parameterSmoother;
+    SharedControlState controlState;
+    SubBlockRenderer subBlockRenderer { parameterSmoother, controlState };
+
+    PolySynthesiser synth;
+    SoAVoiceEngine soaSynth { controlState };
+    VoiceEngineSelector engineSelector;
+
+    EffectsParameters effectsParameters;
+    EffectsBus effectsBus;
+    std::atomic<double> tailLengthSeconds { (double)SynthParameters().adsr.release };
+    WavetableSwitcher wavetableSwitcher;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SynthAudioProcessor)
+};
@@ -17,8 +17,8 @@
 class NoteComponent : public juce::Component
 {
 public:
-    NoteComponent(const juce::MPENote& n)
-        : note(n), colour(juce::Colours::white)
+    NoteComponent()
+        : colour(juce::Colours::white)
     {}
 
     //==============================================================================
@@ -52,6 +52,7 @@ public:
     juce::MPENote note;
     juce::Colour colour;
     juce::Point<float> centre;
+    bool isActive = false, needsUpdate = false;
 
 private:
     //==============================================================================
@@ -110,43 +111,56 @@ private:
 };
 
 //==============================================================================
+/** Shows the notes being played as circles over a keyboard.
+
+    The keyboard is drawn once into an image whenever the size changes. Note
+    components are kept in a pool and reused, and found by MPE note ID in a hash map,
+    so a note change costs the same however many notes are down. Changes are only
+    collected as they come in; the components are moved at most maxFrameRateHz times
+    a second, and the timer stops when nothing is moving.
+
+    The listener callbacks are expected on the message thread (MainComponent feeds
+    its MPEInstrument from a timer), so nothing here needs a lock.
+*/
 class Visualiser : public juce::Component,
     public juce::MPEInstrument::Listener,
-    private juce::AsyncUpdater
+    private juce::Timer
 {
 public:
     //==============================================================================
-    Visualiser() {}
+    Visualiser()
+    {
+        setOpaque(true);
+    }
 
     //==============================================================================
     void paint(juce::Graphics& g) override
     {
-        g.fillAll(juce::Colours::black);
-
-        auto noteDistance = float(getWidth()) / 128;
+        g.drawImageAt(keyboardImage, 0, 0);
+    }
 
-        for (auto i = 0; i < 128; ++i)
-        {
-            auto x = noteDistance * (float)i;
-            auto noteHeight = int(juce::MidiMessage::isMidiNoteBlack(i) ? 0.7 * getHeight() : getHeight());
-            g.setColour(juce::MidiMessage::isMidiNoteBlack(i) ? juce::Colours::white : juce::Colours::grey);
-            g.drawLine(x, 0.0f, x, (float)noteHeight);
+    void resized() override
+    {
+        drawKeyboardImage();
 
-            if (i > 0 && i % 12 == 0)
-            {
-                g.setColour(juce::Colours::grey);
-                auto octaveNumber = (i / 12) - 2;
-                g.drawText("C" + juce::String(octaveNumber), (int)x - 15, getHeight() - 30, 30, 30, juce::Justification::centredBottom);
-            }
-        }
+        for (auto* noteComp : noteComponents)
+            if (noteComp->isActive)
+                markChanged(noteComp);
     }
 
     //==============================================================================
     void noteAdded(juce::MPENote newNote) override
     {
-        const juce::ScopedLock sl(lock);
-        activeNotes.add(newNote);
-        triggerAsyncUpdate();
+        JUCE_ASSERT_MESSAGE_THREAD
+
+        if (auto* oldComp = notesByID[newNote.noteID])
+            releaseNoteComponent(oldComp);
+
+        auto* noteComp = getFreeNoteComponent();
+        noteComp->note = newNote;
+        noteComp->isActive = true;
+        notesByID.set(newNote.noteID, noteComp);
+        markChanged(noteComp);
     }
 
     void notePressureChanged(juce::MPENote note) override { noteChanged(note); }
@@ -156,66 +170,109 @@ public:
 
     void noteChanged(juce::MPENote changedNote)
     {
-        const juce::ScopedLock sl(lock);
-
-        for (auto& note : activeNotes)
-            if (note.noteID == changedNote.noteID)
-                note = changedNote;
+        JUCE_ASSERT_MESSAGE_THREAD
 
-        triggerAsyncUpdate();
+        if (auto* noteComp = notesByID[changedNote.noteID])
+        {
+            noteComp->note = changedNote;
+            markChanged(noteComp);
+        }
     }
 
     void noteReleased(juce::MPENote finishedNote) override
     {
-        const juce::ScopedLock sl(lock);
+        JUCE_ASSERT_MESSAGE_THREAD
 
-        for (auto i = activeNotes.size(); --i >= 0;)
-            if (activeNotes.getReference(i).noteID == finishedNote.noteID)
-                activeNotes.remove(i);
-
-        triggerAsyncUpdate();
+        if (auto* noteComp = notesByID[finishedNote.noteID])
+            releaseNoteComponent(noteComp);
     }
 
 
 private:
     //==============================================================================
-    const juce::MPENote* findActiveNote(int noteID) const noexcept
+    NoteComponent* getFreeNoteComponent()
     {
-        for (auto& note : activeNotes)
-            if (note.noteID == noteID)
-                return &note;
+        if (freeNoteComponents.isEmpty())
+        {
+            auto* noteComp = noteComponents.add(new NoteComponent());
+            addChildComponent(noteComp);
+            return noteComp;
+        }
+
+        auto* noteComp = freeNoteComponents.getLast();
+        freeNoteComponents.removeLast();
+        return noteComp;
+    }
 
-        return nullptr;
+    void releaseNoteComponent(NoteComponent* noteComp)
+    {
+        notesByID.remove(noteComp->note.noteID);
+        noteComp->isActive = false;
+        noteComp->setVisible(false);
+        freeNoteComponents.add(noteComp);
     }
 
-    NoteComponent* findNoteComponent(int noteID) const noexcept
+    void markChanged(NoteComponent* noteComp)
     {
-        for (auto& noteComp : noteComponents)
-            if (noteComp->note.noteID == noteID)
-                return noteComp;
+        if (! noteComp->needsUpdate)
+        {
+            noteComp->needsUpdate = true;
+            changedNotes.add(noteComp);
+        }
 
-        return nullptr;
+        if (! isTimerRunning())
+            startTimerHz(maxFrameRateHz);
     }
 
     //==============================================================================
-    void handleAsyncUpdate() override
+    void timerCallback() override
     {
-        const juce::ScopedLock sl(lock);
+        if (changedNotes.isEmpty())
+        {
+            stopTimer();
+            return;
+        }
 
-        for (auto i = noteComponents.size(); --i >= 0;)
-            if (findActiveNote(noteComponents.getUnchecked(i)->note.noteID) == nullptr)
-                noteComponents.remove(i);
+        for (auto* noteComp : changedNotes)
+        {
+            noteComp->needsUpdate = false;
 
-        for (auto& note : activeNotes)
-            if (findNoteComponent(note.noteID) == nullptr)
-                addAndMakeVisible(noteComponents.add(new NoteComponent(note)));
+            if (noteComp->isActive)
+            {
+                noteComp->update(noteComp->note, getCentrePositionForNote(noteComp->note));
+                noteComp->setVisible(true);
+            }
+        }
 
-        for (auto& noteComp : noteComponents)
-            if (auto* noteInfo = findActiveNote(noteComp->note.noteID))
-                noteComp->update(*noteInfo, getCentrePositionForNote(*noteInfo));
+        changedNotes.clearQuick();
     }
 
     //==============================================================================
+    void drawKeyboardImage()
+    {
+        keyboardImage = juce::Image(juce::Image::RGB, juce::jmax(1, getWidth()), juce::jmax(1, getHeight()), true);
+        juce::Graphics g(keyboardImage);
+
+        g.fillAll(juce::Colours::black);
+
+        auto noteDistance = float(getWidth()) / 128;
+
+        for (auto i = 0; i < 128; ++i)
+        {
+            auto x = noteDistance * (float)i;
+            auto noteHeight = int(juce::MidiMessage::isMidiNoteBlack(i) ? 0.7 * getHeight() : getHeight());
+            g.setColour(juce::MidiMessage::isMidiNoteBlack(i) ? juce::Colours::white : juce::Colours::grey);
+            g.drawLine(x, 0.0f, x, (float)noteHeight);
+
+            if (i > 0 && i % 12 == 0)
+            {
+                g.setColour(juce::Colours::grey);
+                auto octaveNumber = (i / 12) - 2;
+                g.drawText("C" + juce::String(octaveNumber), (int)x - 15, getHeight() - 30, 30, 30, juce::Justification::centredBottom);
+            }
+        }
+    }
+
     juce::Point<float> getCentrePositionForNote(juce::MPENote note) const
     {
         auto n = float(note.initialNote) + float(note.totalPitchbendInSemitones);
@@ -226,10 +283,13 @@ private:
     }
 
     //==============================================================================
+    static constexpr int maxFrameRateHz = 60;
+
+    juce::Image keyboardImage;
+
     juce::OwnedArray<NoteComponent> noteComponents;
-    juce::CriticalSection lock;
-    juce::Array<juce::MPENote> activeNotes;
+    juce::Array<NoteComponent*> freeNoteComponents, changedNotes;
+    juce::HashMap<int, NoteComponent*> notesByID;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(Visualiser)
 };
-
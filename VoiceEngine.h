@@ -0,0 +1,720 @@
+/*
+  ==============================================================================
+
+    VoiceEngine.h
+    An alternative to juce::MPESynthesiser + SynthVoice that keeps every voice's
+    state in structure-of-arrays form and renders SIMDFloat::size voices at once.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <thread>
+#include "Synth.h"
+
+
+//==============================================================================
+/** Renders the same oscillator -> ADSR -> filter chain as SynthVoice, but for all
+    voices together.
+
+    Playing voices are kept packed at the front of the arrays, so a block costs
+    ceil(numActiveVoices / SIMDFloat::size) passes over the lanes and never touches
+    idle voices. The spare lanes at the end of the last group hold silent voices.
+    Every group adds into one lane-wide mix, and that mix is summed and written to
+    the output once per control segment, using the shared filter coefficients and
+    wavetable morph from SharedControlState.
+
+    The modulation matrix is evaluated once per segment for a whole group of voices
+    at a time, one lane per voice. Each destination then ramps across the segment per
+    lane, except pitch, which moves a segment at a time as it does in SynthVoice. A
+    destination with nothing routed to it costs nothing, and a patch with no routes
+    skips the matrix altogether.
+
+    Notes arrive through MPESynthesiserBase on the audio thread, in the middle of
+    renderNextBlock(), so none of this needs a lock.
+*/
+class SoAVoiceEngine : public juce::MPESynthesiserBase
+{
+public:
+    static constexpr int maxVoices = 256;
+
+    //==============================================================================
+    SoAVoiceEngine(const SharedControlState& sharedControlState)
+        : controlState(sharedControlState)
+    {
+        static_assert(maxVoices % SIMDFloat::size == 0, "maxVoices must fill whole SIMD groups");
+
+        wavetables = controlState.wavetable;
+        wavetableVersion = controlState.wavetableVersion;
+        oscillatorTableSize = wavetables.numSamples - 1;
+        nextFrameOffset = wavetables.getNextFrameOffset();
+        levelStride = wavetables.getLevelStride();
+        fractionBits = 32 - juce::roundToInt(std::log2((double)oscillatorTableSize));
+
+        for (int i = 0; i < maxVoices; ++i)
+            clearSlot(i);
+    }
+
+    int getNumActiveVoices() const noexcept { return numActiveVoices; }
+
+    /** Drops every playing voice immediately. Only call this from the audio thread, or
+        while the audio thread is kept away from the engine, as VoiceEngineSelector does.
+    */
+    void turnOffAllVoices() noexcept
+    {
+        for (int i = 0; i < numActiveVoices; ++i)
+            clearSlot(i);
+
+        numActiveVoices = 0;
+    }
+
+    //==============================================================================
+    void noteAdded(juce::MPENote newNote) override
+    {
+        if (numActiveVoices == maxVoices)
+            return;
+
+        updateWavetable();
+
+        auto slot = numActiveVoices++;
+        noteIDs[slot] = newNote.noteID;
+        phases[slot] = 0;
+        pressures[slot] = newNote.pressure.asUnsignedFloat();
+        timbres[slot] = newNote.timbre.asUnsignedFloat();
+        pitchBends[slot] = newNote.pitchbend.asSignedFloat();
+        startModulation(slot);
+        setFrequency(slot, newNote);
+        filterState1[slot] = 0.0f;
+        filterState2[slot] = 0.0f;
+        envelope[slot] = 0.0f;
+        setStage(slot, attackStage);
+    }
+
+    void noteReleased(juce::MPENote finishedNote) override
+    {
+        auto slot = findSlot(finishedNote.noteID);
+
+        if (slot >= 0 && stages[slot] != releaseStage)
+        {
+            setStage(slot, releaseStage);
+            envelope2[slot].noteOff(controlState.envelope2Rates);
+        }
+    }
+
+    void notePitchbendChanged(juce::MPENote changedNote) override
+    {
+        auto slot = findSlot(changedNote.noteID);
+
+        if (slot >= 0)
+        {
+            pitchBends[slot] = changedNote.pitchbend.asSignedFloat();
+            setFrequency(slot, changedNote);
+        }
+    }
+
+    void notePressureChanged(juce::MPENote changedNote) override
+    {
+        auto slot = findSlot(changedNote.noteID);
+
+        if (slot >= 0)
+            pressures[slot] = changedNote.pressure.asUnsignedFloat();
+    }
+
+    void noteTimbreChanged(juce::MPENote changedNote) override
+    {
+        auto slot = findSlot(changedNote.noteID);
+
+        if (slot >= 0)
+            timbres[slot] = changedNote.timbre.asUnsignedFloat();
+    }
+
+    void noteKeyStateChanged(juce::MPENote) override {}
+
+    void setCurrentPlaybackSampleRate(double newRate) override
+    {
+        MPESynthesiserBase::setCurrentPlaybackSampleRate(newRate);
+        inverseSampleRate = 1.0 / newRate;
+        turnOffAllVoices();
+    }
+
+    /** The same lifecycle as PolySynthesiser. Every buffer here is a fixed size, so
+        only the sample rate matters.
+    */
+    void prepare(double sampleRate, int /*numChannels*/, int /*maximumBlockSize*/)
+    {
+        setCurrentPlaybackSampleRate(sampleRate);
+    }
+
+    void release()
+    {
+        turnOffAllVoices();
+    }
+
+private:
+    //==============================================================================
+    enum EnvelopeStage
+    {
+        attackStage,
+        decayStage,
+        sustainStage,
+        releaseStage
+    };
+
+    //==============================================================================
+    void renderNextSubBlock(juce::AudioBuffer<float>& outputBuffer, int startSample, int numSamples) override
+    {
+        if (numActiveVoices == 0)
+            return;
+
+        updateWavetable();
+
+        float mix[SharedControlState::controlInterval];
+
+        while (numSamples > 0)
+        {
+            auto numThisTime = juce::jmin(numSamples, SharedControlState::controlInterval - startSample % SharedControlState::controlInterval);
+
+            // once more after the last route goes, to take every voice back to where it was
+            auto modulated = ! controlState.modulationMatrix.isEmpty();
+
+            if (modulated || wasModulated)
+                updateModulation(startSample, numThisTime);
+
+            wasModulated = modulated;
+
+            renderSegment(mix, numThisTime, controlState.getFilterRamp(startSample),
+                          controlState.getMorphAt(startSample), controlState.getMorphAt(startSample + numThisTime));
+
+            for (auto i = outputBuffer.getNumChannels(); --i >= 0;)
+                outputBuffer.addFrom(i, startSample, mix, numThisTime);
+
+            advanceEnvelopeStages();
+
+            startSample += numThisTime;
+            numSamples -= numThisTime;
+        }
+    }
+
+    void renderSegment(float* mix, int numSamples, const FilterCoefficientRamp& coefficients,
+                       float morphStart, float morphEnd) noexcept
+    {
+        constexpr int lanes = SIMDFloat::size;
+
+        SIMDFloat mixLanes[SharedControlState::controlInterval];
+        juce::uint32 frameOffsets[SharedControlState::controlInterval];
+        float frameWeights[SharedControlState::controlInterval], morphs[SharedControlState::controlInterval];
+
+        // without morph modulation every voice is at the same position, so the frames are
+        // picked once per sample for all of them
+        auto morphStep = (morphEnd - morphStart) / (float)numSamples;
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            mixLanes[i] = SIMDFloat::expand(0.0f);
+            morphs[i] = morphStart + morphStep * (float)i;
+            wavetables.selectFrame(morphs[i], frameOffsets[i], frameWeights[i]);
+        }
+
+        auto& matrix = controlState.modulationMatrix;
+        auto perVoiceMorph = matrix.modulates(ModulationDestination::morph);
+        auto perVoiceCutoff = matrix.modulates(ModulationDestination::cutoff);
+        auto perVoiceAmplitude = matrix.modulates(ModulationDestination::amplitude);
+
+        const auto fractionMask = SIMDUInt32::expand((1u << fractionBits) - 1);
+        const auto fractionScale = SIMDFloat::expand(1.0f / (float)(1u << fractionBits));
+        const auto zero = SIMDFloat::expand(0.0f);
+        const auto one = SIMDFloat::expand(1.0f);
+        const auto half = SIMDFloat::expand(0.5f);
+        const auto perSample = SIMDFloat::expand(1.0f / (float)numSamples);
+
+        for (int first = 0; first < numActiveVoices; first += lanes)
+        {
+            auto phase = SIMDUInt32::load(phases + first);
+            auto phaseDelta = SIMDUInt32::load(phaseDeltas + first);
+            auto env = SIMDFloat::load(envelope + first);
+            auto envDelta = SIMDFloat::load(envelopeDelta + first);
+            auto envMin = SIMDFloat::load(envelopeMin + first);
+            auto envMax = SIMDFloat::load(envelopeMax + first);
+            auto upperWeight = SIMDFloat::load(upperWeights + first);
+            SIMDStateVariableFilter filter;
+            filter.ic1eq = SIMDFloat::load(filterState1 + first);
+            filter.ic2eq = SIMDFloat::load(filterState2 + first);
+
+            // the shared coefficients are the same for every voice, unless each one has its own
+            auto g = SIMDFloat::expand(coefficients.current.g), gStep = SIMDFloat::expand(coefficients.delta.g);
+            auto k = SIMDFloat::expand(coefficients.current.k), kStep = SIMDFloat::expand(coefficients.delta.k);
+
+            if (perVoiceCutoff)
+            {
+                g = SIMDFloat::load(voiceFilterG + first);
+                gStep = SIMDFloat::load(voiceFilterGStep + first);
+                k = SIMDFloat::load(voiceFilterK + first);
+                kStep = SIMDFloat::load(voiceFilterKStep + first);
+            }
+
+            auto gain = one, gainStep = zero;
+
+            if (perVoiceAmplitude)
+            {
+                auto amplitude = (int)ModulationDestination::amplitude;
+                gain = SIMDFloat::max(zero, one + SIMDFloat::load(modulationStart[amplitude] + first));
+                gainStep = (SIMDFloat::max(zero, one + SIMDFloat::load(modulationEnd[amplitude] + first)) - gain) * perSample;
+            }
+
+            alignas(32) float morphOffsets[lanes], morphOffsetSteps[lanes];
+
+            if (perVoiceMorph)
+            {
+                auto morph = (int)ModulationDestination::morph;
+                auto offset = SIMDFloat::load(modulationStart[morph] + first);
+                offset.store(morphOffsets);
+                ((SIMDFloat::load(modulationEnd[morph] + first) - offset) * perSample).store(morphOffsetSteps);
+            }
+
+            for (int i = 0; i < numSamples; ++i)
+            {
+                alignas(32) juce::uint32 indices[lanes];
+                alignas(32) float lower0[lanes], lower1[lanes], upper0[lanes], upper1[lanes];
+
+                phase.shiftRight(fractionBits).store(indices);
+
+                // each voice reads its own pair of mip levels, the upper one a whole level
+                // after the lower, and mixes the same two frames of each
+                for (int lane = 0; lane < lanes; ++lane)
+                {
+                    auto frameOffset = frameOffsets[i];
+                    auto frameWeight = frameWeights[i];
+
+                    if (perVoiceMorph)
+                        wavetables.selectFrame(morphs[i] + morphOffsets[lane] + morphOffsetSteps[lane] * (float)i, frameOffset, frameWeight);
+
+                    auto* lowerSource = wavetables.samples + tableOffsets[first + lane] + frameOffset + indices[lane];
+                    auto* upperSource = lowerSource + levelStride;
+
+                    lower0[lane] = MipmappedWavetable::mixFrames(lowerSource, nextFrameOffset, frameWeight);
+                    lower1[lane] = MipmappedWavetable::mixFrames(lowerSource + 1, nextFrameOffset, frameWeight);
+                    upper0[lane] = MipmappedWavetable::mixFrames(upperSource, nextFrameOffset, frameWeight);
+                    upper1[lane] = MipmappedWavetable::mixFrames(upperSource + 1, nextFrameOffset, frameWeight);
+                }
+
+                auto frac = (phase & fractionMask).toFloat() * fractionScale;
+                auto lowerValue0 = SIMDFloat::load(lower0);
+                auto upperValue0 = SIMDFloat::load(upper0);
+                auto lower = lowerValue0 + frac * (SIMDFloat::load(lower1) - lowerValue0);
+                auto upper = upperValue0 + frac * (SIMDFloat::load(upper1) - upperValue0);
+                auto oscillator = lower + upperWeight * (upper - lower);
+
+                env = SIMDFloat::min(SIMDFloat::max(env + envDelta, envMin), envMax);
+
+                auto out = filter.processSample(oscillator * env * gain * half, g, k, controlState.filterModeWeights);
+                g = g + gStep;
+                k = k + kStep;
+                gain = gain + gainStep;
+
+                mixLanes[i] = mixLanes[i] + out;
+                phase = phase + phaseDelta;
+            }
+
+            phase.store(phases + first);
+            env.store(envelope + first);
+            filter.snapToZero();
+            filter.ic1eq.store(filterState1 + first);
+            filter.ic2eq.store(filterState2 + first);
+        }
+
+        for (int i = 0; i < numSamples; ++i)
+            mix[i] = mixLanes[i].sum() * 0.5f;
+    }
+
+    //==============================================================================
+    /** Steps every voice's LFOs and second envelope to the end of a segment and
+        evaluates the matrix there, a group of voices at a time. Then works out what
+        doesn't vectorise: each voice's pitch, and its filter coefficients if the cutoff
+        is modulated.
+    */
+    void updateModulation(int startSample, int numSamples) noexcept
+    {
+        constexpr int lanes = SIMDFloat::size;
+        auto& matrix = controlState.modulationMatrix;
+
+        for (int first = 0; first < numActiveVoices; first += lanes)
+        {
+            SIMDFloat sources[numModulationSources];
+
+            for (int i = 0; i < ModulationParameters::numLFOs; ++i)
+            {
+                auto lfoPhase = SIMDUInt32::load(lfoPhases[i] + first)
+                                  + SIMDUInt32::expand(controlState.lfoPhaseDeltas[i] * (juce::uint32)numSamples);
+                lfoPhase.store(lfoPhases[i] + first);
+                sources[(int)ModulationSource::lfo1 + i] = ModulationLFO::getValues(controlState.lfoShapes[i], lfoPhase);
+            }
+
+            alignas(32) float envelope2Levels[lanes];
+
+            for (int lane = 0; lane < lanes; ++lane)
+                envelope2Levels[lane] = envelope2[first + lane].advance(numSamples, controlState.envelope2Rates);
+
+            sources[(int)ModulationSource::envelope2] = SIMDFloat::load(envelope2Levels);
+            sources[(int)ModulationSource::pressure] = SIMDFloat::load(pressures + first);
+            sources[(int)ModulationSource::timbre] = SIMDFloat::load(timbres + first);
+            sources[(int)ModulationSource::pitchBend] = SIMDFloat::load(pitchBends + first);
+
+            SIMDFloat destinations[numModulationDestinations];
+            matrix.evaluate(sources, destinations);
+
+            for (int i = 0; i < numModulationDestinations; ++i)
+            {
+                SIMDFloat::load(modulationEnd[i] + first).store(modulationStart[i] + first);
+                destinations[i].store(modulationEnd[i] + first);
+            }
+        }
+
+        auto perVoiceCutoff = matrix.modulates(ModulationDestination::cutoff);
+        auto* pitchOffsets = modulationEnd[(int)ModulationDestination::pitch];
+
+        for (int slot = 0; slot < numActiveVoices; ++slot)
+        {
+            if (pitchOffsets[slot] != appliedPitchOffsets[slot])
+            {
+                appliedPitchOffsets[slot] = pitchOffsets[slot];
+                updatePhaseDelta(slot);
+            }
+
+            if (perVoiceCutoff)
+            {
+                auto ramp = filterModulators[slot].getRamp(controlState, startSample,
+                                                           modulationStart[(int)ModulationDestination::cutoff][slot],
+                                                           modulationEnd[(int)ModulationDestination::cutoff][slot]);
+                voiceFilterG[slot] = ramp.current.g;
+                voiceFilterGStep[slot] = ramp.delta.g;
+                voiceFilterK[slot] = ramp.current.k;
+                voiceFilterKStep[slot] = ramp.delta.k;
+            }
+        }
+    }
+
+    /** Restarts a new voice's LFOs and envelope, and works out its modulation at the
+        start of the note.
+    */
+    void startModulation(int slot) noexcept
+    {
+        auto& matrix = controlState.modulationMatrix;
+        float sources[numModulationSources], destinations[numModulationDestinations];
+
+        for (int i = 0; i < ModulationParameters::numLFOs; ++i)
+        {
+            lfoPhases[i][slot] = 0;
+            sources[(int)ModulationSource::lfo1 + i] = ModulationLFO::getValue(controlState.lfoShapes[i], 0);
+        }
+
+        envelope2[slot].reset();
+        envelope2[slot].noteOn();
+        sources[(int)ModulationSource::envelope2] = envelope2[slot].getLevel();
+        sources[(int)ModulationSource::pressure] = pressures[slot];
+        sources[(int)ModulationSource::timbre] = timbres[slot];
+        sources[(int)ModulationSource::pitchBend] = pitchBends[slot];
+
+        matrix.evaluate(sources, destinations);
+
+        for (int i = 0; i < numModulationDestinations; ++i)
+        {
+            modulationStart[i][slot] = destinations[i];
+            modulationEnd[i][slot] = destinations[i];
+        }
+
+        appliedPitchOffsets[slot] = destinations[(int)ModulationDestination::pitch];
+        filterModulators[slot] = {};
+    }
+
+    /** Picks up a new table from SharedControlState, moving every playing voice over
+        to the same mip levels of it.
+    */
+    void updateWavetable() noexcept
+    {
+        if (wavetableVersion == controlState.wavetableVersion)
+            return;
+
+        wavetables = controlState.wavetable;
+        wavetableVersion = controlState.wavetableVersion;
+        nextFrameOffset = wavetables.getNextFrameOffset();
+        levelStride = wavetables.getLevelStride();
+
+        for (int slot = 0; slot < numActiveVoices; ++slot)
+            setLevels(slot, phaseDeltas[slot] / 4294967296.0);
+    }
+
+    //==============================================================================
+    /** Stage changes happen at segment boundaries; in between, the clamp in renderSegment()
+        holds each envelope at its stage's target.
+    */
+    void advanceEnvelopeStages() noexcept
+    {
+        auto& parameters = controlState.adsrParameters;
+
+        for (auto slot = numActiveVoices; --slot >= 0;)
+        {
+            switch (stages[slot])
+            {
+                case attackStage:   if (envelope[slot] >= 1.0f) setStage(slot, decayStage); break;
+                case decayStage:    if (envelope[slot] <= parameters.sustain) setStage(slot, sustainStage); break;
+                case sustainStage:  setStage(slot, sustainStage); break;
+                case releaseStage:  if (envelope[slot] <= 0.0f) removeSlot(slot); break;
+                default:            break;
+            }
+        }
+    }
+
+    /** Mirrors juce::ADSR: linear segments, with a zero time jumping straight to the target. */
+    void setStage(int slot, EnvelopeStage newStage) noexcept
+    {
+        auto& parameters = controlState.adsrParameters;
+        auto rate = (float)getSampleRate();
+        stages[slot] = newStage;
+
+        switch (newStage)
+        {
+            case attackStage:
+                if (parameters.attack > 0.0f)
+                {
+                    setEnvelopeSegment(slot, 1.0f / (parameters.attack * rate), 0.0f, 1.0f);
+                    return;
+                }
+
+                envelope[slot] = 1.0f;
+                setStage(slot, decayStage);
+                return;
+
+            case decayStage:
+                if (parameters.decay > 0.0f)
+                {
+                    setEnvelopeSegment(slot, -(1.0f - parameters.sustain) / (parameters.decay * rate), parameters.sustain, 1.0f);
+                    return;
+                }
+
+                envelope[slot] = parameters.sustain;
+                setStage(slot, sustainStage);
+                return;
+
+            case sustainStage:
+                setEnvelopeSegment(slot, 0.0f, parameters.sustain, parameters.sustain);
+                return;
+
+            case releaseStage:
+                if (parameters.release > 0.0f)
+                    setEnvelopeSegment(slot, -envelope[slot] / (parameters.release * rate), 0.0f, envelope[slot]);
+                else
+                    setEnvelopeSegment(slot, -1.0f, 0.0f, 0.0f);
+
+                return;
+
+            default:
+                return;
+        }
+    }
+
+    void setEnvelopeSegment(int slot, float delta, float minimum, float maximum) noexcept
+    {
+        envelopeDelta[slot] = delta;
+        envelopeMin[slot] = minimum;
+        envelopeMax[slot] = maximum;
+    }
+
+    void setFrequency(int slot, const juce::MPENote& note) noexcept
+    {
+        baseCyclesPerSample[slot] = note.getFrequencyInHertz() * inverseSampleRate;
+        updatePhaseDelta(slot);
+    }
+
+    /** The note's own frequency, moved by however far the matrix has taken its pitch. */
+    void updatePhaseDelta(int slot) noexcept
+    {
+        auto cyclesPerSample = baseCyclesPerSample[slot] * std::exp2(appliedPitchOffsets[slot] * (1.0 / 12.0));
+        phaseDeltas[slot] = (juce::uint32)juce::jlimit(0.0, 4294967295.0, cyclesPerSample * 4294967296.0);
+        setLevels(slot, cyclesPerSample);
+    }
+
+    void setLevels(int slot, double cyclesPerSample) noexcept
+    {
+        int lowerLevel;
+        wavetables.selectLevels(cyclesPerSample, lowerLevel, upperWeights[slot]);
+        tableOffsets[slot] = (juce::uint32)(lowerLevel * levelStride);
+    }
+
+    int findSlot(juce::uint16 noteID) const noexcept
+    {
+        for (int i = 0; i < numActiveVoices; ++i)
+            if (noteIDs[i] == noteID)
+                return i;
+
+        return -1;
+    }
+
+    /** Keeps the playing voices packed by moving the last one into the hole. */
+    void removeSlot(int slot) noexcept
+    {
+        auto last = --numActiveVoices;
+
+        noteIDs[slot]       = noteIDs[last];
+        stages[slot]        = stages[last];
+        phases[slot]        = phases[last];
+        phaseDeltas[slot]   = phaseDeltas[last];
+        tableOffsets[slot]  = tableOffsets[last];
+        upperWeights[slot]  = upperWeights[last];
+        envelope[slot]      = envelope[last];
+        envelopeDelta[slot] = envelopeDelta[last];
+        envelopeMin[slot]   = envelopeMin[last];
+        envelopeMax[slot]   = envelopeMax[last];
+        filterState1[slot]  = filterState1[last];
+        filterState2[slot]  = filterState2[last];
+
+        pressures[slot]           = pressures[last];
+        timbres[slot]             = timbres[last];
+        pitchBends[slot]          = pitchBends[last];
+        baseCyclesPerSample[slot] = baseCyclesPerSample[last];
+        appliedPitchOffsets[slot] = appliedPitchOffsets[last];
+        envelope2[slot]           = envelope2[last];
+        filterModulators[slot]    = filterModulators[last];
+
+        for (int i = 0; i < ModulationParameters::numLFOs; ++i)
+            lfoPhases[i][slot] = lfoPhases[i][last];
+
+        for (int i = 0; i < numModulationDestinations; ++i)
+        {
+            modulationStart[i][slot] = modulationStart[i][last];
+            modulationEnd[i][slot] = modulationEnd[i][last];
+        }
+
+        clearSlot(last);
+    }
+
+    void clearSlot(int slot) noexcept
+    {
+        noteIDs[slot] = 0;
+        stages[slot] = releaseStage;
+        phases[slot] = 0;
+        phaseDeltas[slot] = 0;
+        tableOffsets[slot] = 0;
+        upperWeights[slot] = 0.0f;
+        envelope[slot] = 0.0f;
+        setEnvelopeSegment(slot, 0.0f, 0.0f, 0.0f);
+        filterState1[slot] = 0.0f;
+        filterState2[slot] = 0.0f;
+
+        pressures[slot] = 0.0f;
+        timbres[slot] = 0.0f;
+        pitchBends[slot] = 0.0f;
+        baseCyclesPerSample[slot] = 0.0;
+        appliedPitchOffsets[slot] = 0.0f;
+        envelope2[slot].reset();
+        filterModulators[slot] = {};
+        voiceFilterG[slot] = FilterCoefficients().g;
+        voiceFilterK[slot] = FilterCoefficients().k;
+        voiceFilterGStep[slot] = 0.0f;
+        voiceFilterKStep[slot] = 0.0f;
+
+        for (int i = 0; i < ModulationParameters::numLFOs; ++i)
+            lfoPhases[i][slot] = 0;
+
+        for (int i = 0; i < numModulationDestinations; ++i)
+        {
+            modulationStart[i][slot] = 0.0f;
+            modulationEnd[i][slot] = 0.0f;
+        }
+    }
+
+    //==============================================================================
+    const SharedControlState& controlState;
+
+    MipmappedWavetable wavetables;
+    juce::uint32 oscillatorTableSize = 0, nextFrameOffset = 0;
+    size_t levelStride = 0;
+    int fractionBits = 0, wavetableVersion = 0;
+
+    int numActiveVoices = 0;
+    double inverseSampleRate = 0.0;
+    bool wasModulated = false;
+
+    juce::uint16 noteIDs[maxVoices];
+    EnvelopeStage stages[maxVoices];
+
+    juce::uint32 phases[maxVoices];
+    juce::uint32 phaseDeltas[maxVoices];
+    juce::uint32 tableOffsets[maxVoices];
+    float upperWeights[maxVoices];
+    float envelope[maxVoices];
+    float envelopeDelta[maxVoices];
+    float envelopeMin[maxVoices];
+    float envelopeMax[maxVoices];
+    float filterState1[maxVoices];
+    float filterState2[maxVoices];
+
+    // the modulation sources and the matrix's output, at the start and end of the segment
+    float pressures[maxVoices];
+    float timbres[maxVoices];
+    float pitchBends[maxVoices];
+    juce::uint32 lfoPhases[ModulationParameters::numLFOs][maxVoices];
+    ControlRateEnvelope envelope2[maxVoices];
+    float modulationStart[numModulationDestinations][maxVoices];
+    float modulationEnd[numModulationDestinations][maxVoices];
+
+    double baseCyclesPerSample[maxVoices];
+    float appliedPitchOffsets[maxVoices];
+    VoiceFilterModulator filterModulators[maxVoices];
+    float voiceFilterG[maxVoices], voiceFilterGStep[maxVoices];
+    float voiceFilterK[maxVoices], voiceFilterKStep[maxVoices];
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SoAVoiceEngine)
+};
+
+//==============================================================================
+/** Picks which of the two voice engines the audio thread renders.
+
+    The engine being left can still be holding notes, and silencing a
+    juce::MPESynthesiser releases its MPEInstrument's notes, which frees their
+    storage. So select() does that on the calling thread instead, once the audio
+    thread has moved on to the other engine, and the callback itself never does
+    more than read a flag.
+*/
+class VoiceEngineSelector
+{
+public:
+    //==============================================================================
+    /** Calls render(useSoAEngine) with the engine to use for this block. Audio thread only. */
+    template <typename Render>
+    void renderSelected(Render&& render) noexcept
+    {
+        // set before reading the choice, so select() can't miss a block that started
+        // on the old engine
+        engineInUse.store(true);
+        render(soaEngineSelected.load());
+        engineInUse.store(false);
+    }
+
+    /** Switches engines, then calls silence(soaEngineWasLeft) on this thread once the
+        audio thread has stopped rendering the one that was left. Call it from any
+        thread except the audio thread.
+    */
+    template <typename Silence>
+    void select(bool useSoAEngine, Silence&& silence)
+    {
+        const juce::ScopedLock sl(selectLock);
+
+        if (soaEngineSelected.load() == useSoAEngine)
+            return;
+
+        soaEngineSelected.store(useSoAEngine);
+
+        while (engineInUse.load())
+            std::this_thread::yield();
+
+        silence(! useSoAEngine);
+    }
+
+    bool isSoAEngineSelected() const noexcept    { return soaEngineSelected.load(); }
+
+private:
+    //==============================================================================
+    juce::CriticalSection selectLock;
+    std::atomic<bool> soaEngineSelected { false }, engineInUse { false };
+};
@@ -0,0 +1,385 @@
+/*
+  ==============================================================================
+
+    VoicePool.h
+    Constant-time voice allocation and stealing for PolySynthesiser, built on
+    intrusive lists threaded through the voices themselves.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+
+//==============================================================================
+enum class VoiceStealingPolicy
+{
+    oldest,     // the note that started longest ago, preferring ones already released
+    quietest,   // the voice with the lowest level at the end of the last sub-block
+    sameNote    // a voice already playing the same note number, or else the oldest
+};
+
+//==============================================================================
+/** How many voices are in each state, as of the last rendered sub-block. Sleeping
+    voices are the free ones, which the synth doesn't touch at all.
+*/
+struct VoiceCounts
+{
+    int active = 0, releasing = 0, sleeping = 0;
+};
+
+//==============================================================================
+/** A voice that can live in a VoicePool.
+
+    The list links live in the voice, so moving a voice between the pool's lists
+    never allocates and never searches.
+*/
+class PooledVoice : public juce::MPESynthesiserVoice
+{
+public:
+    /** Roughly how loud the voice is right now, for finding the quietest one. */
+    virtual float getCurrentLevel() const noexcept = 0;
+
+    /** Fades the voice out over a few milliseconds and then clears its note. A stolen
+        voice does this while the new note starts on a spare voice.
+    */
+    virtual void startFastRelease() noexcept = 0;
+
+    /** Passes a changed note on; MPESynthesiser can only do this for itself. */
+    void setCurrentlyPlayingNote(const juce::MPENote& note) noexcept    { currentlyPlayingNote = note; }
+
+private:
+    friend class VoicePool;
+    template <PooledVoice* PooledVoice::*, PooledVoice* PooledVoice::*> friend struct IntrusiveVoiceList;
+
+    PooledVoice* previous = nullptr;
+    PooledVoice* next = nullptr;
+    PooledVoice* previousWithNote = nullptr;
+    PooledVoice* nextWithNote = nullptr;
+    int list = -1, noteNumber = -1;
+};
+
+//==============================================================================
+/** A doubly linked list through one pair of link members of PooledVoice. */
+template <PooledVoice* PooledVoice::*previousLink, PooledVoice* PooledVoice::*nextLink>
+struct IntrusiveVoiceList
+{
+    PooledVoice* head = nullptr;
+    PooledVoice* tail = nullptr;
+    int size = 0;
+
+    void append(PooledVoice* voice) noexcept
+    {
+        voice->*previousLink = tail;
+        voice->*nextLink = nullptr;
+
+        if (tail != nullptr)
+            tail->*nextLink = voice;
+        else
+            head = voice;
+
+        tail = voice;
+        ++size;
+    }
+
+    void remove(PooledVoice* voice) noexcept
+    {
+        auto* before = voice->*previousLink;
+        auto* after = voice->*nextLink;
+
+        (before != nullptr ? before->*nextLink : head) = after;
+        (after != nullptr ? after->*previousLink : tail) = before;
+
+        voice->*previousLink = nullptr;
+        voice->*nextLink = nullptr;
+        --size;
+    }
+
+    void clear() noexcept
+    {
+        head = tail = nullptr;
+        size = 0;
+    }
+};
+
+//==============================================================================
+/** Keeps track of which voices are free, held, released or fading out after being
+    stolen, and picks voices for new notes.
+
+    Every voice is in exactly one of those lists, each in the order the voices joined
+    it, so the oldest held or released voice is always at the head. Held and released
+    voices are also filed by note number, and by MPE note ID so that expression
+    changes and note-offs find their voice directly. Starting, stealing and releasing
+    a note therefore costs the same however many voices there are. The quietest voice
+    is worked out during the sweep that follows each rendered sub-block, which touches
+    every playing voice anyway.
+
+    The polyphony limits how many voices can be held or released at once, and can be
+    changed at any time without allocating, up to the number of voices added. Voices
+    beyond the polyphony are spares: a stolen voice fades out on its own while the new
+    note starts on a spare, which avoids the click of cutting it off. If there is no
+    spare, the stolen voice is restarted straight away instead.
+
+    Apart from addVoice(), clear(), setPolyphony() and setStealingPolicy(), everything
+    here is for the audio thread, with the synth's voice lock held.
+*/
+class VoicePool
+{
+public:
+    //==============================================================================
+    VoicePool()
+    {
+        std::fill(std::begin(voicesByNoteID), std::end(voicesByNoteID), nullptr);
+    }
+
+    /** Takes a voice the synth already owns. Message thread, with the voice lock held. */
+    void addVoice(PooledVoice* voice)
+    {
+        voice->list = freeList;
+        lists[freeList].append(voice);
+        ++numVoices;
+        voicesToRender.ensureStorageAllocated(numVoices);
+    }
+
+    /** Forgets every voice. Message thread, with the voice lock held. */
+    void clear() noexcept
+    {
+        for (auto& list : lists)
+            list.clear();
+
+        for (auto& list : voicesWithNote)
+            list.clear();
+
+        std::fill(std::begin(voicesByNoteID), std::end(voicesByNoteID), nullptr);
+        voicesToRender.clearQuick();
+        quietestVoice = nullptr;
+        numVoices = 0;
+    }
+
+    int getNumVoices() const noexcept       { return numVoices; }
+    int getNumVoicesInUse() const noexcept  { return lists[heldList].size + lists[releasedList].size; }
+
+    /** Safe to call from any thread. */
+    VoiceCounts getVoiceCounts() const noexcept
+    {
+        return { numActive.load(std::memory_order_relaxed),
+                 numReleasing.load(std::memory_order_relaxed),
+                 numSleeping.load(std::memory_order_relaxed) };
+    }
+
+    //==============================================================================
+    void setPolyphony(int newPolyphony) noexcept                    { polyphony.store(juce::jmax(1, newPolyphony)); }
+    int getPolyphony() const noexcept                               { return juce::jmin(polyphony.load(), numVoices); }
+
+    void setStealingPolicy(VoiceStealingPolicy newPolicy) noexcept  { stealingPolicy.store(newPolicy); }
+    VoiceStealingPolicy getStealingPolicy() const noexcept          { return stealingPolicy.load(); }
+
+    //==============================================================================
+    /** A free voice for a new note, or nullptr if the polyphony is used up. */
+    PooledVoice* findFreeVoice() const noexcept
+    {
+        return getNumVoicesInUse() < getPolyphony() ? lists[freeList].head : nullptr;
+    }
+
+    /** A free voice beyond the polyphony, to take over from a stolen one. */
+    PooledVoice* findSpareVoice() const noexcept    { return lists[freeList].head; }
+
+    /** The voice the stealing policy would give up for noteToPlay. */
+    PooledVoice* findVoiceToSteal(const juce::MPENote& noteToPlay) const noexcept
+    {
+        switch (getStealingPolicy())
+        {
+            case VoiceStealingPolicy::quietest:
+                if (quietestVoice != nullptr && isInUse(quietestVoice))
+                    return quietestVoice;
+
+                break;
+
+            case VoiceStealingPolicy::sameNote:
+                if (auto* voice = voicesWithNote[noteToPlay.initialNote & 127].head)
+                    return voice;
+
+                break;
+
+            case VoiceStealingPolicy::oldest:
+            default:
+                break;
+        }
+
+        return findOldestVoice();
+    }
+
+    /** The voice playing note, found by its MPE note ID. */
+    PooledVoice* findVoice(const juce::MPENote& note) const noexcept
+    {
+        auto* voice = voicesByNoteID[note.noteID & noteIDMask];
+        return voice != nullptr && voice->isCurrentlyPlayingNote(note) ? voice : nullptr;
+    }
+
+    //==============================================================================
+    /** Call after the synth has started note on voice. The voice can come from any list. */
+    void voiceStarted(PooledVoice* voice, const juce::MPENote& note) noexcept
+    {
+        unlink(voice);
+
+        voice->list = heldList;
+        lists[heldList].append(voice);
+
+        voice->noteNumber = note.initialNote & 127;
+        voicesWithNote[voice->noteNumber].append(voice);
+        voicesByNoteID[note.noteID & noteIDMask] = voice;
+    }
+
+    /** Call after the synth has stopped the note on voice, letting it tail off. */
+    void voiceReleased(PooledVoice* voice) noexcept
+    {
+        if (voice->list != heldList)
+            return;
+
+        forgetNoteID(voice);
+        lists[heldList].remove(voice);
+        voice->list = releasedList;
+        lists[releasedList].append(voice);
+    }
+
+    /** Fades voice out and stops counting it against the polyphony. */
+    void fastRelease(PooledVoice* voice) noexcept
+    {
+        unlink(voice);
+
+        voice->list = fastReleaseList;
+        lists[fastReleaseList].append(voice);
+        voice->startFastRelease();
+    }
+
+    /** Fades out the oldest voices until no more than the polyphony are in use. */
+    void enforcePolyphony() noexcept
+    {
+        for (auto limit = getPolyphony(); getNumVoicesInUse() > limit;)
+            fastRelease(findOldestVoice());
+    }
+
+    //==============================================================================
+    /** Every voice that needs rendering, gathered without allocating. */
+    const juce::Array<juce::MPESynthesiserVoice*>& getVoicesToRender() noexcept
+    {
+        voicesToRender.clearQuick();
+
+        for (auto list : { heldList, releasedList, fastReleaseList })
+            for (auto* voice = lists[list].head; voice != nullptr; voice = voice->next)
+                voicesToRender.add(voice);
+
+        return voicesToRender;
+    }
+
+    /** Returns voices that have finished to the free list, moves held voices whose key
+        was let go behind the synth's back to the released list, and finds the quietest
+        voice. Call after each rendered sub-block.
+    */
+    void reclaimFinishedVoices() noexcept
+    {
+        quietestVoice = nullptr;
+        auto quietestLevel = std::numeric_limits<float>::max();
+
+        for (auto list : { heldList, releasedList, fastReleaseList })
+        {
+            for (auto* voice = lists[list].head; voice != nullptr;)
+            {
+                auto* next = voice->next;
+
+                if (! voice->isActive())
+                {
+                    unlink(voice);
+                    voice->list = freeList;
+                    lists[freeList].append(voice);
+                }
+                else if (list != fastReleaseList)
+                {
+                    if (list == heldList && voice->isPlayingButReleased())
+                        voiceReleased(voice);
+
+                    auto level = voice->getCurrentLevel();
+
+                    if (level < quietestLevel)
+                    {
+                        quietestLevel = level;
+                        quietestVoice = voice;
+                    }
+                }
+
+                voice = next;
+            }
+        }
+
+        numActive.store(lists[heldList].size, std::memory_order_relaxed);
+        numReleasing.store(lists[releasedList].size + lists[fastReleaseList].size, std::memory_order_relaxed);
+        numSleeping.store(lists[freeList].size, std::memory_order_relaxed);
+    }
+
+private:
+    //==============================================================================
+    enum ListIndex { freeList, heldList, releasedList, fastReleaseList, numLists };
+
+    using VoiceList = IntrusiveVoiceList<&PooledVoice::previous, &PooledVoice::next>;
+    using NoteList  = IntrusiveVoiceList<&PooledVoice::previousWithNote, &PooledVoice::nextWithNote>;
+
+    // MPENote IDs are (channel << 7) + note number, so they all fit below this
+    static constexpr int noteIDMask = (1 << 12) - 1;
+
+    bool isInUse(const PooledVoice* voice) const noexcept
+    {
+        return voice->list == heldList || voice->list == releasedList;
+    }
+
+    PooledVoice* findOldestVoice() const noexcept
+    {
+        return lists[releasedList].head != nullptr ? lists[releasedList].head
+                                                   : lists[heldList].head;
+    }
+
+    void forgetNoteID(PooledVoice* voice) noexcept
+    {
+        auto& entry = voicesByNoteID[voice->getCurrentlyPlayingNote().noteID & noteIDMask];
+
+        if (entry == voice)
+            entry = nullptr;
+    }
+
+    /** Takes voice out of whichever lists it's in. */
+    void unlink(PooledVoice* voice) noexcept
+    {
+        if (voice->list < 0)
+            return;
+
+        if (voice->noteNumber >= 0)
+        {
+            voicesWithNote[voice->noteNumber].remove(voice);
+            voice->noteNumber = -1;
+        }
+
+        forgetNoteID(voice);
+
+        if (voice == quietestVoice)
+            quietestVoice = nullptr;
+
+        lists[voice->list].remove(voice);
+        voice->list = -1;
+    }
+
+    //==============================================================================
+    VoiceList lists[numLists];
+    NoteList voicesWithNote[128];
+    PooledVoice* voicesByNoteID[noteIDMask + 1];
+    PooledVoice* quietestVoice = nullptr;
+
+    juce::Array<juce::MPESynthesiserVoice*> voicesToRender;
+    int numVoices = 0;
+
+    std::atomic<int> numActive { 0 }, numReleasing { 0 }, numSleeping { 0 };
+    std::atomic<int> polyphony { std::numeric_limits<int>::max() };
+    std::atomic<VoiceStealingPolicy> stealingPolicy { VoiceStealingPolicy::oldest };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(VoicePool)
+};
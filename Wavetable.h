@@ -0,0 +1,653 @@
+/*
+  ==============================================================================
+
+    Wavetable.h
+    Shared, read-only wavetable data and the oscillator that reads it.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "FFT.h"
+#include "SIMD.h"
+
+
+//Global Wavetable Variables
+const unsigned int tableSize = 1 << 11, totalTableSize = tableSize + 1;
+const unsigned int cacheLineSize = 64;
+
+// the built-in table sweeps saw -> square -> narrow pulse across this many frames
+const int numMasterFrames = 64;
+
+// each level halves the harmonics of the one before, down to a single sine
+const int numMipLevels = 11;
+
+//==============================================================================
+/** A wavetable of numFrames single-cycle frames, band-limited numLevels times, one
+    level per octave.
+
+    Everything is in one contiguous block, level by level and then frame by frame, so
+    neighbouring frames of a level sit next to each other in memory. Each frame is
+    numSamples long, including a guard sample that repeats its first one.
+
+    Level 0 holds every harmonic the table can; each level after that holds half as
+    many as the one before. Played at c cycles per sample, level L of an n-sample
+    table stays below Nyquist as long as n * c <= 2^L, so the oscillators crossfade
+    between the two levels just above log2(n * c). Neither of them aliases, and
+    between them they keep everything up to at least a quarter of the sample rate.
+
+    A morph position from 0 to 1 picks a point between the first and last frames, and
+    reading it always costs two frames, however many there are.
+*/
+struct MipmappedWavetable
+{
+    const float* samples = nullptr;
+    unsigned int numSamples = 0;    // per frame, including the guard sample at the end
+    int numFrames = 0, numLevels = 0;
+
+    size_t getLevelStride() const noexcept              { return (size_t)numFrames * numSamples; }
+    const float* getLevel(int level) const noexcept     { return samples + (size_t)level * getLevelStride(); }
+
+    /** How far it is from a sample to the same sample in the next frame. There is no
+        next frame in a single-frame table, so this is 0 and morphing does nothing.
+    */
+    unsigned int getNextFrameOffset() const noexcept    { return numFrames > 1 ? numSamples : 0; }
+
+    /** Picks the two neighbouring levels for a note, and how much of the upper one to
+        mix in. lowerLevel + 1 is always a valid level unless there is only one.
+    */
+    void selectLevels(double cyclesPerSample, int& lowerLevel, float& upperWeight) const noexcept
+    {
+        if (numLevels < 2)
+        {
+            lowerLevel = 0;
+            upperWeight = 0.0f;
+            return;
+        }
+
+        auto cycleLength = (double)(numSamples - 1);
+        auto position = std::log2(juce::jmax(1.0e-9, cyclesPerSample * cycleLength)) + 1.0;
+        position = juce::jlimit(0.0, (double)(numLevels - 1), position);
+
+        lowerLevel = juce::jmin((int)position, numLevels - 2);
+        upperWeight = (float)(position - lowerLevel);
+    }
+
+    /** Finds where a morph position falls: the offset of the frame at or below it from
+        the start of a level, and how much of the next frame to mix in.
+    */
+    forcedinline void selectFrame(float morph, unsigned int& frameOffset, float& nextWeight) const noexcept
+    {
+        auto position = juce::jlimit(0.0f, 1.0f, morph) * (float)(numFrames - 1);
+        auto frame = juce::jmin((int)position, juce::jmax(0, numFrames - 2));
+
+        frameOffset = (unsigned int)frame * numSamples;
+        nextWeight = position - (float)frame;
+    }
+
+    /** The sample at source, mixed with the same sample in the next frame. */
+    static forcedinline float mixFrames(const float* source, unsigned int nextFrameOffset, float nextWeight) noexcept
+    {
+        return source[0] + nextWeight * (source[nextFrameOffset] - source[0]);
+    }
+};
+
+//==============================================================================
+/** Writes every mip level of one frame of a MipmappedWavetable from the frame's
+    harmonics, so each level is band-limited exactly rather than filtered after the
+    fact. Level L keeps the first numHarmonics >> L of them.
+
+    harmonics[n] is the complex amplitude of harmonic n, for n from 1 to numHarmonics;
+    the frame is the sum of 2 * Re(harmonics[n] * e^(i n x)). DC is always left out.
+*/
+class MipmappedFrameWriter
+{
+public:
+    static constexpr int numHarmonics = (int)tableSize / 2;
+
+    MipmappedFrameWriter()
+        : fft((int)tableSize)
+    {
+        level.calloc(tableSize);
+    }
+
+    /** Fills harmonics[1..numHarmonics] from one cycle of cycleLength samples, which
+        must be a power of two no longer than tableSize. Harmonics that a shorter cycle
+        can't hold are zeroed.
+    */
+    void analyse(const float* cycle, int cycleLength, std::complex<float>* harmonics)
+    {
+        jassert(juce::isPowerOfTwo(cycleLength) && cycleLength <= (int)tableSize);
+
+        if (analysisFFT == nullptr || analysisFFT->getSize() != cycleLength)
+            analysisFFT.reset(new RadixTwoFFT(cycleLength));
+
+        for (int i = 0; i < cycleLength; ++i)
+            level[i] = cycle[i];
+
+        analysisFFT->perform(level, false);
+
+        auto scale = 1.0f / (float)cycleLength;
+
+        for (int harmonic = 1; harmonic <= numHarmonics; ++harmonic)
+            harmonics[harmonic] = harmonic < cycleLength / 2 ? level[harmonic] * scale : std::complex<float>();
+
+        // the Nyquist bin has no negative-frequency twin, so it only counts once
+        if (cycleLength / 2 <= numHarmonics)
+            harmonics[cycleLength / 2] = level[cycleLength / 2] * (0.5f * scale);
+    }
+
+    /** Writes frame number frame of a table with numFrames frames and numMipLevels levels. */
+    void write(const std::complex<float>* harmonics, float* tableSamples, int frame, int numFrames)
+    {
+        const int cycleLength = (int)tableSize;
+
+        for (int mipLevel = 0; mipLevel < numMipLevels; ++mipLevel)
+        {
+            auto highestHarmonic = numHarmonics >> mipLevel;
+
+            // only the positive frequencies are filled in, so twice the real part of
+            // the inverse transform is the real waveform
+            std::fill(level.get(), level.get() + cycleLength, std::complex<float>());
+
+            for (int harmonic = 1; harmonic <= highestHarmonic; ++harmonic)
+                level[harmonic] = harmonics[harmonic];
+
+            fft.perform(level, true);
+
+            auto* samples = tableSamples + ((size_t)mipLevel * (size_t)numFrames + (size_t)frame) * totalTableSize;
+
+            for (int i = 0; i < cycleLength; ++i)
+                samples[i] = 2.0f * level[i].real();
+
+            samples[cycleLength] = samples[0];
+        }
+    }
+
+private:
+    RadixTwoFFT fft;
+    std::unique_ptr<RadixTwoFFT> analysisFFT;
+    juce::HeapBlock<std::complex<float>> level;
+
+    JUCE_DECLARE_NON_COPYABLE(MipmappedFrameWriter)
+};
+
+//==============================================================================
+/** The process-wide bank of wavetables.
+
+    It's built once, the first time anything asks for it, and is then shared by every
+    voice of every synth in the process. Keep that first call on the message thread
+    (the SynthVoice constructor does this) so the audio thread never pays for it.
+*/
+class WavetableBank
+{
+public:
+    static const WavetableBank& getInstance()
+    {
+        static const WavetableBank bank;
+        return bank;
+    }
+
+    MipmappedWavetable getMasterTable() const noexcept          { return { masterTables, totalTableSize, numMasterFrames, numMipLevels }; }
+
+    /** The master table's first frame as it is written, with no band-limiting, for
+        comparisons.
+    */
+    MipmappedWavetable getNaiveMasterTable() const noexcept     { return { naiveMasterTable, totalTableSize, 1, 1 }; }
+
+private:
+    WavetableBank()
+    {
+        writeSawtoothTable(naiveMasterTable);
+
+        masterTables.malloc((size_t)numMipLevels * numMasterFrames * totalTableSize);
+        writeMasterFrames();
+    }
+
+    /** Builds every frame from its harmonics. The first half of the frames morphs a saw
+        into a square; the second half narrows the square into a 10% pulse. All of them
+        peak at about +-0.6, and none has any DC.
+    */
+    void writeMasterFrames()
+    {
+        MipmappedFrameWriter writer;
+        std::vector<std::complex<float>> harmonics(MipmappedFrameWriter::numHarmonics + 1);
+
+        for (int frame = 0; frame < numMasterFrames; ++frame)
+        {
+            auto morph = (double)frame / (double)(numMasterFrames - 1);
+            auto sawToSquare = juce::jmin(1.0, 2.0 * morph);
+            auto pulseWidth = 0.5 - 0.8 * juce::jmax(0.0, morph - 0.5);
+
+            // without its DC a pulse peaks at 2 * (1 - pulseWidth), so narrower ones are turned down
+            auto pulseGain = 0.5 / (1.0 - pulseWidth);
+
+            for (int harmonic = 1; harmonic <= MipmappedFrameWriter::numHarmonics; ++harmonic)
+            {
+                // complex Fourier coefficients of the saw 1 - x / pi and of a pulse that's
+                // +1 for the first pulseWidth of the cycle and -1 for the rest
+                auto n = (double)harmonic;
+                auto saw = std::complex<double>(0.0, -1.0 / (juce::MathConstants<double>::pi * n));
+                auto pulse = pulseGain * (1.0 - std::polar(1.0, -juce::MathConstants<double>::twoPi * n * pulseWidth))
+                                / std::complex<double>(0.0, juce::MathConstants<double>::pi * n);
+
+                harmonics[(size_t)harmonic] = std::complex<float>(0.6 * (saw + sawToSquare * (pulse - saw)));
+            }
+
+            writer.write(harmonics.data(), masterTables, frame, numMasterFrames);
+        }
+    }
+
+    /** The same saw the first frame is built from, drawn directly. */
+    static void writeSawtoothTable(float* samples)
+    {
+        for (unsigned int i = 0; i < tableSize; ++i)
+            samples[i] = 0.6f * (1.0f - 2.0f * (float)i / (float)tableSize);
+
+        samples[tableSize] = samples[0];
+    }
+
+    alignas(cacheLineSize) float naiveMasterTable[totalTableSize];
+    juce::HeapBlock<float> masterTables;
+
+    JUCE_DECLARE_NON_COPYABLE(WavetableBank)
+};
+
+//==============================================================================
+/** Reads a MipmappedWavetable with linear interpolation, crossfading between the two
+    levels that suit the current frequency and between the two frames either side of
+    the morph position.
+
+    getNextSample() is the original one-sample-at-a-time float implementation and is
+    kept as the reference. renderBlock() is the fast path: its phase is a 32-bit
+    fixed-point accumulator that wraps for free on overflow, so it never drifts, and
+    it interpolates SIMDFloat::size samples at a time.
+*/
+class WavetableOscillator
+{
+private:
+    MipmappedWavetable tables;
+    const float* lowerTable;
+    const float* upperTable;
+    int lowerLevel = 0;
+    float upperWeight = 0.0f;
+    unsigned int nextFrameOffset;
+    unsigned short int tableSize;
+    int fractionBits;
+public:
+    WavetableOscillator(MipmappedWavetable tablesToUse)
+        : tables(tablesToUse),
+          lowerTable(tables.getLevel(0)),
+          upperTable(lowerTable),
+          nextFrameOffset(tables.getNextFrameOffset()),
+          tableSize((unsigned short int)(tables.numSamples - 1)),
+          fractionBits(32 - juce::roundToInt(std::log2((double)tableSize)))
+    {
+        jassert(tables.samples != nullptr);
+        jassert(juce::isPowerOfTwo((int)tableSize));
+    }
+
+    float currentIndex = 0.0f, tableDelta = 0.0f;
+    juce::uint32 phase = 0, phaseDelta = 0;
+
+    void setFrequency(float frequency, float sampleRate)
+    {
+        auto tableSizeOverSampleRate = (float)tableSize / sampleRate;
+        tableDelta = frequency * tableSizeOverSampleRate;
+
+        // one full cycle of the table is 2^32
+        auto cyclesPerSample = (double)frequency / (double)sampleRate;
+        phaseDelta = (juce::uint32)juce::jlimit(0.0, 4294967295.0, cyclesPerSample * 4294967296.0);
+
+        tables.selectLevels(cyclesPerSample, lowerLevel, upperWeight);
+        updateLevels();
+    }
+
+    /** Switches to another table with the same frame length, keeping the phase and the
+        frequency. It can have any number of frames.
+    */
+    void setTables(MipmappedWavetable newTables) noexcept
+    {
+        jassert(newTables.samples != nullptr && newTables.numSamples == tables.numSamples);
+
+        tables = newTables;
+        nextFrameOffset = tables.getNextFrameOffset();
+        lowerLevel = juce::jmin(lowerLevel, juce::jmax(0, tables.numLevels - 2));
+        updateLevels();
+    }
+
+    void reset() noexcept
+    {
+        currentIndex = 0.0f;
+        phase = 0;
+    }
+
+    forcedinline float getNextSample(float morph) noexcept
+    {
+        unsigned int frameOffset;
+        float frameWeight;
+        tables.selectFrame(morph, frameOffset, frameWeight);
+
+        auto index0 = (unsigned int)currentIndex;
+        auto frac = currentIndex - (float)index0;
+
+        auto* lowerSource = lowerTable + frameOffset + index0;
+        auto* upperSource = upperTable + frameOffset + index0;
+        auto lower0 = MipmappedWavetable::mixFrames(lowerSource, nextFrameOffset, frameWeight);
+        auto upper0 = MipmappedWavetable::mixFrames(upperSource, nextFrameOffset, frameWeight);
+        auto lower = lower0 + frac * (MipmappedWavetable::mixFrames(lowerSource + 1, nextFrameOffset, frameWeight) - lower0);
+        auto upper = upper0 + frac * (MipmappedWavetable::mixFrames(upperSource + 1, nextFrameOffset, frameWeight) - upper0);
+
+        //interpolate
+        auto currentSample = lower + upperWeight * (upper - lower);
+
+        if ((currentIndex += tableDelta) >= (float)tableSize)
+            currentIndex -= (float)tableSize;
+        return currentSample;
+    }
+
+    /** Writes numSamples samples to dst. The morph position moves in a straight line
+        from morphStart at the first sample towards morphEnd, which it would reach at the
+        sample after the last, so consecutive blocks join up.
+    */
+    void renderBlock(float* dst, int numSamples, float morphStart = 0.0f, float morphEnd = 0.0f) noexcept
+    {
+        constexpr int lanes = SIMDFloat::size;
+
+        const auto fractionMask = SIMDUInt32::expand((1u << fractionBits) - 1);
+        const auto fractionScale = SIMDFloat::expand(1.0f / (float)(1u << fractionBits));
+        const auto blockDelta = SIMDUInt32::expand(phaseDelta * (juce::uint32)lanes);
+        const auto weight = SIMDFloat::expand(upperWeight);
+        const auto morphStep = numSamples > 0 ? (morphEnd - morphStart) / (float)numSamples : 0.0f;
+
+        auto phases = SIMDUInt32::ramp(phase, phaseDelta);
+        int i = 0;
+
+        for (; i + lanes <= numSamples; i += lanes)
+        {
+            alignas(32) juce::uint32 indices[lanes];
+            alignas(32) float lower0[lanes], lower1[lanes], upper0[lanes], upper1[lanes];
+
+            phases.shiftRight(fractionBits).store(indices);
+
+            // scalar loads rather than a gather: they're cheaper than vgather on
+            // most cores and the two frames are hot in L1 anyway
+            for (int lane = 0; lane < lanes; ++lane)
+            {
+                unsigned int frameOffset;
+                float frameWeight;
+                tables.selectFrame(morphStart + morphStep * (float)(i + lane), frameOffset, frameWeight);
+
+                auto* lowerSource = lowerTable + frameOffset + indices[lane];
+                auto* upperSource = upperTable + frameOffset + indices[lane];
+                lower0[lane] = MipmappedWavetable::mixFrames(lowerSource, nextFrameOffset, frameWeight);
+                lower1[lane] = MipmappedWavetable::mixFrames(lowerSource + 1, nextFrameOffset, frameWeight);
+                upper0[lane] = MipmappedWavetable::mixFrames(upperSource, nextFrameOffset, frameWeight);
+                upper1[lane] = MipmappedWavetable::mixFrames(upperSource + 1, nextFrameOffset, frameWeight);
+            }
+
+            auto frac = (phases & fractionMask).toFloat() * fractionScale;
+            auto lowerValue0 = SIMDFloat::load(lower0);
+            auto upperValue0 = SIMDFloat::load(upper0);
+            auto lower = lowerValue0 + frac * (SIMDFloat::load(lower1) - lowerValue0);
+            auto upper = upperValue0 + frac * (SIMDFloat::load(upper1) - upperValue0);
+
+            (lower + weight * (upper - lower)).store(dst + i);
+            phases = phases + blockDelta;
+        }
+
+        phase += phaseDelta * (juce::uint32)i;
+
+        for (; i < numSamples; ++i)
+        {
+            unsigned int frameOffset;
+            float frameWeight;
+            tables.selectFrame(morphStart + morphStep * (float)i, frameOffset, frameWeight);
+
+            auto index = phase >> fractionBits;
+            auto frac = (float)(phase & ((1u << fractionBits) - 1)) / (float)(1u << fractionBits);
+            auto* lowerSource = lowerTable + frameOffset + index;
+            auto* upperSource = upperTable + frameOffset + index;
+            auto lower0 = MipmappedWavetable::mixFrames(lowerSource, nextFrameOffset, frameWeight);
+            auto upper0 = MipmappedWavetable::mixFrames(upperSource, nextFrameOffset, frameWeight);
+            auto lower = lower0 + frac * (MipmappedWavetable::mixFrames(lowerSource + 1, nextFrameOffset, frameWeight) - lower0);
+            auto upper = upper0 + frac * (MipmappedWavetable::mixFrames(upperSource + 1, nextFrameOffset, frameWeight) - upper0);
+
+            dst[i] = lower + upperWeight * (upper - lower);
+            phase += phaseDelta;
+        }
+    }
+
+private:
+    void updateLevels() noexcept
+    {
+        lowerTable = tables.getLevel(lowerLevel);
+        upperTable = tables.getLevel(juce::jmin(lowerLevel + 1, tables.numLevels - 1));
+    }
+};
+
+//==============================================================================
+/** A stack of detuned copies of the same wavetable for one note, spread across the
+    stereo field.
+
+    Each copy is rendered a SIMD lane per sample, the same way as WavetableOscillator,
+    and the copies share everything but their phase and pan. The mip levels are picked
+    once, for the highest copy, so none of them alias, and the morph frames once per
+    sample for the whole stack. Each copy starts
+    at a random phase, so the stack doesn't start with every copy in step.
+
+    The copies are spread evenly in pitch, the outer ones detune semitones either side
+    of the note, and evenly across the stereo field, the lowest furthest left. They're
+    scaled so a stack sounds about as loud as one oscillator, and so a copy in the
+    centre comes out of both sides at full level.
+*/
+class UnisonOscillator
+{
+public:
+    static constexpr int maxVoices = 16;
+
+    UnisonOscillator(MipmappedWavetable tablesToUse)
+        : tables(tablesToUse),
+          lowerTable(tables.getLevel(0)),
+          upperTable(lowerTable),
+          nextFrameOffset(tables.getNextFrameOffset()),
+          fractionBits(32 - juce::roundToInt(std::log2((double)(tables.numSamples - 1))))
+    {
+        setUnison(1, 0.0f, 0.0f);
+    }
+
+    void setTables(MipmappedWavetable newTables) noexcept
+    {
+        jassert(newTables.samples != nullptr && newTables.numSamples == tables.numSamples);
+
+        tables = newTables;
+        nextFrameOffset = tables.getNextFrameOffset();
+        lowerLevel = juce::jmin(lowerLevel, juce::jmax(0, tables.numLevels - 2));
+        updateLevels();
+    }
+
+    /** Sets up the stack, keeping the frequency. spread goes from 0, everything in the
+        centre, to 1, the outer copies hard left and right.
+    */
+    void setUnison(int newNumVoices, float detuneInSemitones, float spread) noexcept
+    {
+        numVoices = juce::jlimit(1, maxVoices, newNumVoices);
+        auto gainScale = juce::MathConstants<float>::sqrt2 / std::sqrt((float)numVoices);
+
+        for (int i = 0; i < maxVoices; ++i)
+        {
+            if (i >= numVoices)
+            {
+                ratios[i] = 1.0f;
+                leftGains[i] = 0.0f;
+                rightGains[i] = 0.0f;
+                continue;
+            }
+
+            auto position = numVoices > 1 ? 2.0f * (float)i / (float)(numVoices - 1) - 1.0f : 0.0f;
+            auto angle = (position * spread + 1.0f) * juce::MathConstants<float>::pi * 0.25f;
+
+            ratios[i] = std::exp2(position * detuneInSemitones * (1.0f / 12.0f));
+            leftGains[i] = std::cos(angle) * gainScale;
+            rightGains[i] = std::sin(angle) * gainScale;
+        }
+
+        setCyclesPerSample(cyclesPerSample);
+    }
+
+    int getNumVoices() const noexcept    { return numVoices; }
+
+    void setFrequency(float frequency, float sampleRate) noexcept
+    {
+        setCyclesPerSample((double)frequency / (double)sampleRate);
+    }
+
+    /** Starts every copy at a random phase. */
+    void randomisePhases() noexcept
+    {
+        for (auto& phase : phases)
+            phase = (juce::uint32)random.nextInt();
+    }
+
+    void reset() noexcept
+    {
+        std::fill(std::begin(phases), std::end(phases), 0u);
+    }
+
+    /** Writes numSamples of each side of the stack. The morph position moves the same way
+        as in WavetableOscillator::renderBlock().
+    */
+    void renderBlock(float* left, float* right, int numSamples, float morphStart = 0.0f, float morphEnd = 0.0f) noexcept
+    {
+        const auto morphStep = numSamples > 0 ? (morphEnd - morphStart) / (float)numSamples : 0.0f;
+
+        std::fill(left, left + numSamples, 0.0f);
+        std::fill(right, right + numSamples, 0.0f);
+
+        for (int start = 0; start < numSamples; start += chunkSize)
+        {
+            auto numThisTime = juce::jmin(chunkSize, numSamples - start);
+
+            // the frames are picked once for the whole stack
+            unsigned int frameOffsets[chunkSize];
+            float frameWeights[chunkSize];
+
+            for (int i = 0; i < numThisTime; ++i)
+                tables.selectFrame(morphStart + morphStep * (float)(start + i), frameOffsets[i], frameWeights[i]);
+
+            for (int copy = 0; copy < numVoices; ++copy)
+                addCopy(copy, left + start, right + start, numThisTime, frameOffsets, frameWeights);
+        }
+    }
+
+private:
+    void setCyclesPerSample(double newCyclesPerSample) noexcept
+    {
+        cyclesPerSample = newCyclesPerSample;
+        auto highestRatio = 1.0f;
+
+        for (int i = 0; i < maxVoices; ++i)
+        {
+            phaseDeltas[i] = (juce::uint32)juce::jlimit(0.0, 4294967295.0, cyclesPerSample * ratios[i] * 4294967296.0);
+            highestRatio = juce::jmax(highestRatio, ratios[i]);
+        }
+
+        tables.selectLevels(cyclesPerSample * highestRatio, lowerLevel, upperWeight);
+        updateLevels();
+    }
+
+    void updateLevels() noexcept
+    {
+        lowerTable = tables.getLevel(lowerLevel);
+        upperTable = tables.getLevel(juce::jmin(lowerLevel + 1, tables.numLevels - 1));
+    }
+
+    /** Adds one copy into both sides, a SIMD lane per sample as in WavetableOscillator. */
+    void addCopy(int copy, float* left, float* right, int numSamples,
+                 const unsigned int* frameOffsets, const float* frameWeights) noexcept
+    {
+        constexpr int lanes = SIMDFloat::size;
+
+        const auto fractionMask = SIMDUInt32::expand((1u << fractionBits) - 1);
+        const auto fractionScale = SIMDFloat::expand(1.0f / (float)(1u << fractionBits));
+        const auto weight = SIMDFloat::expand(upperWeight);
+        const auto leftGain = SIMDFloat::expand(leftGains[copy]);
+        const auto rightGain = SIMDFloat::expand(rightGains[copy]);
+        auto& phase = phases[copy];
+        auto phaseDelta = phaseDeltas[copy];
+        const auto blockDelta = SIMDUInt32::expand(phaseDelta * (juce::uint32)lanes);
+
+        auto phaseRamp = SIMDUInt32::ramp(phase, phaseDelta);
+        int i = 0;
+
+        for (; i + lanes <= numSamples; i += lanes)
+        {
+            alignas(32) juce::uint32 indices[lanes];
+            alignas(32) float lower0[lanes], lower1[lanes], upper0[lanes], upper1[lanes];
+
+            phaseRamp.shiftRight(fractionBits).store(indices);
+
+            for (int lane = 0; lane < lanes; ++lane)
+            {
+                auto* lowerSource = lowerTable + frameOffsets[i + lane] + indices[lane];
+                auto* upperSource = upperTable + frameOffsets[i + lane] + indices[lane];
+                auto frameWeight = frameWeights[i + lane];
+                lower0[lane] = MipmappedWavetable::mixFrames(lowerSource, nextFrameOffset, frameWeight);
+                lower1[lane] = MipmappedWavetable::mixFrames(lowerSource + 1, nextFrameOffset, frameWeight);
+                upper0[lane] = MipmappedWavetable::mixFrames(upperSource, nextFrameOffset, frameWeight);
+                upper1[lane] = MipmappedWavetable::mixFrames(upperSource + 1, nextFrameOffset, frameWeight);
+            }
+
+            auto frac = (phaseRamp & fractionMask).toFloat() * fractionScale;
+            auto lowerValue0 = SIMDFloat::load(lower0);
+            auto upperValue0 = SIMDFloat::load(upper0);
+            auto lower = lowerValue0 + frac * (SIMDFloat::load(lower1) - lowerValue0);
+            auto upper = upperValue0 + frac * (SIMDFloat::load(upper1) - upperValue0);
+            auto value = lower + weight * (upper - lower);
+
+            (SIMDFloat::load(left + i) + value * leftGain).store(left + i);
+            (SIMDFloat::load(right + i) + value * rightGain).store(right + i);
+            phaseRamp = phaseRamp + blockDelta;
+        }
+
+        phase += phaseDelta * (juce::uint32)i;
+
+        for (; i < numSamples; ++i)
+        {
+            auto index = phase >> fractionBits;
+            auto frac = (float)(phase & ((1u << fractionBits) - 1)) / (float)(1u << fractionBits);
+            auto* lowerSource = lowerTable + frameOffsets[i] + index;
+            auto* upperSource = upperTable + frameOffsets[i] + index;
+            auto lower0 = MipmappedWavetable::mixFrames(lowerSource, nextFrameOffset, frameWeights[i]);
+            auto upper0 = MipmappedWavetable::mixFrames(upperSource, nextFrameOffset, frameWeights[i]);
+            auto lower = lower0 + frac * (MipmappedWavetable::mixFrames(lowerSource + 1, nextFrameOffset, frameWeights[i]) - lower0);
+            auto upper = upper0 + frac * (MipmappedWavetable::mixFrames(upperSource + 1, nextFrameOffset, frameWeights[i]) - upper0);
+            auto value = lower + upperWeight * (upper - lower);
+
+            left[i] += value * leftGains[copy];
+            right[i] += value * rightGains[copy];
+            phase += phaseDelta;
+        }
+    }
+
+    //==============================================================================
+    static constexpr int chunkSize = 64;
+
+    MipmappedWavetable tables;
+    const float* lowerTable;
+    const float* upperTable;
+    int lowerLevel = 0, numVoices = 1;
+    float upperWeight = 0.0f;
+    unsigned int nextFrameOffset;
+    int fractionBits;
+    double cyclesPerSample = 0.0;
+    juce::Random random;
+
+    juce::uint32 phases[maxVoices] = {};
+    juce::uint32 phaseDeltas[maxVoices] = {};
+    float leftGains[maxVoices] = {};
+    float rightGains[maxVoices] = {};
+    float ratios[maxVoices] = {};
+};
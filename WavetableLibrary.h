@@ -0,0 +1,572 @@
+/*
+  ==============================================================================
+
+    WavetableLibrary.h
+    Multi-frame wavetables imported from WAV files, decoded on a background
+    thread the first time they're played, and handed to the audio thread
+    without it ever waiting or freeing anything.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "Wavetable.h"
+
+
+//==============================================================================
+/** One imported wavetable, band-limited into every mip level.
+
+    The audio thread never holds a reference to one of these; it only reads through
+    the MipmappedWavetable view, and WavetableSwitcher keeps the object alive until
+    the audio thread has stopped using it.
+*/
+class LoadedWavetable : public juce::ReferenceCountedObject
+{
+public:
+    using Ptr = juce::ReferenceCountedObjectPtr<LoadedWavetable>;
+
+    LoadedWavetable(int libraryIndex, const juce::String& tableName, int frames)
+        : index(libraryIndex), name(tableName), numFrames(frames)
+    {
+        samples.malloc((size_t)numMipLevels * (size_t)numFrames * totalTableSize);
+    }
+
+    MipmappedWavetable getTable() const noexcept        { return { samples, totalTableSize, numFrames, numMipLevels }; }
+    size_t getSizeInBytes() const noexcept              { return sizeof(float) * (size_t)numMipLevels * (size_t)numFrames * totalTableSize; }
+
+    const int index;
+    const juce::String name;
+    const int numFrames;
+
+private:
+    friend class WavetableLibrary;
+
+    juce::HeapBlock<float> samples;
+
+    JUCE_DECLARE_NON_COPYABLE(LoadedWavetable)
+};
+
+//==============================================================================
+/** A list of wavetable WAV files, and a bounded cache of the ones that have been
+    decoded.
+
+    Adding a directory only queues it: the background thread lists the files, and
+    nothing is opened until a table is asked for, so startup costs the same however
+    big the library is. The first request for a table memory-maps its file, decodes
+    and band-limits every frame on the background thread, and then calls back on the
+    message thread. After that the table is served from the cache, which throws out
+    the least recently used tables once it's over its size budget. Tables that are
+    still referenced (normally the one that's playing) are never thrown out.
+
+    A file can hold any whole number of frames of tableSize samples, up to maxFrames,
+    as wavetable synths usually write them. A file shorter than tableSize whose length
+    is a power of two is taken as a single cycle. Anything else is skipped.
+
+    Everything here is for the message thread, apart from getCachedTable() and
+    prefetch(), which any thread except the audio thread may call.
+*/
+class WavetableLibrary : private juce::Thread,
+    private juce::AsyncUpdater
+{
+public:
+    static constexpr int maxFrames = 256;
+
+    //==============================================================================
+    explicit WavetableLibrary(size_t cacheBudgetInBytes = (size_t)256 * 1024 * 1024)
+        : juce::Thread("Wavetable loader"),
+          cacheBudget(cacheBudgetInBytes)
+    {
+        startThread(3);
+    }
+
+    ~WavetableLibrary() override
+    {
+        cancelPendingUpdate();
+        stopThread(4000);
+    }
+
+    /** Called on the message thread whenever a directory scan adds tables. */
+    std::function<void()> onLibraryChanged;
+
+    //==============================================================================
+    /** Queues every .wav file in directory and its subdirectories to be added. */
+    void addDirectory(const juce::File& directory)
+    {
+        {
+            const juce::ScopedLock sl(lock);
+            directoriesToScan.add(directory);
+        }
+
+        notify();
+    }
+
+    int getNumTables() const
+    {
+        const juce::ScopedLock sl(lock);
+        return files.size();
+    }
+
+    juce::String getTableName(int index) const
+    {
+        const juce::ScopedLock sl(lock);
+        return files[index].getFileNameWithoutExtension();
+    }
+
+    /** True while there are directories to scan or tables to decode. */
+    bool isBusy() const
+    {
+        const juce::ScopedLock sl(lock);
+        return busy || ! directoriesToScan.isEmpty() || ! tablesToLoad.isEmpty();
+    }
+
+    //==============================================================================
+    /** Calls onLoaded with table index on the message thread: straight away if it's
+        cached, otherwise once the background thread has decoded it. If the file can't
+        be read, onLoaded gets nullptr.
+    */
+    void loadTable(int index, std::function<void(LoadedWavetable::Ptr)> onLoaded)
+    {
+        if (auto table = getCachedTable(index))
+        {
+            onLoaded(table);
+            return;
+        }
+
+        pendingCallbacks.add({ index, std::move(onLoaded) });
+        prefetch(index);
+    }
+
+    /** The table if it's cached, marked as the most recently used, or nullptr. */
+    LoadedWavetable::Ptr getCachedTable(int index)
+    {
+        const juce::ScopedLock sl(lock);
+
+        for (int i = cache.size(); --i >= 0;)
+        {
+            if (cache.getUnchecked(i)->index == index)
+            {
+                cache.move(i, -1);
+                return cache.getLast();
+            }
+        }
+
+        return nullptr;
+    }
+
+    /** Starts decoding table index in the background, unless it's cached or queued. */
+    void prefetch(int index)
+    {
+        {
+            const juce::ScopedLock sl(lock);
+
+            if (! juce::isPositiveAndBelow(index, files.size()) || tablesToLoad.contains(index))
+                return;
+
+            for (auto* table : cache)
+                if (table->index == index)
+                    return;
+
+            tablesToLoad.add(index);
+        }
+
+        notify();
+    }
+
+    //==============================================================================
+    size_t getCachedBytes() const
+    {
+        const juce::ScopedLock sl(lock);
+        return cachedBytes;
+    }
+
+    int getNumCachedTables() const
+    {
+        const juce::ScopedLock sl(lock);
+        return cache.size();
+    }
+
+    int getNumEvictions() const noexcept    { return numEvictions.load(); }
+
+    //==============================================================================
+    /** Decodes file into a new table, or returns nullptr if it isn't a wavetable. The
+        file is memory-mapped, so only the pages that are read are ever touched.
+    */
+    static LoadedWavetable::Ptr decode(const juce::File& file, int index)
+    {
+        juce::WavAudioFormat wav;
+        std::unique_ptr<juce::MemoryMappedAudioFormatReader> reader(wav.createMemoryMappedReader(file));
+
+        if (reader == nullptr || reader->numChannels == 0 || ! reader->mapEntireFile())
+            return nullptr;
+
+        auto length = reader->lengthInSamples;
+        int frameLength;
+
+        if (length >= (juce::int64)tableSize && length % (juce::int64)tableSize == 0)
+            frameLength = (int)tableSize;
+        else if (length > 1 && length < (juce::int64)tableSize && juce::isPowerOfTwo((int)length))
+            frameLength = (int)length;
+        else
+            return nullptr;
+
+        auto numFrames = (int)juce::jmin((juce::int64)maxFrames, length / frameLength);
+        LoadedWavetable::Ptr table(new LoadedWavetable(index, file.getFileNameWithoutExtension(), numFrames));
+
+        juce::AudioBuffer<float> cycle(1, frameLength);
+        std::vector<std::complex<float>> harmonics(MipmappedFrameWriter::numHarmonics + 1);
+        MipmappedFrameWriter writer;
+
+        for (int frame = 0; frame < numFrames; ++frame)
+        {
+            reader->read(&cycle, 0, frameLength, (juce::int64)frame * frameLength, true, false);
+            writer.analyse(cycle.getReadPointer(0), frameLength, harmonics.data());
+            writer.write(harmonics.data(), table->samples, frame, numFrames);
+        }
+
+        normalise(*table);
+        return table;
+    }
+
+private:
+    //==============================================================================
+    struct PendingCallback
+    {
+        int index;
+        std::function<void(LoadedWavetable::Ptr)> onLoaded;
+    };
+
+    void run() override
+    {
+        while (! threadShouldExit())
+        {
+            juce::File directory;
+            juce::File file;
+            int index = -1;
+
+            {
+                const juce::ScopedLock sl(lock);
+                busy = false;
+
+                if (! directoriesToScan.isEmpty())
+                {
+                    directory = directoriesToScan.removeAndReturn(0);
+                    busy = true;
+                }
+                else if (! tablesToLoad.isEmpty())
+                {
+                    index = tablesToLoad.removeAndReturn(0);
+                    file = files[index];
+                    busy = true;
+                }
+            }
+
+            if (directory != juce::File())
+                scan(directory);
+            else if (index >= 0)
+                load(file, index);
+            else
+                wait(-1);
+        }
+    }
+
+    void scan(const juce::File& directory)
+    {
+        auto found = directory.findChildFiles(juce::File::findFiles, true, "*.wav");
+        found.sort();
+
+        {
+            const juce::ScopedLock sl(lock);
+            files.addArray(found);
+        }
+
+        libraryChanged = true;
+        triggerAsyncUpdate();
+    }
+
+    void load(const juce::File& file, int index)
+    {
+        auto table = decode(file, index);
+
+        const juce::ScopedLock sl(lock);
+
+        if (table != nullptr)
+        {
+            cache.add(table);
+            cachedBytes += table->getSizeInBytes();
+            evictUntilWithinBudget();
+        }
+        else
+        {
+            failedTables.add(index);
+        }
+
+        triggerAsyncUpdate();
+    }
+
+    /** Drops the least recently used tables nobody else holds. Call with the lock held. */
+    void evictUntilWithinBudget()
+    {
+        for (int i = 0; i < cache.size() && cachedBytes > cacheBudget;)
+        {
+            auto* table = cache.getUnchecked(i);
+
+            if (table->getReferenceCount() > 1)
+            {
+                ++i;
+                continue;
+            }
+
+            cachedBytes -= table->getSizeInBytes();
+            cache.remove(i);
+            ++numEvictions;
+        }
+    }
+
+    void handleAsyncUpdate() override
+    {
+        if (libraryChanged.exchange(false) && onLibraryChanged != nullptr)
+            onLibraryChanged();
+
+        juce::Array<int> failed;
+
+        {
+            const juce::ScopedLock sl(lock);
+            failed.swapWith(failedTables);
+        }
+
+        // a callback can ask for another table, which adds to the list
+        for (int i = 0; i < pendingCallbacks.size();)
+        {
+            auto index = pendingCallbacks.getReference(i).index;
+            auto table = getCachedTable(index);
+
+            if (table == nullptr && ! failed.contains(index))
+            {
+                ++i;
+                continue;
+            }
+
+            auto onLoaded = std::move(pendingCallbacks.getReference(i).onLoaded);
+            pendingCallbacks.remove(i);
+            onLoaded(table);
+        }
+    }
+
+    /** Scales the table so its loudest frame peaks at 0.6, like the built-in one. */
+    static void normalise(LoadedWavetable& table)
+    {
+        auto level0 = table.getTable();
+        auto peak = 0.0f;
+
+        for (size_t i = 0; i < level0.getLevelStride(); ++i)
+            peak = juce::jmax(peak, std::abs(level0.samples[i]));
+
+        if (peak <= 0.0f)
+            return;
+
+        juce::FloatVectorOperations::multiply(table.samples.get(), 0.6f / peak,
+                                              (int)(table.getSizeInBytes() / sizeof(float)));
+    }
+
+    //==============================================================================
+    juce::CriticalSection lock;
+    juce::Array<juce::File> files, directoriesToScan;
+    juce::Array<int> tablesToLoad, failedTables;
+    juce::ReferenceCountedArray<LoadedWavetable> cache;    // least recently used first
+    size_t cachedBytes = 0;
+    const size_t cacheBudget;
+    bool busy = false;
+
+    std::atomic<bool> libraryChanged { false };
+    std::atomic<int> numEvictions { 0 };
+    juce::Array<PendingCallback> pendingCallbacks;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(WavetableLibrary)
+};
+
+//==============================================================================
+/** Hands the table to play from the message thread to the audio thread.
+
+    setTable() publishes a table with a new generation number. The audio thread picks
+    up the newest one in acquire() at the start of each block and acknowledges its
+    generation. The tables it might still be reading are kept alive here on the
+    message thread until it has acknowledged a later one, so the audio thread never
+    waits, never takes a reference and never frees a table.
+*/
+class WavetableSwitcher
+{
+public:
+    //==============================================================================
+    /** Makes table the one to play; nullptr means the built-in table. Message thread. */
+    void setTable(LoadedWavetable::Ptr table)
+    {
+        releaseRetiredTables();
+
+        if (current != nullptr)
+            retired.add({ current, latestGeneration + 1 });
+
+        current = table;
+        published.store(table.get(), std::memory_order_release);
+        publishedGeneration.store(++latestGeneration, std::memory_order_release);
+    }
+
+    LoadedWavetable::Ptr getTable() const noexcept    { return current; }
+
+    /** Lets go of tables the audio thread has moved on from. Message thread; call it now
+        and then, e.g. from a timer, so the cache can reuse their memory.
+    */
+    void releaseRetiredTables()
+    {
+        auto acknowledged = acknowledgedGeneration.load(std::memory_order_acquire);
+
+        for (int i = retired.size(); --i >= 0;)
+            if (retired.getReference(i).replacedInGeneration <= acknowledged)
+                retired.remove(i);
+    }
+
+    //==============================================================================
+    /** The table to play for this block. Audio thread, once per block. */
+    MipmappedWavetable acquire() noexcept
+    {
+        auto generation = publishedGeneration.load(std::memory_order_acquire);
+
+        if (generation != seenGeneration)
+        {
+            // the table can be newer than generation, never older
+            auto* table = published.load(std::memory_order_acquire);
+            playing = table != nullptr ? table->getTable() : WavetableBank::getInstance().getMasterTable();
+            seenGeneration = generation;
+            acknowledgedGeneration.store(generation, std::memory_order_release);
+        }
+
+        return playing;
+    }
+
+private:
+    //==============================================================================
+    struct RetiredTable
+    {
+        LoadedWavetable::Ptr table;
+        int replacedInGeneration;
+    };
+
+    // message thread
+    LoadedWavetable::Ptr current;
+    juce::Array<RetiredTable> retired;
+    int latestGeneration = 0;
+
+    std::atomic<LoadedWavetable*> published { nullptr };
+    std::atomic<int> publishedGeneration { 0 }, acknowledgedGeneration { 0 };
+
+    // audio thread
+    MipmappedWavetable playing = WavetableBank::getInstance().getMasterTable();
+    int seenGeneration = 0;
+};
+
+#if JUCE_MODULE_AVAILABLE_juce_gui_basics
+
+//==============================================================================
+/** Picks a directory of wavetables and chooses which one the synth plays. */
+class WavetableLibraryPanel : public juce::Component
+{
+public:
+    //==============================================================================
+    WavetableLibraryPanel(WavetableLibrary& libraryToUse, WavetableSwitcher& switcherToUse)
+        : library(libraryToUse), switcher(switcherToUse)
+    {
+        addAndMakeVisible(addDirectoryButton);
+        addDirectoryButton.onClick = [this] { chooseDirectory(); };
+
+        addAndMakeVisible(tableBox);
+        tableBox.onChange = [this] { tableChosen(); };
+
+        addAndMakeVisible(statusLabel);
+
+        library.onLibraryChanged = [this] { updateTableList(); };
+        updateTableList();
+    }
+
+    ~WavetableLibraryPanel() override
+    {
+        library.onLibraryChanged = nullptr;
+    }
+
+    void resized() override
+    {
+        auto r = getLocalBounds();
+        addDirectoryButton.setBounds(r.removeFromLeft(160).reduced(2));
+        statusLabel.setBounds(r.removeFromRight(160));
+        tableBox.setBounds(r.reduced(2));
+    }
+
+private:
+    //==============================================================================
+    static constexpr int builtInTableId = 1;
+
+    void chooseDirectory()
+    {
+        chooser.reset(new juce::FileChooser("Add a directory of wavetables"));
+
+        chooser->launchAsync(juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectDirectories,
+                             [this](const juce::FileChooser& fc)
+                             {
+                                 if (fc.getResult().isDirectory())
+                                     library.addDirectory(fc.getResult());
+                             });
+    }
+
+    void updateTableList()
+    {
+        auto selectedId = tableBox.getSelectedId();
+
+        tableBox.clear(juce::dontSendNotification);
+        tableBox.addItem("Built-in", builtInTableId);
+
+        for (int i = 0; i < library.getNumTables(); ++i)
+            tableBox.addItem(library.getTableName(i), builtInTableId + 1 + i);
+
+        tableBox.setSelectedId(selectedId != 0 ? selectedId : builtInTableId, juce::dontSendNotification);
+    }
+
+    void tableChosen()
+    {
+        auto index = tableBox.getSelectedId() - builtInTableId - 1;
+
+        if (index < 0)
+        {
+            switcher.setTable(nullptr);
+            statusLabel.setText({}, juce::dontSendNotification);
+            return;
+        }
+
+        statusLabel.setText("Loading...", juce::dontSendNotification);
+
+        // carry on playing the old table until the new one is ready
+        library.loadTable(index, [this, index](LoadedWavetable::Ptr table)
+        {
+            if (tableBox.getSelectedId() != builtInTableId + 1 + index)
+                return;
+
+            if (table != nullptr)
+                switcher.setTable(table);
+
+            statusLabel.setText(table != nullptr ? juce::String(table->numFrames) + " frames" : "Unreadable",
+                                juce::dontSendNotification);
+        });
+    }
+
+    //==============================================================================
+    WavetableLibrary& library;
+    WavetableSwitcher& switcher;
+
+    juce::TextButton addDirectoryButton { "Add wavetables..." };
+    juce::ComboBox tableBox;
+    juce::Label statusLabel;
+    std::unique_ptr<juce::FileChooser> chooser;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(WavetableLibraryPanel)
+};
+
+#endif